@@ -12,11 +12,34 @@
 
 
 #include <iostream>
+#include <cstdio>
+#include <algorithm>
 #include <program.h>
 #include <SOIL.h>
 #include <camera.h>
 
 #include <model.h>
+#include <impostor.h>
+#include <chunked_mesh.h>
+#include <scene.h>
+#include <asset_manager.h>
+#include <transform_system.h>
+#include <shader_permutations.h>
+#include <uniform_buffer.h>
+#include <quality.h>
+#include <deferred.h>
+#include <clustered_lighting.h>
+#include <visibility_buffer.h>
+#include <shadow_map.h>
+#include <gpu_profiler.h>
+#include <trace.h>
+#include <render_stats.h>
+#include <hud.h>
+#include <hitch_detector.h>
+#include <metrics_server.h>
+#include <allocation_tracker.h>
+#include <frame_arena.h>
+#include <shader_interfaces.h>
 #include <filesystem.h>
 
 using namespace std;
@@ -27,8 +50,18 @@ static GLFWwindow* window = nullptr;
 static uint16_t window_width = 800, window_height = 600;
 
 // Program (Shaders and models)
-static Program *lampProgram = nullptr, *nanoProgram = nullptr;
-static Model *lampModel = nullptr, *nanoModel = nullptr;
+static Program *lampProgram = nullptr;
+static ShaderPermutations *nanoShaders = nullptr;
+static AssetManager assets;
+static ModelAssetRef lampModel, nanoModel;
+
+// Impostors (far away nanos are drawn as quads)
+static Program *impostorProgram = nullptr;
+static Impostor *nanoImpostor = nullptr;
+static GLfloat impostorDistance = 15.0f;
+
+// Out of core mesh, given with --stream <file.chk>
+static StreamedMesh *streamedMesh = nullptr;
 
 
 // Keyboard and movement
@@ -43,33 +76,84 @@ static bool increase = false;
 static Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 static GLfloat lastX = 0.0f, lastY = 0.0f;
 
-//Lighing and shading
+// Scene
+static Scene scene;
+static uint32_t lampModelId, nanoModelId;
+
+// The lamp (light + cube) and the main nano (its material is what the number keys change)
+static EntityHandle lampEntity, nanoEntity;
+
+// Crowd of nanos (toggled with 'C'), placed on a grid behind the main one.
+static vector<EntityHandle> crowd;
+static const int CROWD_SIDE = 20;
+static const GLfloat CROWD_SPACING = 1.5f;
+
+// Matrices of every draw, computed once per frame
+static TransformSystem *transforms = nullptr;
+
+// Shading quality of the nanos ('T' cycles the tiers, 'Y' toggles the automatic selection)
+static QualityController quality;
+
+// How the nanos are lit ('G' cycles): the frame block lights only, clustered forward, deferred, or
+// through a visibility buffer (frame block lights, each pixel shaded once)
+enum LightingPath {
+	LIGHTING_FORWARD,
+	LIGHTING_CLUSTERED,
+	LIGHTING_DEFERRED,
+	LIGHTING_VISIBILITY,
+	LIGHTING_PATH_COUNT
+};
+static LightingPath lightingPath = LIGHTING_FORWARD;
+static DeferredRenderer *deferred = nullptr;
+static ClusteredLighting *clustered = nullptr;
+static VisibilityRenderer *visibility = nullptr;
+
+// Depth pre-pass before the forward paths ('P'): positions only, then shading with GL_EQUAL depth tests
+static bool depthPrepass = false;
+static Program *depthProgram = nullptr;
+
+// Shadows of the lamp in the forward path ('O')
+static bool shadows = true;
+static ShadowMap *shadowMap = nullptr;
+
+// GPU time of the frame and of its passes, logged every few seconds
+static GpuProfiler *gpuProfiler = nullptr;
 
-// Lamp
-typedef struct Lamp {
+// Performance overlay ('H'), with the frame times (ms) of the last frames
+static Hud *hud = nullptr;
+static vector<GLfloat> frameTimes(120, 0.0f);
+static size_t nextFrameTime = 0;
+static size_t frameTimesFilled = 0;     // Until the ring wraps, only [0, frameTimesFilled) are frame times
 
-	glm::vec3 position = glm::vec3 (3.0f, +2.75f, 0.0f);
-	glm::vec3 color = glm::vec3 ( 1.0f, 1.0f , 1.0f);
+// Frames over twice the median, reported in hitch_report.txt on exit
+static HitchDetector hitchDetector;
 
-	glm::vec3 ambient = color * glm::vec3(0.8f, 0.8f, 0.8f);
-	glm::vec3 diffuse = color * glm::vec3(0.5f, 0.5f, 0.5f);
-	glm::vec3 specular = color * glm::vec3(1.0f, 1.0f, 1.0f);
-}Lamp;
+// Prometheus metrics, served when given --metrics <host:port | unix:path>
+static MetricsServer *metricsServer = nullptr;
+static uint64_t frameCount = 0;
+static double frameSeconds = 0.0;
 
-// Object
-typedef struct Nano {
+// With --alloc-check <frames>, runs that many frames once warmed up and fails if any of them allocated
+// (needs a build with TRACK_ALLOCATIONS)
+static const uint64_t ALLOCATION_CHECK_WARMUP = 300;
+static uint64_t allocationCheckFrames = 0;
+static uint64_t allocatingFrames = 0;
 
-	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0);
-	glm::vec3 ambient = glm::vec3(1.0f, 1.0f, 1.0);
-	glm::vec3 diffuse = glm::vec3(1.0f, 0.5f, 0.31);
-	glm::vec3 specular = glm::vec3(0.5f, 0.5f, 0.5f);
-	float shininess = 4.0f;
+// Field of small coloured lights ('L' cycles its sizes), only the clustered and deferred paths shade them
+static vector<EntityHandle> lightField;
+static const int LIGHT_FIELD_SIDES[] = { 0, 8, 32, 64 };
+static int lightFieldSize = 0;
 
-}Nano;
+// Projection planes
+static const GLfloat Z_NEAR = 0.1f, Z_FAR = 100.0f;
 
+// Camera and lights, shared by all the programs through the Frame uniform block
+static FrameBlock frame;
+static UniformBuffer<FrameBlock> *frameUniforms = nullptr;
 
-static Lamp lamp;
-static Nano nano;
+// Per frame lists, kept to reuse their memory
+static vector<DrawItem> drawList;
+static vector<vector<glm::vec4> > impostorInstances;
 
 
 
@@ -98,8 +182,27 @@ static void	doZoom();
 static void updateLights();
 static void updateUniforms();
 
-static void drawLamp();
-static void drawNano();
+static void createScene();
+static void toggleCrowd();
+static void toggleLightField();
+static void animateLamp();
+static void animateLightField();
+
+// Which part of the draw list drawItems() draws
+enum DrawPass {
+	PASS_ALL,		// Everything, forward shaded
+	PASS_GBUFFER,	// Models drawn with shader variants, into the G-buffer
+	PASS_FORWARD	// The others (the lamp), forward shaded after the deferred or visibility passes
+};
+
+static void setEntityUniforms(Program* program, uint32_t i);
+static void drawDepthPrepass();
+static void drawItems(DrawPass pass);
+static void drawScene();
+static glm::mat4 streamedModelMatrix();
+static void drawStreamed(GLint drawIndex);
+static void drawHud();
+static void publishMetrics();
 
 
 
@@ -157,6 +260,54 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		return;
 	}
 
+	if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		toggleCrowd();
+	}
+
+	if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		static const char* names[LIGHTING_PATH_COUNT] = { "forward", "clustered forward", "deferred", "visibility buffer" };
+		lightingPath = (LightingPath)((lightingPath + 1) % LIGHTING_PATH_COUNT);
+		cout << "Lighting: " << names[lightingPath] << endl;
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		depthPrepass = !depthPrepass;
+		cout << "Depth pre-pass: " << (depthPrepass ? "on" : "off") << endl;
+	}
+	if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		shadows = !shadows;
+		cout << "Shadows: " << (shadows ? "on" : "off") << endl;
+	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+		toggleLightField();
+	}
+
+	if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		quality.nextTier();
+	}
+	if (key == GLFW_KEY_Y && action == GLFW_PRESS) {
+		quality.automatic = !quality.automatic;
+		cout << "Automatic shading quality: " << (quality.automatic ? "on" : "off") << endl;
+	}
+
+	if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		hud->visible = !hud->visible;
+	}
+
+	// Driver work of the last frame
+	if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		cout << "Last frame: " << RenderStats::lastFrame.summary() << endl;
+	}
+
+	// Memory of every asset, to compare with the process RSS
+	if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+		cout << assets.memoryReport() << "Resident: " << residentBytes() / 1048576.0 << " MiB" << endl;
+	}
+
+	// Everything traced so far (startup included, until the per thread rings wrap), for chrome://tracing or Perfetto
+	if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+		Trace::write("trace.json");
+	}
+
 	if (key >= 0 && key <= 1024) {
 
 		if (action == GLFW_PRESS) {
@@ -218,6 +369,7 @@ void window_size_callback(GLFWwindow* window, int width, int height)
 
 static void doMovement()
 {
+	TraceScope trace("doMovement");
 	GLfloat doubleTime = (pressedKeys[GLFW_KEY_LEFT_SHIFT]) ? 2.0f : 1.0f;
 	GLfloat currentFrame = glfwGetTime();
 	deltaTime = currentFrame - lastFrame;
@@ -252,6 +404,9 @@ static void doZoom()
 static void
 updateLights()
 {
+	TraceScope trace("updateLights");
+	MaterialOverride& nano = scene.materials[scene.indexOf(nanoEntity)];
+
 	if (pressedKeys[GLFW_KEY_8]) {
 		updateVector3f(nano.ambient, INCREASE, 0.002, 1.0);
 	}
@@ -282,34 +437,135 @@ updateLights()
 
 static void updateUniforms()
 {
-
+	TraceScope trace("updateUniforms");
+	uint32_t l = scene.indexOf(lampEntity);
+	const glm::vec3& lampPosition = scene.positions[l];
+	const LightParams& lamp = scene.lights[l];
 
 	// For Lamp module
 	lampProgram->use();
-	lampProgram->setVec3("lamp.position", lamp.position.x, lamp.position.y, lamp.position.z);
-	lampProgram->setVec3("lamp.color", lamp.color.x, lamp.color.y, lamp.color.z);
-
-	// For Nano Module
-	nanoProgram->use();
-	nanoProgram->setVec3("viewPos", camera.position);
-	nanoProgram->setVec3("light.position", lamp.position);
-	nanoProgram->setVec3("light.ambient", lamp.ambient);
-	nanoProgram->setVec3("light.diffuse", lamp.diffuse);
-	nanoProgram->setVec3("light.specular", lamp.specular);
-	nanoProgram->setVec3("g_color", nano.color);
-	nanoProgram->setVec3("g_ambient", nano.ambient);
-	nanoProgram->setVec3("g_diffuse", nano.diffuse);
-	nanoProgram->setVec3("g_specular", nano.specular);
-	nanoProgram->setFloat("g_shininess", nano.shininess);
+	lampProgram->set(Uniforms::lamp_position, lampPosition);
+
+	// For the Nano (every variant) and the impostors
+	frame.projection = glm::perspective(camera.zoom, (float)window_width/(float)window_height, Z_NEAR, Z_FAR);
+	frame.view = camera.getViewMatrix();
+	frame.viewPos = camera.position;
+	frame.lights[0].position = lampPosition;
+	frame.lights[0].ambient = lamp.ambient;
+	frame.lights[0].diffuse = lamp.diffuse;
+	frame.lights[0].specular = lamp.specular;
+	frameUniforms->upload(frame);
+}
+
+
 
+
+static void
+createScene()
+{
+	lampModelId = scene.addModel(lampModel, lampProgram);
+	nanoModelId = scene.addModel(nanoModel, nanoShaders, nanoImpostor);
+
+	ModelInstance lamp;
+	lamp.asset = lampModel;
+	lamp.flags = ENTITY_LIGHT;
+	lamp.position = glm::vec3(3.0f, 2.75f, 0.0f);
+	lamp.scale = glm::vec3(0.2f);	// It's a bit too big for our scene, so scale it down
+	lampEntity = scene.spawn(lamp);
+	// Lights the whole scene, as in the forward path
+	scene.lights[scene.indexOf(lampEntity)].radius = 100.0f;
+
+	ModelInstance nano;
+	nano.asset = nanoModel;
+	nano.flags = ENTITY_MATERIAL | ENTITY_STATIC;
+	nano.position = glm::vec3(0.0f, 0.25f, 0.0f);	// Translate it up a bit so it's at the center of the scene
+	nano.scale = glm::vec3(0.2f);	// It's a bit too big for our scene, so scale it down
+	nanoEntity = scene.spawn(nano);
 }
 
 
+static void
+toggleCrowd()
+{
+	// The crowd is static geometry, the cached shadow faces are out of date either way
+	shadowMap->invalidateStatic();
+
+	if (!crowd.empty()) {
+		for (EntityHandle handle : crowd) {
+			scene.destroy(handle);
+		}
+		crowd.clear();
+		return;
+	}
+
+	// Every member shares the nano asset, only the placement differs
+	ModelInstance member;
+	member.asset = nanoModel;
+	member.flags = ENTITY_MATERIAL | ENTITY_STATIC;
+	member.scale = glm::vec3(0.2f);
+
+	for (int i = 0; i < CROWD_SIDE * CROWD_SIDE; i++) {
+		member.position = glm::vec3((i % CROWD_SIDE - CROWD_SIDE / 2) * CROWD_SPACING,
+									0.25f,
+									-(i / CROWD_SIDE + 2) * CROWD_SPACING);
+		crowd.push_back(scene.spawn(member));
+	}
+}
 
 
+// Light only entities (no model), above the crowd: none, then 8 x 8, 32 x 32 and 64 x 64 of them
 static void
-drawLamp()
+toggleLightField()
 {
+	for (EntityHandle handle : lightField) {
+		scene.destroy(handle);
+	}
+	lightField.clear();
+
+	lightFieldSize = (lightFieldSize + 1) % (sizeof(LIGHT_FIELD_SIDES) / sizeof(LIGHT_FIELD_SIDES[0]));
+	int side = LIGHT_FIELD_SIDES[lightFieldSize];
+	cout << "Light field: " << side * side << " lights" << endl;
+
+	for (int i = 0; i < side * side; i++) {
+		EntityHandle handle = scene.create(ENTITY_LIGHT);
+		LightParams& light = scene.lights[scene.indexOf(handle)];
+
+		// Fully saturated hues around the color wheel
+		GLfloat hue = (GLfloat)i / (side * side) * 6.0f;
+		light.color = glm::clamp(glm::vec3(fabs(hue - 3.0f) - 1.0f, 2.0f - fabs(hue - 2.0f), 2.0f - fabs(hue - 4.0f)),
+								 0.0f, 1.0f);
+		light.ambient = glm::vec3(0.0f);
+		light.diffuse = light.color;
+		light.specular = light.color;
+		light.radius = 20.0f / side;
+		lightField.push_back(handle);
+	}
+	animateLightField();
+}
+
+
+static void
+animateLightField()
+{
+	GLfloat time = glfwGetTime();
+	GLint side = LIGHT_FIELD_SIDES[lightFieldSize];
+	GLfloat spacing = CROWD_SIDE * CROWD_SPACING / max(side, 1);
+
+	for (size_t i = 0; i < lightField.size(); i++) {
+		GLfloat phase = i * 0.7f;
+		glm::vec3& position = scene.positions[scene.indexOf(lightField[i])];
+		position.x = ((GLint)i % side - side / 2 + 0.5f) * spacing + sin(time + phase) * spacing;
+		position.y = 1.0f + 0.5f * sin(time * 1.3f + phase);
+		position.z = -((GLint)i / side + 0.5f) * spacing - 2.0f * CROWD_SPACING + cos(time + phase) * spacing;
+	}
+}
+
+
+static void
+animateLamp()
+{
+	uint32_t l = scene.indexOf(lampEntity);
+	LightParams& lamp = scene.lights[l];
 
 //	lamp.color.x = max(sin(glfwGetTime() * 0.5f), 0.0f);
 //	lamp.color.y = max(cos(glfwGetTime() * 0.3f), 0.0f);
@@ -320,51 +576,365 @@ drawLamp()
 	lamp.diffuse = lamp.color * glm::vec3(0.5f, 0.5f, 0.5f);
 	lamp.specular = lamp.color * glm::vec3(1.0f, 1.0f, 1.0f);
 
-	lamp.position.x = sin(glfwGetTime() * 0.5f);
-	lamp.position.z = cos(glfwGetTime() * 0.5f);
+	scene.positions[l].x = sin(glfwGetTime() * 0.5f);
+	scene.positions[l].z = cos(glfwGetTime() * 0.5f);
+}
+
+
+static void
+setMaterialUniforms(Program* program, const MaterialOverride& material)
+{
+	program->set(Uniforms::g_color, material.color);
+	program->set(Uniforms::g_ambient, material.ambient);
+	program->set(Uniforms::g_diffuse, material.diffuse);
+	program->set(Uniforms::g_specular, material.specular);
+	program->set(Uniforms::g_shininess, material.shininess);
+}
 
 
+// Per entity uniforms of the current program: its draw index and what its flags say it has
+static void
+setEntityUniforms(Program* program, uint32_t i)
+{
+	program->set(Uniforms::drawIndex, (GLint)i);
 
+	if (scene.flags[i] & ENTITY_LIGHT) {
+		program->set(Uniforms::lamp_color, scene.lights[i].color);
+	}
+	if (scene.flags[i] & ENTITY_MATERIAL) {
+		setMaterialUniforms(program, scene.materials[i]);
+	}
+}
 
-	lampProgram->use();   // <-- Don't forget this one!
-	// Transformation matrices
-	glm::mat4 projection = glm::perspective(camera.zoom, (float)window_width/(float)window_height, 0.1f, 100.0f);
-	glm::mat4 view = camera.getViewMatrix();
 
-	lampProgram->setMat4("projection", projection);
-	lampProgram->setMat4("view", view);
+static void
+drawScene()
+{
+	TraceScope trace("drawScene");
+	// Transformation matrices (set by updateUniforms())
+	const glm::mat4& projection = frame.projection;
+	const glm::mat4& view = frame.view;
+
+	scene.updateTransforms();
+	scene.cull(projection * view);
+	scene.buildDrawList(camera.position, drawList, impostorInstances);
+
+	// Every entity's matrices at once (entity i is draw index i), then the draws outside the scene
+	transforms->update(scene, view, projection);
+	GLint streamedIndex = -1;
+	if (streamedMesh && streamedMesh->isOpen()) {
+		streamedIndex = transforms->push(streamedModelMatrix(), view, projection);
+	}
+	transforms->upload();
 
-	// Draw the loaded model
-	glm::mat4 model;
-	model = glm::translate(model, lamp.position); // Translate it down a bit so it's at the center of the scene
-	model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));	// It's a bit too big for our scene, so scale it down
+	// Only the forward path has shadows
+	if (shadows && lightingPath == LIGHTING_FORWARD) {
+		GpuScope scope(*gpuProfiler, "shadows");
+		shadowMap->update(scene, scene.positions[scene.indexOf(lampEntity)], *transforms);
+	}
+
+	if (lightingPath == LIGHTING_CLUSTERED) {
+		clustered->update(scene, view, projection, Z_NEAR, Z_FAR, window_width, window_height);
+	}
+
+	if (lightingPath == LIGHTING_DEFERRED) {
+		gpuProfiler->begin("gbuffer");
+		deferred->beginGeometry();
+		drawItems(PASS_GBUFFER);
+		gpuProfiler->end();
+		gpuProfiler->begin("lights");
+		deferred->shadeLights(scene, view, projection);
+		gpuProfiler->end();
+		GpuScope scope(*gpuProfiler, "forward");
+		drawItems(PASS_FORWARD);
+	}
+	else if (lightingPath == LIGHTING_VISIBILITY) {
+		gpuProfiler->begin("visibility");
+		visibility->render(scene, drawList, *transforms);
+		gpuProfiler->end();
+		GpuScope scope(*gpuProfiler, "forward");
+		drawItems(PASS_FORWARD);
+	}
+	else if (depthPrepass) {
+		// Only the nearest surface of each pixel is shaded
+		gpuProfiler->begin("prepass");
+		drawDepthPrepass();
+		gpuProfiler->end();
+		GpuScope scope(*gpuProfiler, "forward");
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+		drawItems(PASS_ALL);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+	}
+	else {
+		GpuScope scope(*gpuProfiler, "forward");
+		drawItems(PASS_ALL);
+	}
+
+	// Draw all the far away ones at once
+	gpuProfiler->begin("impostors");
+	for (size_t m = 0; m < impostorInstances.size(); m++) {
+		if (impostorInstances[m].empty()) {
+			continue;
+		}
+		scene.modelTable[m].impostor->draw(*impostorProgram, impostorInstances[m]);
+	}
+	gpuProfiler->end();
 
-	lampProgram->setMat4("model", model);
-	lampModel->draw(*lampProgram);
+	if (streamedIndex >= 0) {
+		GpuScope scope(*gpuProfiler, "streamed");
+		drawStreamed(streamedIndex);
+	}
 }
 
-static void drawNano()
+
+static void
+drawDepthPrepass()
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	depthProgram->use();
+	transforms->bind(*depthProgram);
+
+	for (const DrawItem& item : drawList) {
+		uint32_t i = item.index;
+		depthProgram->set(Uniforms::drawIndex, (GLint)i);
+		for (const Mesh& mesh : scene.modelTable[scene.models[i]].model->meshes) {
+			mesh.drawPositions();
+		}
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+
+static void
+drawItems(DrawPass pass)
 {
+	// The draw list is sorted by program, switch only when it changes
+	Program* program = nullptr;
+	for (const DrawItem& item : drawList) {
+		uint32_t i = item.index;
+		const ModelEntry& entry = scene.modelTable[scene.models[i]];
+		if ((pass == PASS_GBUFFER && !entry.shaders) || (pass == PASS_FORWARD && entry.shaders)) {
+			continue;
+		}
+
+		// Models drawn with shader variants may switch program between their meshes
+		bool entityUniformsSet = false;
+		// Only the models drawn with shader variants follow the quality tier, the G-buffer needs the full one
+		QualityTier tier = (entry.shaders && pass != PASS_GBUFFER) ? quality.tier : QUALITY_FULL;
+		// The cheaper tiers keep the frame block lights
+		bool clusteredMesh = entry.shaders && lightingPath == LIGHTING_CLUSTERED && tier == QUALITY_FULL;
+		bool shadowedMesh = entry.shaders && shadows && lightingPath == LIGHTING_FORWARD && tier == QUALITY_FULL;
+		for (const Mesh& mesh : entry.model->meshes) {
+			Program* meshProgram = entry.program;
+			if (pass == PASS_GBUFFER) {
+				meshProgram = entry.shaders->get(mesh.shaderFeatures | SHADER_GBUFFER);
+			}
+			else if (clusteredMesh) {
+				meshProgram = entry.shaders->get(mesh.shaderFeatures | SHADER_CLUSTERED);
+			}
+			else if (entry.shaders) {
+				meshProgram = entry.shaders->get(tierShaderFeatures(tier, mesh.shaderFeatures) |
+												 (shadowedMesh ? SHADER_SHADOWS : 0));
+			}
+			if (meshProgram != program) {
+				program = meshProgram;
+				program->use();
+				transforms->bind(*program);
+				if (clusteredMesh) {
+					clustered->bind(*program);
+				}
+				if (shadowedMesh) {
+					shadowMap->bind(*program);
+				}
+				entityUniformsSet = false;
+			}
+
+			if (!entityUniformsSet) {
+				setEntityUniforms(program, i);
+				entityUniformsSet = true;
+			}
+
+			mesh.draw(*program, tier);
+		}
+	}
+}
 
-	nanoProgram->use();   // <-- Don't forget this one!
-	// Transformation matrices
-	glm::mat4 projection = glm::perspective(camera.zoom, (float)window_width/(float)window_height, 0.1f, 100.0f);
-	glm::mat4 view = camera.getViewMatrix();
 
-	nanoProgram->setMat4("projection", projection);
-	nanoProgram->setMat4("view", view);
 
 
-	// Draw the loaded model
+// Fits the whole streamed mesh in a 2 units box at the center of the scene
+static glm::mat4 streamedModelMatrix()
+{
+	glm::vec3 extent = streamedMesh->boundsMax - streamedMesh->boundsMin;
+	GLfloat scale = 2.0f / max(max(extent.x, extent.y), max(extent.z, 1e-6f));
 	glm::mat4 model;
-	model = glm::translate(model, glm::vec3(0.0f, 0.25f, 0.0f)); // Translate it up a bit so it's at the center of the scene
-	model = glm::scale(model, glm::vec3(.2f, .2f, .2f));	// It's a bit too big for our scene, so scale it down
+	model = glm::scale(model, glm::vec3(scale));
+	model = glm::translate(model, -(streamedMesh->boundsMin + streamedMesh->boundsMax) * 0.5f);
+	return model;
+}
 
-	glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(model)));
 
-	nanoProgram->setMat4("model", model);
-	nanoProgram->setMat3("normalMatrix", normalMatrix);
-	nanoModel->draw(*nanoProgram);
+static void drawStreamed(GLint drawIndex)
+{
+	const glm::mat4& projection = frame.projection;
+	const glm::mat4& view = frame.view;
+
+	streamedMesh->update(streamedModelMatrix(), view, projection, camera.position, camera.zoom, window_height);
+
+	// The chunks are untextured
+	Program* program = nanoShaders->get(0);
+	program->use();
+	transforms->bind(*program);
+	program->set(Uniforms::drawIndex, drawIndex);
+	// The nano entity isn't drawn, but its material (and the keys changing it) still applies to what replaces it
+	setMaterialUniforms(program, scene.materials[scene.indexOf(nanoEntity)]);
+	streamedMesh->draw(*program);
+}
+
+
+static void
+drawHud()
+{
+	frameTimes[nextFrameTime] = deltaTime * 1000.0f;
+	nextFrameTime = (nextFrameTime + 1) % frameTimes.size();
+	frameTimesFilled = min(frameTimesFilled + 1, frameTimes.size());
+	if (!hud->visible) {
+		return;
+	}
+
+	GLfloat average = 0.0f;
+	for (size_t i = 0; i < frameTimesFilled; i++) {
+		average += frameTimes[i];
+	}
+	average /= frameTimesFilled;
+
+	size_t meshBytes = 0, textureBytes = 0;
+	for (const ModelEntry& entry : scene.modelTable) {
+		meshBytes += entry.model->meshBytes();
+		textureBytes += entry.model->textureBytes();
+	}
+
+	FrameVector<GpuScopeStats> passes = gpuProfiler->stats();
+	const RenderStats& stats = RenderStats::lastFrame;
+	AllocationCounts allocations = AllocationTracker::lastFrame();
+	size_t lines = passes.size() + (AllocationTracker::enabled() ? 5 : 4);
+
+	GLfloat line = hud->lineHeight();
+	GLfloat graphHeight = 3.0f * line;
+	GLfloat x = 10.0f, y = 10.0f;
+	hud->rect(0.0f, 0.0f, 27.0f * HUD_GLYPH_SIZE * hud->scale + 2.0f * x,
+			  lines * line + graphHeight + 2.0f * y, glm::vec4(0.0f, 0.0f, 0.0f, 0.6f));
+
+	char text[128];
+	snprintf(text, sizeof(text), "%5.1f FPS  %6.2f ms", 1000.0f / max(average, 0.001f), average);
+	hud->text(x, y, text);
+	y += line;
+
+	// Full height is 50 ms, red over 60 Hz
+	hud->graph(x, y, 27.0f * HUD_GLYPH_SIZE * hud->scale, graphHeight - 0.5f * line,
+			   frameTimes, nextFrameTime, 50.0f, 1000.0f / 60.0f);
+	y += graphHeight;
+
+	hud->text(x, y, "pass        cpu ms  gpu ms", glm::vec4(0.7f, 0.7f, 0.7f, 1.0f));
+	y += line;
+	for (const GpuScopeStats& pass : passes) {
+		snprintf(text, sizeof(text), "%-10.10s  %6.2f  %6.2f", pass.name, pass.cpu, pass.avg);
+		hud->text(x, y, text);
+		y += line;
+	}
+
+	snprintf(text, sizeof(text), "%llu draws %llu tris",
+			 (unsigned long long)stats.drawCalls, (unsigned long long)stats.triangles);
+	hud->text(x, y, text);
+	y += line;
+	snprintf(text, sizeof(text), "mesh %.1fM  tex %.1fM", meshBytes / 1048576.0, textureBytes / 1048576.0);
+	hud->text(x, y, text);
+	if (AllocationTracker::enabled()) {
+		y += line;
+		snprintf(text, sizeof(text), "%llu allocs %.1fK",
+				 (unsigned long long)allocations.allocations, allocations.bytes / 1024.0);
+		hud->text(x, y, text, allocations.allocations > 0 ? glm::vec4(1.0f, 0.4f, 0.3f, 1.0f) : glm::vec4(1.0f));
+	}
+
+	GpuScope scope(*gpuProfiler, "hud");
+	hud->draw(window_width, window_height);
+}
+
+
+// Once warmed up, every frame allocating is reported with its tags, until the frames to check are done
+static void
+checkAllocations()
+{
+	if (allocationCheckFrames == 0 || frameCount <= ALLOCATION_CHECK_WARMUP) {
+		return;
+	}
+
+	AllocationCounts counts = AllocationTracker::lastFrame();
+	if (counts.allocations > 0) {
+		allocatingFrames++;
+		cout << "Frame " << frameCount << " allocated " << counts.allocations << " times, " << counts.bytes << " bytes:";
+		for (size_t tag = 0; tag < AllocationTracker::tagCount(); tag++) {
+			AllocationCounts tagCounts = AllocationTracker::lastFrame(tag);
+			if (tagCounts.allocations > 0) {
+				cout << " " << AllocationTracker::tagName(tag) << " " << tagCounts.allocations << " (" << tagCounts.bytes << " bytes)";
+			}
+		}
+		cout << endl;
+	}
+
+	if (frameCount == ALLOCATION_CHECK_WARMUP + allocationCheckFrames) {
+		cout << "Allocation check: " << allocatingFrames << " of " << allocationCheckFrames
+			 << " frames allocated" << endl;
+		glfwSetWindowShouldClose(window, GL_TRUE);
+	}
+}
+
+
+// Hands the metrics server a new snapshot twice a second or so. It only copies numbers, the formatting is
+// done by the server thread.
+static void
+publishMetrics()
+{
+	frameCount++;
+	frameSeconds += deltaTime;
+	if (!metricsServer || frameCount % 30 != 0) {
+		return;
+	}
+
+	MetricsSnapshot& s = metricsServer->snapshot();
+	s.frames = frameCount;
+	s.frameSeconds = frameSeconds;
+
+	// The frame times the HUD keeps, in ms - only the ones recorded so far
+	GLfloat sorted[120];
+	size_t count = min(frameTimesFilled, sizeof(sorted) / sizeof(sorted[0]));
+	copy(frameTimes.begin(), frameTimes.begin() + count, sorted);
+	sort(sorted, sorted + count);
+	const double quantiles[4] = { 0.5, 0.9, 0.99, 1.0 };
+	for (int q = 0; q < 4; q++) {
+		s.frameQuantiles[q] = (count == 0) ? 0.0 : sorted[min(count - 1, (size_t)(quantiles[q] * count))] / 1000.0;
+	}
+
+	s.modelsLoaded = scene.modelTable.size();
+	s.texturesLoaded = 0;
+	s.meshGpuBytes = s.textureGpuBytes = s.meshCpuBytes = 0;
+	for (const ModelEntry& entry : scene.modelTable) {
+		s.texturesLoaded += entry.model->textures_loaded.size();
+		s.meshGpuBytes += entry.model->meshBytes();
+		s.textureGpuBytes += entry.model->textureBytes();
+		s.meshCpuBytes += entry.model->cpuBytes();
+	}
+
+	const vector<AssetLoad>& loads = assets.loads();
+	s.loadCount = min(loads.size(), METRICS_MAX_LOADS);
+	for (uint32_t i = 0; i < s.loadCount; i++) {
+		snprintf(s.loads[i].model, METRICS_NAME_SIZE, "%s", loads[i].path.c_str());
+		s.loads[i].seconds = loads[i].seconds;
+	}
+
+	metricsServer->publish();
 }
 
 
@@ -372,6 +942,13 @@ static void drawNano()
 
 int main(int argc, char* argv[])
 {
+	// Offline conversion to the chunked format used by --stream, no window needed
+	if (argc == 4 && string(argv[1]) == "--build-chunks") {
+		return ChunkedMeshBuilder::build(argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	Trace::setThreadName("main");
+
 	// init glfw
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -415,51 +992,157 @@ int main(int argc, char* argv[])
 	glfwSetWindowSizeCallback(window, window_size_callback);
 
 
-	// load Shaders
+	// load Shaders. They compile in the background while the models load, and are waited for on first use.
+	Program::enableParallelCompile();
 	lampProgram = new Program("shaders/lampShader.vs", "shaders/lampShader.frag");
-	nanoProgram = new Program("shaders/nanoShader.vs", "shaders/nanoShader.frag");
+	nanoShaders = new ShaderPermutations("shaders/nanoShader.vs", "shaders/nanoShader.frag");
+	nanoShaders->get(SHADER_TEXTURED | SHADER_HAS_SPECULAR_MAP);
+	nanoShaders->get(0);
+	impostorProgram = new Program("shaders/impostorShader.vs", "shaders/impostorShader.frag");
+	depthProgram = new Program("shaders/positionOnly.vs", "shaders/depthOnly.frag");
+
+	// Options, before the models load: --mesh-data <keep | collision | none> is what their meshes keep in RAM
+	for (int i = 1; i + 1 < argc; i += 2) {
+		string option = argv[i];
+		if (option == "--stream") {
+			streamedMesh = new StreamedMesh(argv[i + 1]);
+		}
+		else if (option == "--metrics") {
+			metricsServer = new MetricsServer(argv[i + 1]);
+		}
+		else if (option == "--mesh-data") {
+			string keep = argv[i + 1];
+			assets.meshCpuData = (keep == "none") ? MESH_CPU_DROP : (keep == "collision") ? MESH_CPU_COLLISION : MESH_CPU_KEEP;
+		}
+		else if (option == "--alloc-check") {
+			allocationCheckFrames = max(atoi(argv[i + 1]), 1);
+			if (!AllocationTracker::enabled()) {
+				cout << "--alloc-check needs a build with TRACK_ALLOCATIONS (make alloc_check)" << endl;
+				allocatingFrames = 1;
+				glfwSetWindowShouldClose(window, GL_TRUE);
+			}
+		}
+	}
 
 	// load Models
-	lampModel = new Model(FileSystem::getPath("Project_1/resources/objects/cube/cube.obj").c_str());
-	nanoModel = new Model(FileSystem::getPath("Project_1/resources/objects/nanosuit/nanosuit.obj").c_str());
-//	nanoModel = new Model(FileSystem::getPath("Project_1/resources/objects/StreetLamp/StreetLamp.obj").c_str());
-//	nanoModel = new Model(FileSystem::getPath("Project_1/resources/objects/bugatti/bugatti.obj").c_str());
-//	nanoModel = new Model(FileSystem::getPath("Project_1/resources/objects/pencil-obj/pencil.obj").c_str());
-//	nanoModel = new Model(FileSystem::getPath("Project_1/resources/objects/Rabbit/Rabbit.obj").c_str());
+	lampModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/cube/cube.obj"));
+	nanoModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/nanosuit/nanosuit.obj"));
+//	nanoModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/StreetLamp/StreetLamp.obj"));
+//	nanoModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/bugatti/bugatti.obj"));
+//	nanoModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/pencil-obj/pencil.obj"));
+//	nanoModel = assets.loadModel(FileSystem::getPath("Project_1/resources/objects/Rabbit/Rabbit.obj"));
+
+	// Any other variant the nano meshes need, in every quality tier (the common ones are already compiling)
+	for (const Mesh& mesh : nanoModel->meshes) {
+		for (int tier = 0; tier < QUALITY_TIER_COUNT; tier++) {
+			nanoShaders->get(tierShaderFeatures((QualityTier)tier, mesh.shaderFeatures));
+		}
+		nanoShaders->get(mesh.shaderFeatures | SHADER_GBUFFER);
+		nanoShaders->get(mesh.shaderFeatures | SHADER_CLUSTERED);
+		nanoShaders->get(mesh.shaderFeatures | SHADER_SHADOWS);
+	}
+
+	// Capture the nano impostor (uses the nano shaders, so it is lit the same way)
+	nanoImpostor = new Impostor(*nanoModel, *nanoShaders, impostorDistance);
+
+	transforms = new TransformSystem();
+	frameUniforms = new UniformBuffer<FrameBlock>(FRAME_BLOCK_BINDING);
+	deferred = new DeferredRenderer(window_width, window_height);
+	clustered = new ClusteredLighting();
+	visibility = new VisibilityRenderer(window_width, window_height);
+	shadowMap = new ShadowMap();
+	gpuProfiler = new GpuProfiler();
+	hud = new Hud();
+	createScene();
+	if (streamedMesh && streamedMesh->isOpen()) {
+		// The streamed mesh takes the place of the nano
+		scene.flags[scene.indexOf(nanoEntity)] &= ~ENTITY_DRAWABLE;
+	}
 
 
 	// Game loop
 	while(!glfwWindowShouldClose(window))
 	{
+		TraceScope trace("frame");
+		FrameArena::renderThread().reset();
+		gpuProfiler->beginFrame();
 
 		// Clear the colorbuffer
 		glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Check and call events
-		glfwPollEvents();
+		{
+			TraceScope trace("glfwPollEvents");
+			AllocationScope allocations("events");
+			glfwPollEvents();
+		}
 
-		doMovement();
-		doZoom();
+		{
+			AllocationScope allocations("update");
+			doMovement();
+			doZoom();
+			quality.update(deltaTime);
 
-		updateLights();
-		updateUniforms();
+			updateLights();
+			animateLamp();
+			animateLightField();
+			updateUniforms();
+		}
 
-		drawLamp();
-		drawNano();
+		{
+			AllocationScope allocations("drawScene");
+			drawScene();
+		}
+		{
+			AllocationScope allocations("drawHud");
+			drawHud();
+		}
 
 		// Swap the buffers
-		glfwSwapBuffers(window);
+		{
+			TraceScope trace("glfwSwapBuffers");
+			AllocationScope allocations("glfwSwapBuffers");
+			glfwSwapBuffers(window);
+		}
+		{
+			AllocationScope allocations("frame end");
+			RenderStats::endFrame();
+			hitchDetector.endFrame();
+			publishMetrics();
+
+			gpuProfiler->endFrame();
+		}
+		AllocationTracker::endFrame();
+		checkAllocations();
 	}
 
-	glfwTerminate();
+	// GL objects must be released while the context is still alive
+	delete lampProgram; delete nanoShaders; delete impostorProgram; delete depthProgram;
+	// Dropping the last references releases the models
+	scene.clear();
+	lampModel.reset(); nanoModel.reset();
+	delete nanoImpostor;
+	delete streamedMesh;
+	delete transforms;
+	delete frameUniforms;
+	delete deferred;
+	delete clustered;
+	delete visibility;
+	delete shadowMap;
+	delete gpuProfiler;
+	delete hud;
+	delete metricsServer;
 
+	glfwTerminate();
 
-	delete lampProgram; delete nanoProgram;
-	delete lampModel; delete nanoModel;
+	assets.writeLoadReport("load_report.txt");
+	if (hitchDetector.writeReport("hitch_report.txt")) {
+		cout << hitchDetector.hitchCount() << " hitches, see hitch_report.txt" << endl;
+	}
 
 
-	return 0;
+	return (allocatingFrames > 0) ? EXIT_FAILURE : 0;
 }
 
 
@@ -0,0 +1,77 @@
+#version 330 core
+// Light pass of the deferred path: reads the G-buffer written by the GBUFFER variants of nanoShader
+// and adds one light's contribution (blending is additive).
+
+struct LightVolume {
+    vec3 position;      // World space
+    float radius;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform LightVolume light;
+
+uniform sampler2D gAlbedoSpec;      // Diffuse color (rgb), specular intensity (a)
+uniform sampler2D gNormal;          // Octahedral view space normal (rg), shininess (b), ambient factor (a)
+uniform sampler2D gDepth;
+uniform mat4 inverseProjection;
+
+flat in vec3 LightViewPos;
+out vec4 color;
+
+
+vec2 signNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0) {
+		n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+	}
+	return normalize(n);
+}
+
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepth, texel, 0).r;
+	if (depth == 1.0) {
+		discard;	// Background
+	}
+
+	// View space position from the depth
+	vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+	vec4 position = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	vec3 fragPos = position.xyz / position.w;
+
+	vec3 lightVec = LightViewPos - fragPos;
+	float distance = length(lightVec);
+	if (distance >= light.radius) {
+		discard;
+	}
+	// Smooth falloff to zero at the radius
+	float attenuation = 1.0 - (distance * distance) / (light.radius * light.radius);
+	attenuation *= attenuation;
+
+	vec4 albedoSpec = texelFetch(gAlbedoSpec, texel, 0);
+	vec4 normalData = texelFetch(gNormal, texel, 0);
+	vec3 norm = octDecode(normalData.xy * 2.0 - 1.0);
+	float shininess = exp2(normalData.z * 10.0);
+
+	vec3 lightDir = lightVec / distance;
+	vec3 viewDir = normalize(-fragPos);
+	float diff = max(dot(norm, lightDir), 0.0);
+	float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), shininess);
+
+	vec3 ambient = light.ambient * albedoSpec.rgb * normalData.a;
+	vec3 diffuse = diff * light.diffuse * albedoSpec.rgb;
+	vec3 specular = spec * light.specular * albedoSpec.a;
+
+	color = vec4((ambient + diffuse + specular) * attenuation, 1.0);
+}
@@ -0,0 +1,42 @@
+#version 330 core
+// Full screen triangle, no vertex buffer - one draw per light, clipped to the light's scissor rectangle
+
+// Per frame values shared by all the programs, filled from FrameBlock (generated, see the Makefile).
+// The same block must be declared identically in every shader that uses it.
+#define MAX_FRAME_LIGHTS 8
+
+struct PointLight {
+    vec3 position;
+    
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
+struct LightVolume {
+    vec3 position;      // World space
+    float radius;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+uniform LightVolume light;
+
+flat out vec3 LightViewPos;
+
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID >> 1) * 4.0 - 1.0);
+	LightViewPos = vec3(view * vec4(light.position, 1.0));
+	gl_Position = vec4(corner, 0.0, 1.0);
+}
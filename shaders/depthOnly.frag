@@ -0,0 +1,7 @@
+#version 330 core
+// Depth pre-pass: the depth test and writes are all there is
+
+
+void main()
+{
+}
@@ -0,0 +1,23 @@
+#version 330 core
+// The font is one row of 8x8 glyphs (R8, 0 or 255)
+#define HUD_GLYPH_SIZE 8
+
+uniform sampler2D hudFont;
+
+in vec2 GlyphCoords;
+in vec4 Color;
+flat in int Glyph;
+
+out vec4 color;
+
+
+void main()
+{
+	if (Glyph >= 0) {
+		ivec2 texel = ivec2(min(GlyphCoords * HUD_GLYPH_SIZE, vec2(HUD_GLYPH_SIZE - 1)));
+		if (texelFetch(hudFont, ivec2(Glyph * HUD_GLYPH_SIZE + texel.x, texel.y), 0).r < 0.5) {
+			discard;
+		}
+	}
+	color = Color;
+}
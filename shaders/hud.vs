@@ -0,0 +1,23 @@
+#version 330 core
+// One instance per glyph or filled rectangle of the overlay, a triangle strip of 4 vertices each
+layout (location = 0) in vec4 rect;     // Pixels from the top left corner: x, y, width, height
+layout (location = 1) in vec4 color;
+layout (location = 2) in float glyph;   // Index in the font, negative for a filled rectangle
+
+uniform vec2 hudScreenSize;
+
+out vec2 GlyphCoords;
+out vec4 Color;
+flat out int Glyph;
+
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	vec2 pixel = rect.xy + corner * rect.zw;
+
+	GlyphCoords = corner;
+	Color = color;
+	Glyph = int(glyph);
+	gl_Position = vec4(pixel / hudScreenSize * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+}
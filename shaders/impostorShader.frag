@@ -0,0 +1,60 @@
+#version 330 core
+
+// Per frame values shared by all the programs, filled from FrameBlock (generated, see the Makefile).
+// The same block must be declared identically in every shader that uses it.
+#define MAX_FRAME_LIGHTS 8
+
+struct PointLight {
+    vec3 position;
+    
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
+uniform sampler2D colorAtlas;
+uniform sampler2D normalAtlas;
+uniform sampler2D depthAtlas;
+
+uniform float radius;
+uniform float captureNear;
+uniform float captureFar;
+
+
+in vec2 AtlasCoords;
+in vec3 QuadPos;
+flat in vec3 FrameDir;
+flat in vec3 FrameRight;
+flat in vec3 FrameUp;
+flat in float Scale;
+out vec4 color;
+
+
+void main()
+{
+	// Unlit albedo, lit here once
+	vec4 albedo = texture(colorAtlas, AtlasCoords);
+	if (albedo.a < 0.5) {
+		discard;
+	}
+
+	// Normal was captured in the frame's view space
+	vec3 n = texture(normalAtlas, AtlasCoords).xyz * 2.0 - 1.0;
+	vec3 norm = normalize(FrameRight * n.x + FrameUp * n.y + FrameDir * n.z);
+
+	// Depth is linear (orthographic capture), the capture eye was at 2 * radius from the center
+	float eyeDistance = mix(captureNear, captureFar, texture(depthAtlas, AtlasCoords).r);
+	vec3 surfacePos = QuadPos + FrameDir * (2.0 * radius - eyeDistance) * Scale;
+
+	vec3 lightDir = normalize(lights[0].position - surfacePos);
+	float diff = max(dot(norm, lightDir), 0.0);
+
+	color = vec4(albedo.rgb * (lights[0].ambient + diff * lights[0].diffuse), 1.0);
+}
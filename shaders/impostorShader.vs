@@ -0,0 +1,80 @@
+#version 330 core
+layout (location = 0) in vec2 corner;      // Quad corner in [-1, 1]
+layout (location = 1) in vec4 instance;    // World position (xyz) and uniform scale (w)
+
+// Per frame values shared by all the programs, filled from FrameBlock (generated, see the Makefile).
+// The same block must be declared identically in every shader that uses it.
+#define MAX_FRAME_LIGHTS 8
+
+struct PointLight {
+    vec3 position;
+    
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
+/* Impostor properties - see Impostor::capture() */
+uniform vec3 center;
+uniform float radius;
+uniform float framesPerSide;
+uniform float frameInset;       // Part of a frame's side inside its empty border
+
+out vec2 AtlasCoords;
+out vec3 QuadPos;
+flat out vec3 FrameDir;
+flat out vec3 FrameRight;
+flat out vec3 FrameUp;
+flat out float Scale;
+
+
+// Octahedral mapping (y is up), must match the one in impostor.cpp
+vec2 octEncode(vec3 n)
+{
+	n /= (abs(n.x) + abs(n.y) + abs(n.z));
+	vec2 p = n.xz;
+	if (n.y < 0.0) {
+		p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return p;
+}
+
+vec3 octDecode(vec2 p)
+{
+	vec3 n = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+	if (n.y < 0.0) {
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(n);
+}
+
+
+void main()
+{
+	vec3 modelCenter = instance.xyz + center * instance.w;
+	vec3 toEye = normalize(viewPos - modelCenter);
+
+	// Snap to the closest captured frame, and build the quad in that frame's camera basis (as glm::lookAt does)
+	// so the image lines up with the quad.
+	vec2 cell = clamp(floor((octEncode(toEye) * 0.5 + 0.5) * framesPerSide), 0.0, framesPerSide - 1.0);
+	vec3 dir = octDecode((cell + 0.5) / framesPerSide * 2.0 - 1.0);
+	vec3 up = (abs(dir.y) > 0.99) ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(-dir, up));
+	up = cross(right, -dir);
+
+	QuadPos = modelCenter + (right * corner.x + up * corner.y) * radius * instance.w;
+	AtlasCoords = (cell + 0.5 + corner * 0.5 * frameInset) / framesPerSide;
+	FrameDir = dir;
+	FrameRight = right;
+	FrameUp = up;
+	Scale = instance.w;
+
+	gl_Position = projection * view * vec4(QuadPos, 1.0);
+}
@@ -3,9 +3,13 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per draw matrices, computed once per frame on the CPU - see TransformSystem
+#define TRANSFORM_TEXELS 16
+uniform samplerBuffer transforms;
+uniform int drawIndex;
+
+// Same depths as the pre-pass (shaders/positionOnly.vs), for its GL_EQUAL depth test
+invariant gl_Position;
 
 
 //out vec3 Position;
@@ -15,7 +19,10 @@ uniform mat4 projection;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
+    int base = drawIndex * TRANSFORM_TEXELS;
+    mat4 modelViewProjection = mat4(texelFetch(transforms, base + 8), texelFetch(transforms, base + 9),
+                                    texelFetch(transforms, base + 10), texelFetch(transforms, base + 11));
+    gl_Position = modelViewProjection * vec4(position, 1.0f);
     
     //Position = vec3 (model * vec4(position, 1.0f));
     //Normal = itModel * normal;
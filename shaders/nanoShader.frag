@@ -1,5 +1,12 @@
-
 #version 330 core
+// Variants are compiled by ShaderPermutations, which inserts the feature #defines here
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 1
+#endif
+
+// Per frame values shared by all the programs, filled from FrameBlock (generated, see the Makefile).
+// The same block must be declared identically in every shader that uses it.
+#define MAX_FRAME_LIGHTS 8
 
 struct PointLight {
     vec3 position;
@@ -9,17 +16,29 @@ struct PointLight {
     vec3 specular;
 };
 
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
 struct Material {
 
+#ifdef TEXTURED
 	sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
 	sampler2D texture_specular1;
+#endif
+#endif
+#ifdef NORMAL_MAP
+	sampler2D texture_normal1;
+#endif
 
     vec3 ambient;
     vec3 diffuse;
     vec3 specular;    
     float shininess;
-    
-    bool textured;
 };
 
 /* Model properties - not per mesh */
@@ -30,45 +49,74 @@ uniform vec3 g_specular;
 uniform float g_shininess;
  
 
-uniform PointLight light;
 uniform Material material;
-uniform vec3 viewPos; 
+
+#ifdef CLUSTERED
+// Lights of the fragment's cluster - see ClusteredLighting (CLUSTER_GRID_* are defined with the features)
+#define CLUSTER_LIGHT_TEXELS 4
+uniform samplerBuffer clusterLights;    // View space position + radius, ambient, diffuse, specular
+uniform usamplerBuffer clusterRanges;   // Offset in clusterIndices, count
+uniform usamplerBuffer clusterIndices;
+uniform float clusterScale;             // Depth slice = log(depth) * clusterScale + clusterBias
+uniform float clusterBias;
+uniform vec2 clusterTileSize;           // In pixels
+#endif
 
 
 in vec3 Normal;  
 in vec3 FragPos;
 in vec2 TexCoords;  
-out vec4 color;
+#ifdef NORMAL_MAP
+in mat3 TBN;
+#endif
+#ifdef SHADOWS
+in vec3 WorldPos;
 
+// Cube maps of ShadowMap: distance to the light over shadowFar, of the static and of the dynamic casters
+uniform samplerCube shadowStatic;
+uniform samplerCube shadowDynamic;
+uniform vec3 shadowLightPos;
+uniform vec3 shadowStaticLightPos;      // Where the light was when the static cube was rendered
+uniform float shadowFar;
+uniform float shadowBias;
+#endif
+#ifdef GOURAUD
+in vec3 LitAmbientDiffuse;
+in vec3 LitSpecular;
+#endif
+#ifdef GBUFFER
+// Deferred path: the material goes to the G-buffer, see shaders/deferredLight.frag for the encoding
+layout (location = 0) out vec4 gAlbedoSpec;
+layout (location = 1) out vec4 gNormal;
+#elif defined(IMPOSTOR_CAPTURE)
+// Impostor::capture(): unlit albedo, view space normal and linear depth, lit by shaders/impostorShader.frag
+layout (location = 0) out vec4 color;
+layout (location = 1) out vec4 captureNormal;
+layout (location = 2) out float captureDepth;
+#else
+layout (location = 0) out vec4 color;
+#endif
 
 
 
-vec3 calculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewPos)
+
+// The texture samples are the same for every light, so they are taken once by main()
+vec3 calculatePointLight(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir,
+						 vec3 diffuseSample, vec3 specularSample)
 {
 	// ambient
-    vec3 ambient = light.ambient * material.ambient;
-    if (material.textured) {
-    	ambient *= vec3(texture(material.texture_diffuse1, TexCoords));
-    }
+    vec3 ambient = light.ambient * material.ambient * diffuseSample;
     
   	
     // diffuse 
-    vec3 norm = normalize(normal);
     vec3 lightDir = normalize(light.position - fragPos);
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * light.diffuse * material.diffuse;
-    if (material.textured) {
-    	diffuse *= vec3(texture(material.texture_diffuse1, TexCoords));
-    } 
+    vec3 diffuse = diff * light.diffuse * material.diffuse * diffuseSample;
     
     // specular
-    vec3 viewDir = normalize(viewPos - FragPos);
     vec3 reflectDir = reflect(-lightDir, norm);  
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess * g_shininess);
-    vec3 specular = spec * light.specular * material.specular;
-    if (material.textured) {
-    	specular *= vec3(texture(material.texture_specular1, TexCoords));
-    }  
+    vec3 specular = spec * light.specular * material.specular * specularSample;
         
     vec3 result = (g_ambient * ambient + g_diffuse * diffuse + g_specular * specular) * g_color;
     
@@ -78,15 +126,116 @@ vec3 calculatePointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewP
 
 
 
+#ifdef SHADOWS
+// 1 if the fragment sees the shadowed light, 0 if a caster is in between. Each cube is compared against
+// the light position it was rendered from, the static one may lag the light by ShadowMap's maxDrift.
+float shadowFactor(vec3 worldPos)
+{
+	vec3 toFragment = worldPos - shadowLightPos;
+	vec3 toStaticFragment = worldPos - shadowStaticLightPos;
+	bool dynamicShadow = length(toFragment) / shadowFar - shadowBias > texture(shadowDynamic, toFragment).r;
+	bool staticShadow = length(toStaticFragment) / shadowFar - shadowBias > texture(shadowStatic, toStaticFragment).r;
+	return (dynamicShadow || staticShadow) ? 0.0 : 1.0;
+}
+#endif
+
+
+#ifdef GBUFFER
+vec2 signNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n)
+{
+	vec2 p = n.xy / (abs(n.x) + abs(n.y) + abs(n.z));
+	return (n.z <= 0.0) ? (1.0 - abs(p.yx)) * signNotZero(p) : p;
+}
+#endif
+
+
 void main()
 {
+#ifdef TEXTURED
+	vec3 diffuseSample = vec3(texture(material.texture_diffuse1, TexCoords));
+#else
+	vec3 diffuseSample = vec3(1.0);
+#endif
+#if defined(TEXTURED) && defined(HAS_SPECULAR_MAP)
+	vec3 specularSample = vec3(texture(material.texture_specular1, TexCoords));
+#else
+	vec3 specularSample = vec3(1.0);
+#endif
+
+#ifdef NORMAL_MAP
+	vec3 norm = normalize(TBN * (vec3(texture(material.texture_normal1, TexCoords)) * 2.0 - 1.0));
+#else
+	vec3 norm = normalize(Normal);
+#endif
+
+#if defined(GBUFFER)
+	// Same terms as calculatePointLight(), the light pass applies the lights
+	vec3 albedo = g_diffuse * material.diffuse * diffuseSample * g_color;
+	vec3 specularColor = g_specular * material.specular * specularSample * g_color;
+	vec3 ambientRatio = (g_ambient * material.ambient) / max(g_diffuse * material.diffuse, vec3(1e-4));
+
+	gAlbedoSpec = vec4(albedo, clamp(dot(specularColor, vec3(1.0 / 3.0)), 0.0, 1.0));
+	gNormal = vec4(octEncode(norm) * 0.5 + 0.5,
+				   clamp(log2(max(material.shininess * g_shininess, 1.0)) / 10.0, 0.0, 1.0),
+				   clamp(dot(ambientRatio, vec3(1.0 / 3.0)), 0.0, 1.0));
+#elif defined(IMPOSTOR_CAPTURE)
+	color = vec4(g_diffuse * material.diffuse * diffuseSample * g_color, 1.0);
+	captureNormal = vec4(norm * 0.5 + 0.5, 1.0);
+	// The capture is orthographic, so window depth is linear between its near and far planes
+	captureDepth = gl_FragCoord.z;
+#else
+#if defined(UNLIT)
+	vec3 totalLight = diffuseSample * material.diffuse * g_color;
+#elif defined(GOURAUD)
+	vec3 totalLight = LitAmbientDiffuse * diffuseSample + LitSpecular * specularSample;
+#elif defined(CLUSTERED)
+	// Everything is in view space here, the eye is at the origin
+	vec3 viewDir = normalize(-FragPos);
+
+	int slice = clamp(int(log(-FragPos.z) * clusterScale + clusterBias), 0, CLUSTER_GRID_Z - 1);
+	ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	uvec2 range = texelFetch(clusterRanges, tile.x + CLUSTER_GRID_X * (tile.y + CLUSTER_GRID_Y * slice)).xy;
+
+	vec3 totalLight = vec3(0.0);
+	for (uint i = 0u; i < range.y; i++) {
+		int base = int(texelFetch(clusterIndices, int(range.x + i)).x) * CLUSTER_LIGHT_TEXELS;
+		vec4 positionRadius = texelFetch(clusterLights, base);
+		PointLight light = PointLight(positionRadius.xyz,
+									  texelFetch(clusterLights, base + 1).rgb,
+									  texelFetch(clusterLights, base + 2).rgb,
+									  texelFetch(clusterLights, base + 3).rgb);
+
+		// Same falloff as the deferred light pass
+		vec3 toLight = light.position - FragPos;
+		float attenuation = clamp(1.0 - dot(toLight, toLight) / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+		totalLight += attenuation * attenuation *
+					  calculatePointLight(light, norm, FragPos, viewDir, diffuseSample, specularSample);
+	}
+#else
+	vec3 viewDir = normalize(viewPos - FragPos);
 
-	vec3 totalLight;
-	
-	//totalLight = calculateDirectionalLight(light, Normal, FragPos
-	totalLight += calculatePointLight(light, Normal, FragPos, viewPos);
+	vec3 totalLight = vec3(0.0);
+	for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
+		PointLight light = lights[i];
+#ifdef SHADOWS
+		// Only the first light (the lamp) has a shadow map, its ambient term stays
+		if (i == 0) {
+			float lit = shadowFactor(WorldPos);
+			light.diffuse *= lit;
+			light.specular *= lit;
+		}
+#endif
+		totalLight += calculatePointLight(light, norm, FragPos, viewDir, diffuseSample, specularSample);
+	}
+#endif
     
     color = vec4(totalLight, 1.0f);
+#endif
 } 
 
 
@@ -1,39 +1,144 @@
-
 #version 330 core
+// Variants are compiled by ShaderPermutations, which inserts the feature #defines here.
+// GOURAUD and UNLIT (the cheaper quality tiers) read the compact vertex layouts of Mesh::setupLayout().
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 1
+#endif
+
 layout (location = 0) in vec3 position;
+#ifndef UNLIT
 layout (location = 1) in vec3 normal;
+#endif
 layout (location = 2) in vec2 texCoords;
+#ifdef NORMAL_MAP
+layout (location = 3) in vec3 tangent;
+layout (location = 4) in vec3 bitangent;
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+#ifdef NORMAL_MAP
+out mat3 TBN;
+#endif
+#ifdef SHADOWS
+out vec3 WorldPos;
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per draw matrices, computed once per frame on the CPU - see TransformSystem
+#define TRANSFORM_TEXELS 16
+uniform samplerBuffer transforms;
+uniform int drawIndex;
 
-// This is in eye-coordination
-/*
-void main()
-{
-    FragPos = vec3(model * vec4(position, 1.0));
-    Normal = mat3(transpose(inverse(model))) * normal;
-    TexCoords = texCoords;  
+// Same depths as the pre-pass (shaders/positionOnly.vs), for its GL_EQUAL depth test
+invariant gl_Position;
+
+
+#ifdef GOURAUD
+// Lighting is done here, so this stage needs the frame block and the material too (same as nanoShader.frag)
+#define MAX_FRAME_LIGHTS 8
+
+struct PointLight {
+    vec3 position;
     
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
+struct Material {
+
+#ifdef TEXTURED
+	sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
+	sampler2D texture_specular1;
+#endif
+#endif
+#ifdef NORMAL_MAP
+	sampler2D texture_normal1;
+#endif
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;    
+    float shininess;
+};
+
+uniform vec3 g_color;
+uniform vec3 g_ambient;
+uniform vec3 g_diffuse;
+uniform vec3 g_specular;    
+uniform float g_shininess;
+
+uniform Material material;
+
+// The fragment shader multiplies the first one by the diffuse map and adds the second
+out vec3 LitAmbientDiffuse;
+out vec3 LitSpecular;
+#endif
+
+
+mat4 fetchMat4(int texel)
+{
+	return mat4(texelFetch(transforms, texel), texelFetch(transforms, texel + 1),
+				texelFetch(transforms, texel + 2), texelFetch(transforms, texel + 3));
 }
 
+
 // This is in view coorditations
-*/
 void main()
 {
-	vec4 fragPos4 = view * model * vec4(position, 1.0f);
+#ifdef INSTANCED
+	int base = (drawIndex + gl_InstanceID) * TRANSFORM_TEXELS;
+#else
+	int base = drawIndex * TRANSFORM_TEXELS;
+#endif
+	mat4 modelView = fetchMat4(base + 4);
+	mat4 modelViewProjection = fetchMat4(base + 8);
+
+	vec4 fragPos4 = modelView * vec4(position, 1.0f);
     FragPos = vec3(fragPos4) / fragPos4.w;
-    Normal = mat3(transpose(inverse(view * model))) * normal;
+#ifdef SHADOWS
+	WorldPos = vec3(fetchMat4(base) * vec4(position, 1.0f));
+#endif
     TexCoords = texCoords;  
-    
-    gl_Position = projection * view * model * vec4(position, 1.0);
-}
-
+#ifdef UNLIT
+    Normal = vec3(0.0, 0.0, 1.0);
+#else
+	mat3 normalMatrix = mat3(texelFetch(transforms, base + 12).xyz,
+							 texelFetch(transforms, base + 13).xyz,
+							 texelFetch(transforms, base + 14).xyz);
+    Normal = normalMatrix * normal;
+#endif
+#ifdef NORMAL_MAP
+    TBN = mat3(normalize(mat3(modelView) * tangent), normalize(mat3(modelView) * bitangent), normalize(Normal));
+#endif
 
+#ifdef GOURAUD
+	// Same terms as calculatePointLight() in nanoShader.frag, without the texture samples
+	vec3 norm = normalize(Normal);
+	vec3 viewDir = normalize(viewPos - FragPos);
+	LitAmbientDiffuse = vec3(0.0);
+	LitSpecular = vec3(0.0);
+	for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
+		vec3 lightDir = normalize(lights[i].position - FragPos);
+		float diff = max(dot(norm, lightDir), 0.0);
+		float spec = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.0), material.shininess * g_shininess);
 
+		LitAmbientDiffuse += g_ambient * lights[i].ambient * material.ambient +
+							 g_diffuse * diff * lights[i].diffuse * material.diffuse;
+		LitSpecular += g_specular * spec * lights[i].specular * material.specular;
+	}
+	LitAmbientDiffuse *= g_color;
+	LitSpecular *= g_color;
+#endif
+    
+    gl_Position = modelViewProjection * vec4(position, 1.0);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+// Positions only, for the passes that need no material: the depth pre-pass and the visibility pass
+layout (location = 0) in vec3 position;
+
+// Per draw matrices, computed once per frame on the CPU - see TransformSystem
+#define TRANSFORM_TEXELS 16
+uniform samplerBuffer transforms;
+uniform int drawIndex;
+
+// The depth pre-pass is followed by GL_EQUAL depth tests, the depths must be the very same
+invariant gl_Position;
+
+
+void main()
+{
+	int base = drawIndex * TRANSFORM_TEXELS;
+	mat4 modelViewProjection = mat4(texelFetch(transforms, base + 8), texelFetch(transforms, base + 9),
+									texelFetch(transforms, base + 10), texelFetch(transforms, base + 11));
+	gl_Position = modelViewProjection * vec4(position, 1.0);
+}
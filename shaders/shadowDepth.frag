@@ -0,0 +1,12 @@
+#version 330 core
+// Distance to the light, normalized - what ShadowMap's cube maps hold
+uniform vec3 shadowLightPos;
+uniform float shadowFar;
+
+in vec3 WorldPos;
+
+
+void main()
+{
+	gl_FragDepth = length(WorldPos - shadowLightPos) / shadowFar;
+}
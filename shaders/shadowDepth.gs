@@ -0,0 +1,45 @@
+#version 330 core
+// Renders each triangle to the six cube faces in one pass (layered rendering)
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;
+
+uniform vec3 shadowLightPos;
+uniform float shadowFar;
+
+out vec3 WorldPos;
+
+#define SHADOW_NEAR 0.05
+
+// Cube map face directions and up vectors (+X, -X, +Y, -Y, +Z, -Z)
+const vec3 faceDirections[6] = vec3[](vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0),
+									  vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0));
+const vec3 faceUps[6] = vec3[](vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0), vec3(0.0, 0.0, 1.0),
+							   vec3(0.0, 0.0, -1.0), vec3(0.0, -1.0, 0.0), vec3(0.0, -1.0, 0.0));
+
+
+// 90 degrees perspective looking down the face direction, as glm::lookAt and glm::perspective would build it
+vec4 faceClip(int face, vec3 worldPos)
+{
+	vec3 f = faceDirections[face];
+	vec3 s = normalize(cross(f, faceUps[face]));
+	vec3 u = cross(s, f);
+	vec3 p = worldPos - shadowLightPos;
+	vec3 view = vec3(dot(s, p), dot(u, p), -dot(f, p));
+
+	float n = SHADOW_NEAR, far = shadowFar;
+	return vec4(view.x, view.y, (view.z * (far + n) + 2.0 * far * n) / (n - far), -view.z);
+}
+
+
+void main()
+{
+	for (int face = 0; face < 6; face++) {
+		gl_Layer = face;
+		for (int i = 0; i < 3; i++) {
+			WorldPos = gl_in[i].gl_Position.xyz;
+			gl_Position = faceClip(face, WorldPos);
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
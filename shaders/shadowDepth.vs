@@ -0,0 +1,17 @@
+#version 330 core
+// Shadow casters, world space positions - shadowDepth.gs projects them on the cube faces
+layout (location = 0) in vec3 position;
+
+// Per draw matrices, computed once per frame on the CPU - see TransformSystem
+#define TRANSFORM_TEXELS 16
+uniform samplerBuffer transforms;
+uniform int drawIndex;
+
+
+void main()
+{
+	int base = drawIndex * TRANSFORM_TEXELS;
+	mat4 model = mat4(texelFetch(transforms, base), texelFetch(transforms, base + 1),
+					  texelFetch(transforms, base + 2), texelFetch(transforms, base + 3));
+	gl_Position = model * vec4(position, 1.0);
+}
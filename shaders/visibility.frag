@@ -0,0 +1,14 @@
+#version 330 core
+// Visibility pass: the only output is which triangle of which draw covers the pixel.
+// Must match VISIBILITY_TRIANGLE_BITS in visibility_buffer.h
+#define VISIBILITY_TRIANGLE_BITS 19
+
+uniform uint visibilityDraw;    // Index in the draw table + 1, 0 is the background
+
+out uint id;
+
+
+void main()
+{
+	id = (visibilityDraw << VISIBILITY_TRIANGLE_BITS) | uint(gl_PrimitiveID);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+// Writes the depth of each pixel's mesh (its slot in the draw table), for the resolve passes to test against.
+// Must match VISIBILITY_TRIANGLE_BITS, VISIBILITY_DRAW_TEXELS and VISIBILITY_MAX_MESHES in visibility_buffer.h
+#define VISIBILITY_TRIANGLE_BITS 19
+#define VISIBILITY_DRAW_TEXELS 5
+#define VISIBILITY_MAX_MESHES 1024
+
+uniform usampler2D visibilityIds;
+uniform samplerBuffer visibilityDraws;
+
+
+void main()
+{
+	uint id = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).r;
+	if (id == 0u) {
+		discard;	// Background
+	}
+
+	int draw = int(id >> VISIBILITY_TRIANGLE_BITS) - 1;
+	float slot = texelFetch(visibilityDraws, draw * VISIBILITY_DRAW_TEXELS).y;
+	gl_FragDepth = (slot + 1.0) / float(VISIBILITY_MAX_MESHES);
+}
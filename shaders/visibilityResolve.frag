@@ -0,0 +1,207 @@
+#version 330 core
+// Resolve pass of the visibility buffer, one per mesh: rebuilds the attributes of the pixel's triangle from
+// the mesh's vertex and index buffers, then shades it as nanoShader.frag does.
+// Variants are compiled by ShaderPermutations, which inserts the feature #defines here
+#ifndef NUM_POINT_LIGHTS
+#define NUM_POINT_LIGHTS 1
+#endif
+
+// Must match the constants of visibility_buffer.h and mesh.h
+#define VISIBILITY_TRIANGLE_BITS 19
+#define VISIBILITY_DRAW_TEXELS 5
+#define VERTEX_FLOATS 14
+
+// Per frame values shared by all the programs, filled from FrameBlock (generated, see the Makefile).
+// The same block must be declared identically in every shader that uses it.
+#define MAX_FRAME_LIGHTS 8
+
+struct PointLight {
+    vec3 position;
+    
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+layout (std140) uniform Frame {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    PointLight lights[MAX_FRAME_LIGHTS];
+};
+
+struct Material {
+
+#ifdef TEXTURED
+	sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
+	sampler2D texture_specular1;
+#endif
+#endif
+#ifdef NORMAL_MAP
+	sampler2D texture_normal1;
+#endif
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;    
+    float shininess;
+};
+
+uniform Material material;
+
+// Per draw matrices, computed once per frame on the CPU - see TransformSystem
+#define TRANSFORM_TEXELS 16
+uniform samplerBuffer transforms;
+
+uniform usampler2D visibilityIds;
+uniform samplerBuffer visibilityDraws;  // Draw index + mesh slot + shininess, color, ambient, diffuse, specular
+uniform samplerBuffer meshVertices;
+uniform usamplerBuffer meshIndices;
+
+out vec4 color;
+
+
+// The model factors of the pixel's draw (the g_* uniforms of nanoShader.frag)
+struct DrawMaterial {
+    vec3 color;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+};
+
+
+mat4 fetchMat4(int texel)
+{
+	return mat4(texelFetch(transforms, texel), texelFetch(transforms, texel + 1),
+				texelFetch(transforms, texel + 2), texelFetch(transforms, texel + 3));
+}
+
+vec3 fetchVec3(int vertex, int offset)
+{
+	int base = vertex * VERTEX_FLOATS + offset;
+	return vec3(texelFetch(meshVertices, base).r, texelFetch(meshVertices, base + 1).r,
+				texelFetch(meshVertices, base + 2).r);
+}
+
+vec2 fetchVec2(int vertex, int offset)
+{
+	int base = vertex * VERTEX_FLOATS + offset;
+	return vec2(texelFetch(meshVertices, base).r, texelFetch(meshVertices, base + 1).r);
+}
+
+
+// Perspective correct barycentrics of the NDC point p in the triangle (a, b, c are NDC, invW the 1 / w)
+vec3 barycentrics(vec2 p, vec2 a, vec2 b, vec2 c, vec3 invW)
+{
+	vec2 v0 = b - a, v1 = c - a, v2 = p - a;
+	float d = v0.x * v1.y - v1.x * v0.y;
+	float l1 = (v2.x * v1.y - v1.x * v2.y) / d;
+	float l2 = (v0.x * v2.y - v2.x * v0.y) / d;
+	vec3 l = vec3(1.0 - l1 - l2, l1, l2) * invW;
+	return l / (l.x + l.y + l.z);
+}
+
+
+// Same as calculatePointLight() in nanoShader.frag, with the model factors of the draw
+vec3 calculatePointLight(PointLight light, DrawMaterial draw, vec3 norm, vec3 fragPos, vec3 viewDir,
+						 vec3 diffuseSample, vec3 specularSample)
+{
+	// ambient
+    vec3 ambient = light.ambient * material.ambient * diffuseSample;
+    
+    // diffuse 
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = diff * light.diffuse * material.diffuse * diffuseSample;
+    
+    // specular
+    vec3 reflectDir = reflect(-lightDir, norm);  
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess * draw.shininess);
+    vec3 specular = spec * light.specular * material.specular * specularSample;
+        
+    return (draw.ambient * ambient + draw.diffuse * diffuse + draw.specular * specular) * draw.color;
+}
+
+
+void main()
+{
+	uint id = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).r;
+	int drawTexel = (int(id >> VISIBILITY_TRIANGLE_BITS) - 1) * VISIBILITY_DRAW_TEXELS;
+	int triangle = int(id & ((1u << VISIBILITY_TRIANGLE_BITS) - 1u));
+
+	vec4 drawInfo = texelFetch(visibilityDraws, drawTexel);
+	DrawMaterial draw = DrawMaterial(texelFetch(visibilityDraws, drawTexel + 1).rgb,
+									 texelFetch(visibilityDraws, drawTexel + 2).rgb,
+									 texelFetch(visibilityDraws, drawTexel + 3).rgb,
+									 texelFetch(visibilityDraws, drawTexel + 4).rgb,
+									 drawInfo.z);
+
+	int base = int(drawInfo.x) * TRANSFORM_TEXELS;
+	mat4 modelView = fetchMat4(base + 4);
+	mat4 modelViewProjection = fetchMat4(base + 8);
+	mat3 normalMatrix = mat3(texelFetch(transforms, base + 12).xyz,
+							 texelFetch(transforms, base + 13).xyz,
+							 texelFetch(transforms, base + 14).xyz);
+
+	// The triangle
+	int v[3];
+	vec3 positions[3];
+	vec4 clip[3];
+	for (int i = 0; i < 3; i++) {
+		v[i] = int(texelFetch(meshIndices, triangle * 3 + i).r);
+		positions[i] = fetchVec3(v[i], 0);
+		clip[i] = modelViewProjection * vec4(positions[i], 1.0);
+	}
+	vec3 invW = 1.0 / vec3(clip[0].w, clip[1].w, clip[2].w);
+	vec2 a = clip[0].xy * invW.x, b = clip[1].xy * invW.y, c = clip[2].xy * invW.z;
+
+	// At the pixel, and one pixel right and up for the texture gradients
+	vec2 pixel = 2.0 / vec2(textureSize(visibilityIds, 0));
+	vec2 ndc = gl_FragCoord.xy * pixel - 1.0;
+	vec3 bary = barycentrics(ndc, a, b, c, invW);
+	vec3 baryX = barycentrics(ndc + vec2(pixel.x, 0.0), a, b, c, invW);
+	vec3 baryY = barycentrics(ndc + vec2(0.0, pixel.y), a, b, c, invW);
+
+	vec2 uv[3];
+	for (int i = 0; i < 3; i++) {
+		uv[i] = fetchVec2(v[i], 6);
+	}
+	vec2 texCoords = bary.x * uv[0] + bary.y * uv[1] + bary.z * uv[2];
+	vec2 dx = baryX.x * uv[0] + baryX.y * uv[1] + baryX.z * uv[2] - texCoords;
+	vec2 dy = baryY.x * uv[0] + baryY.y * uv[1] + baryY.z * uv[2] - texCoords;
+
+	vec3 position = bary.x * positions[0] + bary.y * positions[1] + bary.z * positions[2];
+	vec3 fragPos = vec3(modelView * vec4(position, 1.0));
+	vec3 normal = normalMatrix * (bary.x * fetchVec3(v[0], 3) + bary.y * fetchVec3(v[1], 3) + bary.z * fetchVec3(v[2], 3));
+
+#ifdef TEXTURED
+	vec3 diffuseSample = vec3(textureGrad(material.texture_diffuse1, texCoords, dx, dy));
+#else
+	vec3 diffuseSample = vec3(1.0);
+#endif
+#if defined(TEXTURED) && defined(HAS_SPECULAR_MAP)
+	vec3 specularSample = vec3(textureGrad(material.texture_specular1, texCoords, dx, dy));
+#else
+	vec3 specularSample = vec3(1.0);
+#endif
+
+#ifdef NORMAL_MAP
+	vec3 tangent = bary.x * fetchVec3(v[0], 8) + bary.y * fetchVec3(v[1], 8) + bary.z * fetchVec3(v[2], 8);
+	vec3 bitangent = bary.x * fetchVec3(v[0], 11) + bary.y * fetchVec3(v[1], 11) + bary.z * fetchVec3(v[2], 11);
+	mat3 TBN = mat3(normalize(mat3(modelView) * tangent), normalize(mat3(modelView) * bitangent), normalize(normal));
+	vec3 norm = normalize(TBN * (vec3(textureGrad(material.texture_normal1, texCoords, dx, dy)) * 2.0 - 1.0));
+#else
+	vec3 norm = normalize(normal);
+#endif
+
+	vec3 viewDir = normalize(viewPos - fragPos);
+
+	vec3 totalLight = vec3(0.0);
+	for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
+		totalLight += calculatePointLight(lights[i], draw, norm, fragPos, viewDir, diffuseSample, specularSample);
+	}
+
+	color = vec4(totalLight, 1.0f);
+}
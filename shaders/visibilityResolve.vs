@@ -0,0 +1,11 @@
+#version 330 core
+// Full screen triangle at a given depth - the resolve passes are depth tested (GL_EQUAL) against the
+// mesh depths written by visibilityMaterial.frag, so each pixel is shaded by its own mesh only.
+uniform float meshDepth;
+
+
+void main()
+{
+	vec2 corner = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID >> 1) * 4.0 - 1.0);
+	gl_Position = vec4(corner, meshDepth * 2.0 - 1.0, 1.0);
+}
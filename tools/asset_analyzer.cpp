@@ -0,0 +1,281 @@
+// Reports what the meshes of a model cost to draw, to review assets before they go in the library:
+//  - vertex and triangle counts, duplicate vertices (every attribute equal) and the index width the vertices need
+//  - ACMR and ATVR: post-transform cache misses per triangle and per vertex, for a FIFO cache of --cache entries
+//  - overfetch: vertex buffer bytes read through 64 byte cache lines, over the size of the vertices used
+//  - overdraw: pixels shaded over pixels covered, rasterized without culling from the 6 axis directions
+//  - the textures, and the GPU memory the viewer would use for them and the meshes
+//
+// usage: asset_analyzer [--cache <entries>] [--max-acmr <x>] [--max-overfetch <x>] [--max-overdraw <x>] <model>...
+//
+// The models go through Model's import without uploading anything, so no window or GL context is needed.
+// It fails if a model can't be loaded, or if a mesh is over one of the given maximums.
+
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include <model.h>
+
+
+
+// Vertex fetch: cache line size, and the lines kept (16 KiB)
+static const size_t FETCH_LINE_SIZE = 64;
+static const size_t FETCH_CACHE_LINES = 256;
+
+// Overdraw: pixels of the side of each view
+static const int OVERDRAW_GRID = 256;
+
+
+struct MeshMetrics {
+	size_t vertices, triangles;
+	size_t duplicates;      // Vertices equal to another one
+	double acmr, atvr;
+	double overfetch;
+	double overdraw;
+	int indexBits;          // Smallest index type that fits the vertex count
+	size_t gpuBytes;        // As the viewer uploads it: Vertex and 32 bit indices
+};
+
+
+// Transforms missed by a FIFO cache of 'cacheSize' vertices. A vertex is still in the cache if fewer than
+// 'cacheSize' misses happened since it went in.
+static void
+analyzeVertexCache(const vector<GLuint>& indices, size_t vertexCount, size_t cacheSize, MeshMetrics& m)
+{
+	vector<size_t> cachedAt(vertexCount, SIZE_MAX);
+	size_t misses = 0, used = 0;
+	for (GLuint index : indices) {
+		if (cachedAt[index] == SIZE_MAX) {
+			used++;
+		}
+		if (cachedAt[index] == SIZE_MAX || misses - cachedAt[index] >= cacheSize) {
+			cachedAt[index] = misses;
+			misses++;
+		}
+	}
+	m.acmr = m.triangles ? (double)misses / m.triangles : 0.0;
+	m.atvr = used ? (double)misses / used : 0.0;
+}
+
+
+// Every vertex transform reads the cache lines the vertex spans, through a FIFO cache of lines
+static void
+analyzeVertexFetch(const vector<GLuint>& indices, size_t vertexCount, size_t cacheSize, MeshMetrics& m)
+{
+	size_t lineCount = (vertexCount * sizeof(Vertex) + FETCH_LINE_SIZE - 1) / FETCH_LINE_SIZE;
+	vector<size_t> vertexCachedAt(vertexCount, SIZE_MAX), lineCachedAt(lineCount, SIZE_MAX);
+	vector<bool> used(vertexCount, false);
+	size_t vertexMisses = 0, lineMisses = 0, usedCount = 0;
+
+	for (GLuint index : indices) {
+		if (!used[index]) {
+			used[index] = true;
+			usedCount++;
+		}
+		if (vertexCachedAt[index] != SIZE_MAX && vertexMisses - vertexCachedAt[index] < cacheSize) {
+			continue;
+		}
+		vertexCachedAt[index] = vertexMisses++;
+
+		size_t first = index * sizeof(Vertex) / FETCH_LINE_SIZE;
+		size_t last = ((index + 1) * sizeof(Vertex) - 1) / FETCH_LINE_SIZE;
+		for (size_t line = first; line <= last; line++) {
+			if (lineCachedAt[line] == SIZE_MAX || lineMisses - lineCachedAt[line] >= FETCH_CACHE_LINES) {
+				lineCachedAt[line] = lineMisses++;
+			}
+		}
+	}
+	m.overfetch = usedCount ? (double)(lineMisses * FETCH_LINE_SIZE) / (usedCount * sizeof(Vertex)) : 0.0;
+}
+
+
+static void
+analyzeDuplicates(const vector<Vertex>& vertices, MeshMetrics& m)
+{
+	vector<uint32_t> order(vertices.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	sort(order.begin(), order.end(), [&vertices] (uint32_t a, uint32_t b) {
+		return memcmp(&vertices[a], &vertices[b], sizeof(Vertex)) < 0;
+	});
+
+	m.duplicates = 0;
+	for (size_t i = 1; i < order.size(); i++) {
+		if (memcmp(&vertices[order[i - 1]], &vertices[order[i]], sizeof(Vertex)) == 0) {
+			m.duplicates++;
+		}
+	}
+}
+
+
+// Shaded fragments (depth test passed, in submission order) over covered pixels, summed over orthographic
+// views along -x, +x, -y, +y, -z and +z of the mesh bounds
+static void
+analyzeOverdraw(const Mesh& mesh, MeshMetrics& m)
+{
+	glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+	GLfloat scale = 1.0f / max(max(extent.x, extent.y), max(extent.z, 1e-6f));
+
+	vector<GLfloat> depth(OVERDRAW_GRID * OVERDRAW_GRID);
+	size_t shaded = 0, covered = 0;
+
+	for (int view = 0; view < 6; view++) {
+		int axis = view / 2;
+		bool flip = view % 2;
+		int uAxis = (axis + 1) % 3, vAxis = (axis + 2) % 3;
+		fill(depth.begin(), depth.end(), FLT_MAX);
+
+		for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+			// Grid coordinates, and depth in [0, 1]
+			glm::vec3 p[3];
+			for (int k = 0; k < 3; k++) {
+				glm::vec3 n = (mesh.vertices[mesh.indices[t + k]].position - mesh.boundsMin) * scale;
+				p[k] = glm::vec3(n[uAxis] * OVERDRAW_GRID, n[vAxis] * OVERDRAW_GRID, flip ? 1.0f - n[axis] : n[axis]);
+			}
+
+			GLfloat area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+			if (fabs(area) < 1e-12f) {
+				continue;
+			}
+
+			int x0 = max(0, (int)floor(min(min(p[0].x, p[1].x), p[2].x)));
+			int y0 = max(0, (int)floor(min(min(p[0].y, p[1].y), p[2].y)));
+			int x1 = min(OVERDRAW_GRID - 1, (int)ceil(max(max(p[0].x, p[1].x), p[2].x)));
+			int y1 = min(OVERDRAW_GRID - 1, (int)ceil(max(max(p[0].y, p[1].y), p[2].y)));
+
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					// Barycentrics of the pixel center, both windings
+					GLfloat px = x + 0.5f, py = y + 0.5f;
+					GLfloat w0 = ((p[1].x - px) * (p[2].y - py) - (p[1].y - py) * (p[2].x - px)) / area;
+					GLfloat w1 = ((p[2].x - px) * (p[0].y - py) - (p[2].y - py) * (p[0].x - px)) / area;
+					GLfloat w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+						continue;
+					}
+
+					GLfloat z = w0 * p[0].z + w1 * p[1].z + w2 * p[2].z;
+					GLfloat& d = depth[y * OVERDRAW_GRID + x];
+					if (z < d) {
+						d = z;
+						shaded++;
+					}
+				}
+			}
+		}
+
+		for (GLfloat d : depth) {
+			covered += (d != FLT_MAX) ? 1 : 0;
+		}
+	}
+	m.overdraw = covered ? (double)shaded / covered : 0.0;
+}
+
+
+static MeshMetrics
+analyze(const Mesh& mesh, size_t cacheSize)
+{
+	MeshMetrics m;
+	m.vertices = mesh.vertices.size();
+	m.triangles = mesh.indices.size() / 3;
+	m.indexBits = (m.vertices <= (1u << 8)) ? 8 : (m.vertices <= (1u << 16)) ? 16 : 32;
+	m.gpuBytes = m.vertices * sizeof(Vertex) + mesh.indices.size() * sizeof(GLuint);
+
+	analyzeVertexCache(mesh.indices, m.vertices, cacheSize, m);
+	analyzeVertexFetch(mesh.indices, m.vertices, cacheSize, m);
+	analyzeDuplicates(mesh.vertices, m);
+	analyzeOverdraw(mesh, m);
+	return m;
+}
+
+
+static double
+parseOption(const char* value)
+{
+	char* end = nullptr;
+	double result = strtod(value, &end);
+	if (!end || *end || result <= 0.0) {
+		cerr << "asset_analyzer: bad value " << value << endl;
+		exit(EXIT_FAILURE);
+	}
+	return result;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	size_t cacheSize = 16;
+	double maxAcmr = 0.0, maxOverfetch = 0.0, maxOverdraw = 0.0;
+	vector<string> paths;
+
+	for (int i = 1; i < argc; i++) {
+		string option = argv[i];
+		if (i + 1 < argc && option == "--cache") {
+			cacheSize = (size_t)parseOption(argv[++i]);
+		}
+		else if (i + 1 < argc && option == "--max-acmr") {
+			maxAcmr = parseOption(argv[++i]);
+		}
+		else if (i + 1 < argc && option == "--max-overfetch") {
+			maxOverfetch = parseOption(argv[++i]);
+		}
+		else if (i + 1 < argc && option == "--max-overdraw") {
+			maxOverdraw = parseOption(argv[++i]);
+		}
+		else {
+			paths.push_back(option);
+		}
+	}
+	if (paths.empty()) {
+		cerr << "usage: " << argv[0]
+			 << " [--cache <entries>] [--max-acmr <x>] [--max-overfetch <x>] [--max-overdraw <x>] <model>..." << endl;
+		return EXIT_FAILURE;
+	}
+
+	bool failed = false;
+	for (const string& path : paths) {
+		Model model(path, false, MESH_CPU_KEEP, false);
+		if (model.meshes.empty()) {
+			cerr << "asset_analyzer: " << path << ": no mesh loaded" << endl;
+			failed = true;
+			continue;
+		}
+
+		cout << model.loadReport.summary() << endl;
+		cout << fixed << setprecision(2);
+		cout << "  mesh  vertices  triangles  duplicates   acmr   atvr  overfetch  overdraw  index   gpu KiB" << endl;
+
+		size_t gpuBytes = 0;
+		for (size_t i = 0; i < model.meshes.size(); i++) {
+			MeshMetrics m = analyze(model.meshes[i], cacheSize);
+			gpuBytes += m.gpuBytes;
+
+			bool over = (maxAcmr > 0.0 && m.acmr > maxAcmr) ||
+						(maxOverfetch > 0.0 && m.overfetch > maxOverfetch) ||
+						(maxOverdraw > 0.0 && m.overdraw > maxOverdraw);
+			failed = failed || over;
+
+			cout << "  " << setw(4) << i << setw(10) << m.vertices << setw(11) << m.triangles << setw(12) << m.duplicates
+				 << setw(7) << m.acmr << setw(7) << m.atvr << setw(11) << m.overfetch << setw(10) << m.overdraw
+				 << setw(7) << m.indexBits << setw(10) << m.gpuBytes / 1024.0 << (over ? "  over the maximum" : "") << endl;
+		}
+
+		for (const TextureLoad& texture : model.loadReport.textures) {
+			cout << "  texture " << texture.path << ": " << texture.width << "x" << texture.height << ", "
+				 << texture.bitsPerPixel << " bpp, " << texture.bytes / 1024.0 << " KiB" << endl;
+			gpuBytes += texture.bytes;
+		}
+		cout << "  estimated GPU memory: " << gpuBytes / 1048576.0 << " MiB (cache of " << cacheSize << " vertices)" << endl;
+	}
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,688 @@
+// Generates the C++ side of the shaders' interfaces (see the Makefile, it runs on every shader change):
+//  - a typed handle (Uniforms::name) for every uniform outside a block, so Program::set() is checked at compile
+//    time and uses a location resolved once per program instead of looking the name up on each update.
+//  - a struct with the std140 layout of every uniform block (offsets checked with static_assert), filled on
+//    the CPU and copied to the block's buffer as is.
+//
+// usage: shader_interface_gen <output.h> <shader>...
+//
+// It understands the subset of GLSL the shaders use: structs, plain and array uniforms, uniform blocks without
+// an instance name and object-like #defines for array sizes. Anything else is skipped.
+
+#include <cstdlib>
+#include <cctype>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+
+
+struct Member {
+	string type;
+	string name;
+	int arraySize;      // 0 if not an array
+};
+
+typedef vector<Member> StructDef;
+
+struct Block {
+	StructDef members;
+	map<string, StructDef> structs;    // Struct types the members use (transitively)
+	string source;
+};
+
+// Per shader file
+struct ShaderFile {
+	string path;
+	map<string, int> defines;
+	map<string, StructDef> structs;
+};
+
+
+// Output of the parse, across all the files
+static map<string, string> uniforms;            // GLSL name -> C++ type
+static map<string, vector<string> > uniformSources;
+static map<string, Block> blocks;
+
+
+
+static void
+fail(const string& path, const string& message)
+{
+	cerr << "shader_interface_gen: " << path << ": " << message << endl;
+	exit(EXIT_FAILURE);
+}
+
+
+static string
+baseName(const string& path)
+{
+	size_t slash = path.find_last_of('/');
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+
+/*  Tokenizer  */
+
+static string
+stripComments(const string& source)
+{
+	string out;
+	for (size_t i = 0; i < source.size(); i++) {
+		if (source.compare(i, 2, "//") == 0) {
+			while (i < source.size() && source[i] != '\n') {
+				i++;
+			}
+			out += '\n';
+		}
+		else if (source.compare(i, 2, "/*") == 0) {
+			size_t end = source.find("*/", i + 2);
+			i = (end == string::npos) ? source.size() : end + 1;
+			out += ' ';
+		}
+		else {
+			out += source[i];
+		}
+	}
+	return out;
+}
+
+
+// Splits the source in identifiers/numbers and single punctuation characters. Preprocessor lines are
+// consumed here: object-like #defines with an integer value are recorded (first one wins, so the default
+// of an #ifndef block is what array sizes resolve to), the other directives are ignored.
+static vector<string>
+tokenize(const string& source, ShaderFile& file)
+{
+	vector<string> tokens;
+	stringstream lines(stripComments(source));
+	string line;
+
+	while (getline(lines, line)) {
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first != string::npos && line[first] == '#') {
+			stringstream directive(line.substr(first + 1));
+			string keyword, name, value;
+			directive >> keyword >> name >> value;
+			if (keyword == "define" && !value.empty() && isdigit((unsigned char)value[0]) &&
+				file.defines.find(name) == file.defines.end()) {
+				file.defines[name] = atoi(value.c_str());
+			}
+			continue;
+		}
+
+		for (size_t i = 0; i < line.size(); ) {
+			unsigned char c = line[i];
+			if (isspace(c)) {
+				i++;
+			}
+			else if (isalnum(c) || c == '_') {
+				size_t start = i;
+				while (i < line.size() && (isalnum((unsigned char)line[i]) || line[i] == '_' || line[i] == '.')) {
+					i++;
+				}
+				tokens.push_back(line.substr(start, i - start));
+			}
+			else {
+				tokens.push_back(string(1, line[i]));
+				i++;
+			}
+		}
+	}
+	return tokens;
+}
+
+
+/*  Parser  */
+
+class Parser
+{
+public:
+	Parser(const vector<string>& tokens, ShaderFile& file) :tokens(tokens), pos(0), file(file) {}
+
+	void parse()
+	{
+		while (!atEnd()) {
+			const string& token = peek();
+			if (token == "struct") {
+				parseStruct();
+			}
+			else if (token == "layout") {
+				next();
+				skipParentheses();
+				if (!atEnd() && peek() == "uniform") {
+					parseUniform();
+				}
+				else {
+					skipStatement();
+				}
+			}
+			else if (token == "uniform") {
+				parseUniform();
+			}
+			else {
+				skipStatement();
+			}
+		}
+	}
+
+private:
+	const vector<string>& tokens;
+	size_t pos;
+	ShaderFile& file;
+
+	bool atEnd() const { return pos >= tokens.size(); }
+	const string& peek() const { return tokens[pos]; }
+
+	const string& next()
+	{
+		if (atEnd()) {
+			fail(file.path, "unexpected end of file");
+		}
+		return tokens[pos++];
+	}
+
+	void expect(const string& token)
+	{
+		if (next() != token) {
+			fail(file.path, "expected '" + token + "' near '" + tokens[pos - 1] + "'");
+		}
+	}
+
+	void skipParentheses()
+	{
+		if (atEnd() || peek() != "(") {
+			return;
+		}
+		int depth = 0;
+		do {
+			const string& token = next();
+			depth += (token == "(") - (token == ")");
+		} while (depth > 0);
+	}
+
+	// Up to the ';' ending a declaration, or the '}' ending a function body
+	void skipStatement()
+	{
+		int depth = 0;
+		while (!atEnd()) {
+			const string& token = next();
+			if (token == "{") {
+				depth++;
+			}
+			else if (token == "}") {
+				if (--depth <= 0) {
+					if (!atEnd() && peek() == ";") {
+						next();
+					}
+					return;
+				}
+			}
+			else if (token == ";" && depth == 0) {
+				return;
+			}
+		}
+	}
+
+	int parseArraySize()
+	{
+		if (atEnd() || peek() != "[") {
+			return 0;
+		}
+		next();
+		string size = next();
+		expect("]");
+
+		if (isdigit((unsigned char)size[0])) {
+			return atoi(size.c_str());
+		}
+		map<string, int>::const_iterator define = file.defines.find(size);
+		if (define == file.defines.end()) {
+			fail(file.path, "array size '" + size + "' is not a number or a #define");
+		}
+		return define->second;
+	}
+
+	// 'type name[size];' lines up to the closing brace
+	StructDef parseMembers()
+	{
+		StructDef members;
+		expect("{");
+		while (peek() != "}") {
+			Member member;
+			member.type = next();
+			// Qualifiers (precision, interpolation) don't change the interface
+			while (member.type == "highp" || member.type == "mediump" || member.type == "lowp" ||
+				   member.type == "flat" || member.type == "smooth") {
+				member.type = next();
+			}
+			member.name = next();
+			member.arraySize = parseArraySize();
+			expect(";");
+			members.push_back(member);
+		}
+		expect("}");
+		return members;
+	}
+
+	void parseStruct()
+	{
+		expect("struct");
+		string name = next();
+		file.structs[name] = parseMembers();
+		expect(";");
+	}
+
+	void parseUniform()
+	{
+		expect("uniform");
+		string type = next();
+
+		// Uniform block: 'uniform Name { ... };'
+		if (peek() == "{") {
+			parseBlock(type);
+			return;
+		}
+
+		while (type == "highp" || type == "mediump" || type == "lowp") {
+			type = next();
+		}
+		string name = next();
+		int arraySize = parseArraySize();
+		expect(";");
+		addUniform(name, type, arraySize);
+	}
+
+	void parseBlock(const string& name)
+	{
+		Block block;
+		block.members = parseMembers();
+		block.source = file.path;
+		if (peek() != ";") {
+			fail(file.path, "uniform block " + name + " must not have an instance name");
+		}
+		expect(";");
+
+		for (const Member& member : block.members) {
+			collectStructs(member.type, block.structs);
+		}
+
+		map<string, Block>::const_iterator existing = blocks.find(name);
+		if (existing != blocks.end()) {
+			if (!sameBlock(existing->second, block)) {
+				fail(file.path, "uniform block " + name + " differs from the one in " + existing->second.source);
+			}
+			return;
+		}
+		blocks[name] = block;
+	}
+
+	void collectStructs(const string& type, map<string, StructDef>& structs)
+	{
+		map<string, StructDef>::const_iterator s = file.structs.find(type);
+		if (s == file.structs.end()) {
+			return;
+		}
+		structs[type] = s->second;
+		for (const Member& member : s->second) {
+			collectStructs(member.type, structs);
+		}
+	}
+
+	static bool sameMembers(const StructDef& a, const StructDef& b)
+	{
+		if (a.size() != b.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i].type != b[i].type || a[i].name != b[i].name || a[i].arraySize != b[i].arraySize) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static bool sameBlock(const Block& a, const Block& b)
+	{
+		if (!sameMembers(a.members, b.members) || a.structs.size() != b.structs.size()) {
+			return false;
+		}
+		for (map<string, StructDef>::const_iterator s = a.structs.begin(); s != a.structs.end(); ++s) {
+			map<string, StructDef>::const_iterator other = b.structs.find(s->first);
+			if (other == b.structs.end() || !sameMembers(s->second, other->second)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Uniforms of struct type are flattened to one handle per member, as GL names them ('light.position')
+	void addUniform(const string& name, const string& type, int arraySize)
+	{
+		if (arraySize > 0) {
+			for (int i = 0; i < arraySize; i++) {
+				addUniform(name + "[" + to_string(i) + "]", type, 0);
+			}
+			return;
+		}
+
+		map<string, StructDef>::const_iterator s = file.structs.find(type);
+		if (s != file.structs.end()) {
+			for (const Member& member : s->second) {
+				addUniform(name + "." + member.name, member.type, member.arraySize);
+			}
+			return;
+		}
+
+		string cppType = uniformType(type);
+		map<string, string>::const_iterator existing = uniforms.find(name);
+		if (existing != uniforms.end() && existing->second != cppType) {
+			fail(file.path, "uniform " + name + " is " + cppType + " here but " + existing->second + " in " +
+				 uniformSources[name].front());
+		}
+		uniforms[name] = cppType;
+
+		vector<string>& sources = uniformSources[name];
+		if (sources.empty() || sources.back() != baseName(file.path)) {
+			sources.push_back(baseName(file.path));
+		}
+	}
+
+	string uniformType(const string& type)
+	{
+		if (type == "float") return "GLfloat";
+		if (type == "int") return "GLint";
+		if (type == "uint") return "GLuint";
+		if (type == "bool") return "bool";
+		if (type == "vec2") return "glm::vec2";
+		if (type == "vec3") return "glm::vec3";
+		if (type == "vec4") return "glm::vec4";
+		if (type == "mat2") return "glm::mat2";
+		if (type == "mat3") return "glm::mat3";
+		if (type == "mat4") return "glm::mat4";
+		// Samplers are set to a texture unit
+		if (type.find("sampler") != string::npos) return "GLint";
+
+		fail(file.path, "unsupported uniform type " + type);
+		return "";
+	}
+};
+
+
+/*  std140  */
+
+struct Layout {
+	size_t align;
+	size_t size;
+};
+
+static size_t
+roundUp(size_t value, size_t multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+
+static Layout structLayout(const StructDef& def, const map<string, StructDef>& structs, const string& source);
+
+
+static Layout
+typeLayout(const string& type, const map<string, StructDef>& structs, const string& source)
+{
+	if (type == "float" || type == "int" || type == "uint" || type == "bool") return { 4, 4 };
+	if (type == "vec2") return { 8, 8 };
+	if (type == "vec3") return { 16, 12 };
+	if (type == "vec4") return { 16, 16 };
+	if (type == "mat2") return { 16, 32 };     // Columns are vec4 aligned
+	if (type == "mat3") return { 16, 48 };
+	if (type == "mat4") return { 16, 64 };
+
+	map<string, StructDef>::const_iterator s = structs.find(type);
+	if (s == structs.end()) {
+		fail(source, "unsupported type in uniform block: " + type);
+	}
+	return structLayout(s->second, structs, source);
+}
+
+
+static Layout
+memberLayout(const Member& member, const map<string, StructDef>& structs, const string& source)
+{
+	Layout layout = typeLayout(member.type, structs, source);
+	if (member.arraySize > 0) {
+		// Array elements are vec4 aligned
+		size_t stride = roundUp(layout.size, 16);
+		return { 16, stride * member.arraySize };
+	}
+	return layout;
+}
+
+
+static Layout
+structLayout(const StructDef& def, const map<string, StructDef>& structs, const string& source)
+{
+	size_t offset = 0, align = 16;
+	for (const Member& member : def) {
+		Layout layout = memberLayout(member, structs, source);
+		offset = roundUp(offset, layout.align) + layout.size;
+	}
+	return { align, roundUp(offset, align) };
+}
+
+
+static string
+blockType(const string& type, const map<string, StructDef>& structs)
+{
+	if (type == "float") return "GLfloat";
+	if (type == "int" || type == "bool") return "GLint";     // std140 bools take 4 bytes
+	if (type == "uint") return "GLuint";
+	if (type == "vec2") return "glm::vec2";
+	if (type == "vec3") return "glm::vec3";
+	if (type == "vec4") return "glm::vec4";
+	if (type == "mat4") return "glm::mat4";
+	if (structs.count(type)) return type + "Std140";
+	return "";
+}
+
+
+// C++ struct with the std140 layout of the members, explicit padding where std140 leaves holes
+static void
+writeStruct(ostream& out, const string& name, const StructDef& def, const map<string, StructDef>& structs,
+			const string& source)
+{
+	stringstream asserts;
+	out << "struct " << name << " {\n";
+
+	size_t offset = 0;
+	int pads = 0;
+	for (const Member& member : def) {
+		Layout layout = memberLayout(member, structs, source);
+		size_t start = roundUp(offset, layout.align);
+		if (start > offset) {
+			out << "    GLubyte _pad" << pads++ << "[" << (start - offset) << "];\n";
+		}
+
+		// Matrices with fewer than 4 rows are stored as vec4 columns
+		string type = blockType(member.type, structs);
+		string declarator = member.name;
+		if (member.type == "mat2" || member.type == "mat3") {
+			type = "glm::vec4";
+			declarator += (member.type == "mat2") ? "[2]" : "[3]";
+			if (member.arraySize > 0) {
+				fail(source, "arrays of " + member.type + " are not supported in uniform blocks");
+			}
+		}
+		if (member.arraySize > 0) {
+			// Element stride must be 16 as in std140: only types whose size already is a multiple of it
+			if (typeLayout(member.type, structs, source).size % 16 != 0) {
+				fail(source, "array " + member.name + " of " + member.type + " has a padded stride in std140,"
+					 " use a vec4 or a struct instead");
+			}
+			declarator += "[" + to_string(member.arraySize) + "]";
+		}
+		if (type.empty()) {
+			fail(source, "unsupported type in uniform block: " + member.type);
+		}
+
+		out << "    " << type << " " << declarator << ";\n";
+		asserts << "static_assert(offsetof(" << name << ", " << member.name << ") == " << start
+				<< ", \"std140 offset of " << name << "::" << member.name << "\");\n";
+		offset = start + layout.size;
+	}
+
+	Layout layout = structLayout(def, structs, source);
+	if (layout.size > offset) {
+		out << "    GLubyte _pad" << pads++ << "[" << (layout.size - offset) << "];\n";
+	}
+	out << "};\n";
+	out << asserts.str();
+	out << "static_assert(sizeof(" << name << ") == " << layout.size << ", \"std140 size of " << name << "\");\n\n";
+}
+
+
+static void
+writeStructs(ostream& out, const string& type, const map<string, StructDef>& structs, const string& source,
+			 map<string, bool>& written)
+{
+	map<string, StructDef>::const_iterator s = structs.find(type);
+	if (s == structs.end() || written[type]) {
+		return;
+	}
+	// Dependencies first
+	for (const Member& member : s->second) {
+		writeStructs(out, member.type, structs, source, written);
+	}
+	writeStruct(out, type + "Std140", s->second, structs, source);
+	written[type] = true;
+}
+
+
+static string
+identifier(const string& glslName)
+{
+	string id;
+	for (char c : glslName) {
+		if (c == '.' || c == '[') {
+			id += '_';
+		}
+		else if (c != ']') {
+			id += c;
+		}
+	}
+	return id;
+}
+
+
+static string
+upper(const string& s)
+{
+	string u;
+	for (char c : s) {
+		u += (char)toupper((unsigned char)c);
+	}
+	return u;
+}
+
+
+static void
+writeHeader(ostream& out)
+{
+	out << "// Generated by tools/shader_interface_gen from the shaders - do not edit, see the Makefile.\n"
+		   "#pragma once\n"
+		   "#include <cstddef>\n"
+		   "\n"
+		   "#include <GL/glew.h>\n"
+		   "#include <glm/glm.hpp>\n"
+		   "\n"
+		   "#include <program.h>\n"
+		   "\n\n";
+
+	// Uniforms outside blocks, the index is the one of the name in UNIFORM_NAMES
+	out << "/*  Uniforms  */\n";
+	out << "namespace Uniforms {\n";
+	unsigned index = 0;
+	for (map<string, string>::const_iterator u = uniforms.begin(); u != uniforms.end(); ++u, ++index) {
+		out << "    const Uniform<" << u->second << "> " << identifier(u->first) << " = { " << index << " };";
+		out << "    // ";
+		const vector<string>& sources = uniformSources[u->first];
+		for (size_t i = 0; i < sources.size(); i++) {
+			out << (i ? ", " : "") << sources[i];
+		}
+		out << "\n";
+	}
+	out << "}\n\n";
+
+	out << "const GLuint UNIFORM_COUNT = " << uniforms.size() << ";\n";
+	out << "static const char* const UNIFORM_NAMES[UNIFORM_COUNT] = {\n";
+	for (map<string, string>::const_iterator u = uniforms.begin(); u != uniforms.end(); ++u) {
+		out << "    \"" << u->first << "\",\n";
+	}
+	out << "};\n\n\n";
+
+	// Uniform blocks, each gets the binding point of its rank
+	out << "/*  Uniform blocks (std140)  */\n";
+	map<string, bool> written;
+	unsigned binding = 0;
+	for (map<string, Block>::const_iterator b = blocks.begin(); b != blocks.end(); ++b, ++binding) {
+		const Block& block = b->second;
+		for (const Member& member : block.members) {
+			writeStructs(out, member.type, block.structs, block.source, written);
+		}
+		out << "// uniform block " << b->first << " (" << baseName(block.source) << ")\n";
+		writeStruct(out, b->first + "Block", block.members, block.structs, block.source);
+		out << "const GLuint " << upper(b->first) << "_BLOCK_BINDING = " << binding << ";\n\n";
+	}
+
+	out << "const GLuint UNIFORM_BLOCK_COUNT = " << blocks.size() << ";\n";
+	out << "static const char* const UNIFORM_BLOCK_NAMES[UNIFORM_BLOCK_COUNT + 1] = {\n";
+	for (map<string, Block>::const_iterator b = blocks.begin(); b != blocks.end(); ++b) {
+		out << "    \"" << b->first << "\",\n";
+	}
+	out << "    nullptr\n};\n";
+}
+
+
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		cerr << "usage: " << argv[0] << " <output.h> <shader>..." << endl;
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 2; i < argc; i++) {
+		ifstream in(argv[i]);
+		if (!in) {
+			fail(argv[i], "unable to read");
+		}
+		stringstream source;
+		source << in.rdbuf();
+
+		ShaderFile file;
+		file.path = argv[i];
+		vector<string> tokens = tokenize(source.str(), file);
+		Parser(tokens, file).parse();
+	}
+
+	// Only replace the header when it changes, so the sources aren't rebuilt for a shader body edit
+	stringstream header;
+	writeHeader(header);
+
+	ifstream previous(argv[1]);
+	stringstream previousHeader;
+	previousHeader << previous.rdbuf();
+	if (previous && previousHeader.str() == header.str()) {
+		return EXIT_SUCCESS;
+	}
+
+	ofstream out(argv[1], ios::trunc);
+	if (!out) {
+		fail(argv[1], "unable to write");
+	}
+	out << header.str();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <mutex>
+
+#include <allocation_tracker.h>
+
+
+// Deeper scopes count under the deepest one that fits
+static const size_t MAX_TAG_DEPTH = 16;
+
+// Everything here is constant initialized, operator new may run before main()
+static const char* tagNames[ALLOCATION_TAGS] = { "untagged" };
+static atomic<size_t> tagsUsed(1);
+static mutex tagMutex;
+
+static atomic<uint64_t> totalAllocations(0), totalBytes(0);
+
+static thread_local AllocationCounts threadFrame[ALLOCATION_TAGS];
+static thread_local uint8_t tagStack[MAX_TAG_DEPTH];
+static thread_local size_t tagDepth = 0;
+
+// Of the render thread
+static AllocationCounts lastFrameCounts[ALLOCATION_TAGS];
+
+
+
+bool
+AllocationTracker::enabled()
+{
+#ifdef TRACK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+void
+AllocationTracker::endFrame()
+{
+	for (size_t tag = 0; tag < ALLOCATION_TAGS; tag++) {
+		lastFrameCounts[tag] = threadFrame[tag];
+		threadFrame[tag].allocations = 0;
+		threadFrame[tag].bytes = 0;
+	}
+}
+
+
+AllocationCounts
+AllocationTracker::lastFrame()
+{
+	AllocationCounts counts = { 0, 0 };
+	for (size_t tag = 0; tag < ALLOCATION_TAGS; tag++) {
+		counts.allocations += lastFrameCounts[tag].allocations;
+		counts.bytes += lastFrameCounts[tag].bytes;
+	}
+	return counts;
+}
+
+
+AllocationCounts
+AllocationTracker::lastFrame(size_t tag)
+{
+	return lastFrameCounts[tag];
+}
+
+
+const char*
+AllocationTracker::tagName(size_t tag)
+{
+	return tagNames[tag];
+}
+
+
+size_t
+AllocationTracker::tagCount()
+{
+	return tagsUsed.load();
+}
+
+
+AllocationCounts
+AllocationTracker::total()
+{
+	AllocationCounts counts = { totalAllocations.load(), totalBytes.load() };
+	return counts;
+}
+
+
+void
+AllocationTracker::pushTag(const char* name)
+{
+	// Look for the tag without the lock first, names are only ever appended
+	size_t used = tagsUsed.load(memory_order_acquire);
+	size_t tag = 0;
+	for (size_t t = 1; t < used; t++) {
+		if (tagNames[t] == name) {
+			tag = t;
+			break;
+		}
+	}
+	if (tag == 0) {
+		lock_guard<mutex> lock(tagMutex);
+		used = tagsUsed.load();
+		for (size_t t = 1; t < used && tag == 0; t++) {
+			if (tagNames[t] == name) {
+				tag = t;
+			}
+		}
+		// Past ALLOCATION_TAGS, new tags count as untagged
+		if (tag == 0 && used < ALLOCATION_TAGS) {
+			tag = used;
+			tagNames[tag] = name;
+			tagsUsed.store(used + 1, memory_order_release);
+		}
+	}
+
+	if (tagDepth < MAX_TAG_DEPTH) {
+		tagStack[tagDepth] = tag;
+	}
+	tagDepth++;
+}
+
+
+void
+AllocationTracker::popTag()
+{
+	if (tagDepth > 0) {
+		tagDepth--;
+	}
+}
+
+
+void
+AllocationTracker::record(size_t bytes)
+{
+	totalAllocations.fetch_add(1, memory_order_relaxed);
+	totalBytes.fetch_add(bytes, memory_order_relaxed);
+
+	size_t tag = (tagDepth == 0) ? 0 : tagStack[min(tagDepth, MAX_TAG_DEPTH) - 1];
+	threadFrame[tag].allocations++;
+	threadFrame[tag].bytes += bytes;
+}
+
+
+
+#ifdef TRACK_ALLOCATIONS
+// Instrumented global allocator: counts, then malloc/free. The array forms and the sized and nothrow
+// deletes come back here, so every allocation of the program is seen once.
+
+void*
+operator new(size_t bytes)
+{
+	AllocationTracker::record(bytes);
+	void* p = malloc(bytes ? bytes : 1);
+	if (!p) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+
+void*
+operator new[](size_t bytes)
+{
+	return operator new(bytes);
+}
+
+
+void*
+operator new(size_t bytes, const nothrow_t&) noexcept
+{
+	AllocationTracker::record(bytes);
+	return malloc(bytes ? bytes : 1);
+}
+
+
+void*
+operator new[](size_t bytes, const nothrow_t& tag) noexcept
+{
+	return operator new(bytes, tag);
+}
+
+
+void
+operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+
+void
+operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+
+void
+operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+
+void
+operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+
+void
+operator delete(void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+
+
+void
+operator delete[](void* p, const nothrow_t&) noexcept
+{
+	free(p);
+}
+#endif
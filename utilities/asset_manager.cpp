@@ -0,0 +1,107 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <asset_manager.h>
+
+
+
+AssetManager::AssetManager()
+:meshCpuData(MESH_CPU_KEEP)
+{
+}
+
+
+ModelAssetRef
+AssetManager::loadModel(const string& path, bool gamma)
+{
+	// The same file with and without gamma correction gives different textures
+	string key = path + (gamma ? "#gamma" : "");
+
+	weak_ptr<const ModelAsset>& cached = this->models[key];
+	ModelAssetRef asset = cached.lock();
+	if (!asset) {
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		asset = make_shared<const ModelAsset>(path, gamma, this->meshCpuData);
+		AssetLoad load;
+		load.path = key;
+		load.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		load.report = asset->loadReport;
+		this->loadTimes.push_back(load);
+		cout << "Loaded " << load.report.summary() << endl;
+		cached = asset;
+		this->collect();
+	}
+	return asset;
+}
+
+
+size_t
+AssetManager::loadedCount()
+{
+	this->collect();
+	return this->models.size();
+}
+
+
+string
+AssetManager::memoryReport() const
+{
+	vector<pair<size_t, pair<string, ModelAssetRef> > > assets;
+	for (const pair<const string, weak_ptr<const ModelAsset> >& entry : this->models) {
+		ModelAssetRef asset = entry.second.lock();
+		if (asset) {
+			size_t bytes = asset->cpuBytes() + asset->meshBytes() + asset->textureBytes();
+			assets.push_back(make_pair(bytes, make_pair(entry.first, asset)));
+		}
+	}
+	sort(assets.begin(), assets.end(),
+		 [] (const pair<size_t, pair<string, ModelAssetRef> >& a, const pair<size_t, pair<string, ModelAssetRef> >& b) {
+			 return a.first > b.first;
+		 });
+
+	stringstream ss;
+	ss << fixed << setprecision(1);
+	size_t cpu = 0, gpu = 0;
+	for (const pair<size_t, pair<string, ModelAssetRef> >& entry : assets) {
+		const ModelAsset& asset = *entry.second.second;
+		ss << entry.second.first << ": cpu " << asset.cpuBytes() / 1048576.0 << " MiB, gpu meshes "
+		   << asset.meshBytes() / 1048576.0 << " MiB, gpu textures " << asset.textureBytes() / 1048576.0 << " MiB" << endl;
+		ss << asset.memoryReport();
+		cpu += asset.cpuBytes();
+		gpu += asset.meshBytes() + asset.textureBytes();
+	}
+	ss << assets.size() << " assets: cpu " << cpu / 1048576.0 << " MiB, gpu " << gpu / 1048576.0 << " MiB" << endl;
+	return ss.str();
+}
+
+
+bool
+AssetManager::writeLoadReport(const string& path) const
+{
+	ofstream out(path.c_str());
+	if (!out) {
+		cout << "Could not write the load report to " << path << endl;
+		return false;
+	}
+	for (const AssetLoad& load : this->loadTimes) {
+		out << load.report.report();
+	}
+	return true;
+}
+
+
+void
+AssetManager::collect()
+{
+	for (unordered_map<string, weak_ptr<const ModelAsset> >::iterator it = this->models.begin(); it != this->models.end(); ) {
+		if (it->second.expired()) {
+			it = this->models.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
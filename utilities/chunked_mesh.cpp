@@ -0,0 +1,1363 @@
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <chunked_mesh.h>
+#include <frustum.h>
+#include <trace.h>
+#include <hitch_detector.h>
+#include <frame_arena.h>
+#include <shader_interfaces.h>
+
+
+
+//*******************************************************************************//
+//					Builder
+//*******************************************************************************//
+
+// The source is never in memory: the readers stream it into a temporary file of triangles (each with its
+// vertices, so a triangle needs nothing else), and every node splits its file into one per child. Only the
+// triangles of a leaf, or the LOD grid of an inner node, are in memory at once.
+
+struct SoupTriangle {
+	ChunkVertex v[3];
+};
+
+// Triangles per read or write of a temporary file
+static const size_t SOUP_BLOCK_TRIANGLES = 4096;
+
+// Temporary file of triangles being written, and the bounds of what it holds
+struct SoupFile {
+	string path;
+	ofstream out;
+	uint64_t count;
+	glm::vec3 boundsMin, boundsMax;
+	vector<SoupTriangle> block;
+};
+
+// Vertex attributes of the source, appended to a temporary file while it is read and mapped once the
+// faces need them, so the page cache holds them instead of the heap
+struct AttributeFile {
+	string path;
+	ofstream out;
+	size_t stride;
+	uint64_t count;
+	int fd;
+	char* mapped;
+	size_t mappedBytes;
+};
+
+struct BuildContext {
+	ofstream out;
+	uint64_t offset;
+	vector<ChunkNode> nodes;
+	GLuint maxTriangles;
+	GLuint gridSize;
+	string tempPrefix;          // Of the temporary files, next to the output
+	uint32_t tempCount;
+	bool failed;                // A temporary file could not be written or read back
+};
+
+
+static string
+tempPath(BuildContext& ctx)
+{
+	return ctx.tempPrefix + to_string(ctx.tempCount++);
+}
+
+
+static void
+soupOpen(BuildContext& ctx, SoupFile& soup)
+{
+	soup.path = tempPath(ctx);
+	soup.out.open(soup.path, ios::binary | ios::trunc);
+	soup.count = 0;
+	soup.boundsMin = glm::vec3(FLT_MAX);
+	soup.boundsMax = glm::vec3(-FLT_MAX);
+	soup.block.clear();
+	soup.block.reserve(SOUP_BLOCK_TRIANGLES);
+
+	if (!soup.out) {
+		cout << "Unable to write " << soup.path << endl;
+		ctx.failed = true;
+	}
+}
+
+
+static void
+soupAppend(SoupFile& soup, const SoupTriangle& t)
+{
+	for (int k = 0; k < 3; k++) {
+		soup.boundsMin = glm::min(soup.boundsMin, t.v[k].position);
+		soup.boundsMax = glm::max(soup.boundsMax, t.v[k].position);
+	}
+	soup.count++;
+
+	soup.block.push_back(t);
+	if (soup.block.size() == SOUP_BLOCK_TRIANGLES) {
+		soup.out.write((const char*)soup.block.data(), soup.block.size() * sizeof(SoupTriangle));
+		soup.block.clear();
+	}
+}
+
+
+static void
+soupClose(BuildContext& ctx, SoupFile& soup)
+{
+	soup.out.write((const char*)soup.block.data(), soup.block.size() * sizeof(SoupTriangle));
+	soup.out.close();
+	vector<SoupTriangle>().swap(soup.block);
+
+	if (!soup.out) {
+		cout << "Unable to write " << soup.path << endl;
+		ctx.failed = true;
+	}
+}
+
+
+// Calls visit() on every triangle of a closed SoupFile, in the order they were written
+template <typename Visitor>
+static bool
+readSoup(const string& path, Visitor visit)
+{
+	ifstream in(path, ios::binary);
+	if (!in) {
+		cout << "Unable to read " << path << endl;
+		return false;
+	}
+
+	vector<SoupTriangle> block(SOUP_BLOCK_TRIANGLES);
+	do {
+		in.read((char*)block.data(), block.size() * sizeof(SoupTriangle));
+		size_t count = in.gcount() / sizeof(SoupTriangle);
+		for (size_t i = 0; i < count; i++) {
+			visit(block[i]);
+		}
+	} while (in);
+
+	return in.eof();
+}
+
+
+static void
+attributeOpen(BuildContext& ctx, AttributeFile& a, size_t stride)
+{
+	a.path = tempPath(ctx);
+	a.out.open(a.path, ios::binary | ios::trunc);
+	a.stride = stride;
+	a.count = 0;
+	a.fd = -1;
+	a.mapped = nullptr;
+	a.mappedBytes = 0;
+
+	if (!a.out) {
+		cout << "Unable to write " << a.path << endl;
+		ctx.failed = true;
+	}
+}
+
+
+static void
+attributeAppend(AttributeFile& a, const void* value)
+{
+	a.out.write((const char*)value, a.stride);
+	a.count++;
+}
+
+
+// Ends the writing, the attributes can then be read with attributeAt()
+static bool
+attributeMap(AttributeFile& a)
+{
+	a.out.close();
+	if (!a.out) {
+		cout << "Unable to write " << a.path << endl;
+		return false;
+	}
+	if (a.count == 0) {
+		return true;
+	}
+
+	a.mappedBytes = a.count * a.stride;
+	a.fd = open(a.path.c_str(), O_RDONLY);
+	void* p = (a.fd >= 0) ? mmap(nullptr, a.mappedBytes, PROT_READ, MAP_PRIVATE, a.fd, 0) : MAP_FAILED;
+	if (p == MAP_FAILED) {
+		cout << "Unable to map " << a.path << endl;
+		return false;
+	}
+	a.mapped = (char*)p;
+	return true;
+}
+
+
+static inline const char*
+attributeAt(const AttributeFile& a, uint64_t index)
+{
+	return a.mapped + index * a.stride;
+}
+
+
+static void
+attributeRelease(AttributeFile& a)
+{
+	if (a.mapped) {
+		munmap(a.mapped, a.mappedBytes);
+		a.mapped = nullptr;
+	}
+	if (a.fd >= 0) {
+		close(a.fd);
+		a.fd = -1;
+	}
+	a.out.close();
+	remove(a.path.c_str());
+}
+
+
+// Triangulates a polygon as a fan. Corners without a normal (zero) take the one of their triangle.
+static void
+emitPolygon(SoupFile& soup, const vector<ChunkVertex>& corners)
+{
+	for (size_t i = 1; i + 1 < corners.size(); i++) {
+		SoupTriangle t;
+		t.v[0] = corners[0];
+		t.v[1] = corners[i];
+		t.v[2] = corners[i + 1];
+
+		glm::vec3 faceNormal = glm::cross(t.v[1].position - t.v[0].position, t.v[2].position - t.v[0].position);
+		if (glm::dot(faceNormal, faceNormal) > 0.0f) {
+			faceNormal = glm::normalize(faceNormal);
+		}
+		for (int k = 0; k < 3; k++) {
+			if (t.v[k].normal == glm::vec3(0.0f)) {
+				t.v[k].normal = faceNormal;
+			}
+		}
+		soupAppend(soup, t);
+	}
+}
+
+
+static ChunkVertex
+emptyVertex()
+{
+	ChunkVertex v;
+	v.position = glm::vec3(0.0f);
+	v.normal = glm::vec3(0.0f);
+	v.texCoords = glm::vec2(0.0f);
+	return v;
+}
+
+
+// OBJ index (1 based, or negative from the last one read) to a 0 based one, -1 if absent or out of range
+static int64_t
+objIndex(long index, uint64_t read, uint64_t count)
+{
+	int64_t i = (index > 0) ? index - 1 : (int64_t)read + index;
+	return (index != 0 && i >= 0 && (uint64_t)i < count) ? i : -1;
+}
+
+
+// OBJ: a first pass writes the v, vt and vn lines to attribute files, a second one triangulates the f lines
+static bool
+readObj(BuildContext& ctx, const string& path, SoupFile& soup)
+{
+	ifstream in(path);
+	if (!in) {
+		cout << "Unable to read " << path << endl;
+		return false;
+	}
+
+	AttributeFile positions, texCoords, normals;
+	attributeOpen(ctx, positions, sizeof(glm::vec3));
+	attributeOpen(ctx, texCoords, sizeof(glm::vec2));
+	attributeOpen(ctx, normals, sizeof(glm::vec3));
+
+	string line;
+	while (getline(in, line)) {
+		if (line.size() < 2 || line[0] != 'v') {
+			continue;
+		}
+		if (isspace((unsigned char)line[1])) {
+			glm::vec3 p(0.0f);
+			sscanf(line.c_str() + 2, "%f %f %f", &p.x, &p.y, &p.z);
+			attributeAppend(positions, &p);
+		}
+		else if (line[1] == 't' && line.size() > 2 && isspace((unsigned char)line[2])) {
+			glm::vec2 t(0.0f);
+			sscanf(line.c_str() + 3, "%f %f", &t.x, &t.y);
+			// Flipped, as the model import does
+			t.y = 1.0f - t.y;
+			attributeAppend(texCoords, &t);
+		}
+		else if (line[1] == 'n' && line.size() > 2 && isspace((unsigned char)line[2])) {
+			glm::vec3 n(0.0f);
+			sscanf(line.c_str() + 3, "%f %f %f", &n.x, &n.y, &n.z);
+			attributeAppend(normals, &n);
+		}
+	}
+
+	bool ok = attributeMap(positions) && attributeMap(texCoords) && attributeMap(normals);
+
+	in.clear();
+	in.seekg(0);
+	uint64_t positionsRead = 0, texCoordsRead = 0, normalsRead = 0, skipped = 0;
+	vector<ChunkVertex> corners;
+	while (ok && getline(in, line)) {
+		if (line.size() < 2 || !isspace((unsigned char)line[1])) {
+			if (line.compare(0, 2, "vt") == 0) {
+				texCoordsRead++;
+			}
+			else if (line.compare(0, 2, "vn") == 0) {
+				normalsRead++;
+			}
+			continue;
+		}
+		if (line[0] == 'v') {
+			positionsRead++;
+			continue;
+		}
+		if (line[0] != 'f') {
+			continue;
+		}
+
+		// v, v/vt, v//vn or v/vt/vn corners
+		corners.clear();
+		bool bad = false;
+		const char* p = line.c_str() + 1;
+		while (true) {
+			while (*p == ' ' || *p == '\t') {
+				p++;
+			}
+			if (*p == '\0' || *p == '\r' || *p == '#') {
+				break;
+			}
+
+			long index[3] = { 0, 0, 0 };
+			for (int k = 0; k < 3; k++) {
+				char* end;
+				index[k] = strtol(p, &end, 10);
+				p = end;
+				if (*p != '/') {
+					break;
+				}
+				p++;
+			}
+			while (*p && !isspace((unsigned char)*p)) {
+				p++;
+			}
+
+			int64_t position = objIndex(index[0], positionsRead, positions.count);
+			int64_t texCoord = objIndex(index[1], texCoordsRead, texCoords.count);
+			int64_t normal = objIndex(index[2], normalsRead, normals.count);
+			if (position < 0) {
+				bad = true;
+				continue;
+			}
+
+			ChunkVertex v = emptyVertex();
+			memcpy(&v.position, attributeAt(positions, position), sizeof(glm::vec3));
+			if (texCoord >= 0) {
+				memcpy(&v.texCoords, attributeAt(texCoords, texCoord), sizeof(glm::vec2));
+			}
+			if (normal >= 0) {
+				memcpy(&v.normal, attributeAt(normals, normal), sizeof(glm::vec3));
+			}
+			corners.push_back(v);
+		}
+
+		if (bad || corners.size() < 3) {
+			skipped++;
+			continue;
+		}
+		emitPolygon(soup, corners);
+	}
+
+	if (skipped > 0) {
+		cout << "Skipped " << skipped << " faces with missing vertices in " << path << endl;
+	}
+	attributeRelease(positions);
+	attributeRelease(texCoords);
+	attributeRelease(normals);
+	return ok;
+}
+
+
+enum PlyFormat {
+	PLY_ASCII,
+	PLY_BINARY_LITTLE_ENDIAN,
+	PLY_BINARY_BIG_ENDIAN
+};
+
+enum PlyType {
+	PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64,
+	PLY_TYPE_INVALID
+};
+
+struct PlyProperty {
+	string name;
+	PlyType type;
+	PlyType countType;          // PLY_TYPE_INVALID if not a list
+};
+
+struct PlyElement {
+	string name;
+	uint64_t count;
+	vector<PlyProperty> properties;
+};
+
+
+static PlyType
+plyType(const string& name)
+{
+	static const char* names[][2] = {
+		{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+		{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+	};
+	for (int type = 0; type < PLY_TYPE_INVALID; type++) {
+		if (name == names[type][0] || name == names[type][1]) {
+			return (PlyType)type;
+		}
+	}
+	return PLY_TYPE_INVALID;
+}
+
+
+static double
+readPlyValue(istream& in, PlyFormat format, PlyType type)
+{
+	if (format == PLY_ASCII) {
+		double value = 0.0;
+		in >> value;
+		return value;
+	}
+
+	static const size_t sizes[PLY_TYPE_INVALID] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+	static const uint16_t one = 1;
+	bool littleEndianHost = *(const uint8_t*)&one == 1;
+
+	char bytes[8] = { 0 };
+	size_t size = sizes[type];
+	in.read(bytes, size);
+	if ((format == PLY_BINARY_LITTLE_ENDIAN) != littleEndianHost) {
+		reverse(bytes, bytes + size);
+	}
+
+	switch (type) {
+	case PLY_INT8:    { int8_t v;   memcpy(&v, bytes, size); return v; }
+	case PLY_UINT8:   { uint8_t v;  memcpy(&v, bytes, size); return v; }
+	case PLY_INT16:   { int16_t v;  memcpy(&v, bytes, size); return v; }
+	case PLY_UINT16:  { uint16_t v; memcpy(&v, bytes, size); return v; }
+	case PLY_INT32:   { int32_t v;  memcpy(&v, bytes, size); return v; }
+	case PLY_UINT32:  { uint32_t v; memcpy(&v, bytes, size); return v; }
+	case PLY_FLOAT32: { float v;    memcpy(&v, bytes, size); return v; }
+	default:          { double v;   memcpy(&v, bytes, size); return v; }
+	}
+}
+
+
+static void
+skipPlyProperty(istream& in, PlyFormat format, const PlyProperty& property)
+{
+	uint64_t count = 1;
+	if (property.countType != PLY_TYPE_INVALID) {
+		count = (uint64_t)readPlyValue(in, format, property.countType);
+	}
+	for (uint64_t i = 0; i < count && in; i++) {
+		readPlyValue(in, format, property.type);
+	}
+}
+
+
+// PLY, ascii or binary: the vertex element is written to an attribute file, then the face element is
+// triangulated from it. Other elements are skipped.
+static bool
+readPly(BuildContext& ctx, const string& path, SoupFile& soup)
+{
+	ifstream in(path, ios::binary);
+	string line;
+	if (!in || !getline(in, line) || line.compare(0, 3, "ply") != 0) {
+		cout << "Not a PLY file: " << path << endl;
+		return false;
+	}
+
+	PlyFormat format = PLY_ASCII;
+	vector<PlyElement> elements;
+	bool valid = true;
+	while (getline(in, line)) {
+		stringstream ss(line);
+		string keyword;
+		ss >> keyword;
+
+		if (keyword == "format") {
+			string name;
+			ss >> name;
+			format = (name == "binary_little_endian") ? PLY_BINARY_LITTLE_ENDIAN :
+					 (name == "binary_big_endian") ? PLY_BINARY_BIG_ENDIAN : PLY_ASCII;
+			valid = valid && (name == "ascii" || format != PLY_ASCII);
+		}
+		else if (keyword == "element") {
+			PlyElement element;
+			ss >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty()) {
+			PlyProperty property;
+			string type;
+			ss >> type;
+			if (type == "list") {
+				string countType;
+				ss >> countType >> type;
+				property.countType = plyType(countType);
+				valid = valid && property.countType != PLY_TYPE_INVALID;
+			}
+			else {
+				property.countType = PLY_TYPE_INVALID;
+			}
+			ss >> property.name;
+			property.type = plyType(type);
+			valid = valid && property.type != PLY_TYPE_INVALID;
+			elements.back().properties.push_back(property);
+		}
+		else if (keyword == "end_header") {
+			break;
+		}
+	}
+	if (!valid || !in) {
+		cout << "Unsupported PLY header: " << path << endl;
+		return false;
+	}
+
+	// Components a vertex property fills, by index: position, normal, texture coordinates
+	static const char* attributeNames[][8] = {
+		{ "x", "y", "z", "nx", "ny", "nz", "u", "v" },
+		{ "x", "y", "z", "nx", "ny", "nz", "s", "t" },
+		{ "x", "y", "z", "nx", "ny", "nz", "texture_u", "texture_v" }
+	};
+
+	AttributeFile vertices;
+	attributeOpen(ctx, vertices, sizeof(ChunkVertex));
+	bool verticesRead = false, ok = true;
+	uint64_t skipped = 0;
+	vector<ChunkVertex> corners;
+
+	for (const PlyElement& element : elements) {
+		if (element.name == "vertex") {
+			vector<int> slots;
+			bool textured = false;
+			for (const PlyProperty& property : element.properties) {
+				int slot = -1;
+				for (int s = 0; s < 8 && slot < 0 && property.countType == PLY_TYPE_INVALID; s++) {
+					for (int n = 0; n < 3; n++) {
+						if (property.name == attributeNames[n][s]) {
+							slot = s;
+						}
+					}
+				}
+				textured = textured || slot >= 6;
+				slots.push_back(slot);
+			}
+
+			for (uint64_t i = 0; i < element.count && in; i++) {
+				ChunkVertex v = emptyVertex();
+				GLfloat* components[8] = { &v.position.x, &v.position.y, &v.position.z,
+										   &v.normal.x, &v.normal.y, &v.normal.z, &v.texCoords.x, &v.texCoords.y };
+				for (size_t p = 0; p < slots.size(); p++) {
+					if (slots[p] < 0) {
+						skipPlyProperty(in, format, element.properties[p]);
+					}
+					else {
+						*components[slots[p]] = (GLfloat)readPlyValue(in, format, element.properties[p].type);
+					}
+				}
+				// Flipped, as the model import does
+				if (textured) {
+					v.texCoords.y = 1.0f - v.texCoords.y;
+				}
+				attributeAppend(vertices, &v);
+			}
+			verticesRead = true;
+			ok = attributeMap(vertices);
+		}
+		else if (element.name == "face" && verticesRead) {
+			for (uint64_t i = 0; i < element.count && in; i++) {
+				corners.clear();
+				bool bad = false;
+				for (const PlyProperty& property : element.properties) {
+					if (property.countType == PLY_TYPE_INVALID ||
+						(property.name != "vertex_indices" && property.name != "vertex_index")) {
+						skipPlyProperty(in, format, property);
+						continue;
+					}
+					uint64_t count = (uint64_t)readPlyValue(in, format, property.countType);
+					for (uint64_t k = 0; k < count && in; k++) {
+						double index = readPlyValue(in, format, property.type);
+						if (index < 0.0 || index >= (double)vertices.count) {
+							bad = true;
+							continue;
+						}
+						ChunkVertex v;
+						memcpy(&v, attributeAt(vertices, (uint64_t)index), sizeof(ChunkVertex));
+						corners.push_back(v);
+					}
+				}
+
+				if (bad || corners.size() < 3) {
+					skipped++;
+					continue;
+				}
+				emitPolygon(soup, corners);
+			}
+		}
+		else if (element.name == "face") {
+			cout << "The faces come before the vertices in " << path << endl;
+			ok = false;
+		}
+		else {
+			for (uint64_t i = 0; i < element.count && in; i++) {
+				for (const PlyProperty& property : element.properties) {
+					skipPlyProperty(in, format, property);
+				}
+			}
+		}
+
+		if (!ok || !in) {
+			break;
+		}
+	}
+
+	if (ok && !in) {
+		cout << "Truncated PLY file: " << path << endl;
+		ok = false;
+	}
+	if (skipped > 0) {
+		cout << "Skipped " << skipped << " faces with missing vertices in " << path << endl;
+	}
+	attributeRelease(vertices);
+	return ok;
+}
+
+
+static void
+writePayload(BuildContext& ctx, ChunkNode& node, const vector<ChunkVertex>& vertices, const vector<GLushort>& indices)
+{
+	node.offset = ctx.offset;
+	node.vertexCount = vertices.size();
+	node.indexCount = indices.size();
+
+	ctx.out.write((const char*)vertices.data(), vertices.size() * sizeof(ChunkVertex));
+	ctx.out.write((const char*)indices.data(), indices.size() * sizeof(GLushort));
+	ctx.offset += vertices.size() * sizeof(ChunkVertex) + indices.size() * sizeof(GLushort);
+}
+
+
+// Full resolution payload of the triangles in 'path', identical vertices shared, in order of first use
+static void
+writeLeaf(BuildContext& ctx, ChunkNode& node, const string& path)
+{
+	vector<ChunkVertex> corners;
+	if (!readSoup(path, [&corners] (const SoupTriangle& t) { corners.insert(corners.end(), t.v, t.v + 3); })) {
+		ctx.failed = true;
+	}
+
+	// Equal corners end up next to each other
+	vector<uint32_t> order(corners.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	sort(order.begin(), order.end(), [&corners] (uint32_t a, uint32_t b) {
+		return memcmp(&corners[a], &corners[b], sizeof(ChunkVertex)) < 0;
+	});
+
+	// First corner of each group of equal ones
+	vector<uint32_t> firstEqual(corners.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		bool same = i > 0 && memcmp(&corners[order[i - 1]], &corners[order[i]], sizeof(ChunkVertex)) == 0;
+		firstEqual[order[i]] = same ? firstEqual[order[i - 1]] : order[i];
+	}
+
+	unordered_map<uint32_t, GLushort> remap;
+	vector<ChunkVertex> vertices;
+	vector<GLushort> indices;
+	indices.reserve(corners.size());
+	for (size_t i = 0; i < corners.size(); i++) {
+		auto it = remap.find(firstEqual[i]);
+		if (it == remap.end()) {
+			it = remap.insert(make_pair(firstEqual[i], (GLushort)vertices.size())).first;
+			vertices.push_back(corners[i]);
+		}
+		indices.push_back(it->second);
+	}
+
+	node.error = 0.0f;
+	writePayload(ctx, node, vertices, indices);
+}
+
+
+// Simplified payload of the triangles in 'path' - every vertex is merged with the others in its cell of a
+// gridSize^3 grid laid over the node bounds, triangles that collapse are dropped and the ones collapsing to
+// the same cells are kept once. Memory is bounded by the grid, whatever the number of triangles.
+static void
+writeClustered(BuildContext& ctx, ChunkNode& node, const string& path)
+{
+	glm::vec3 bmin(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+	glm::vec3 bmax(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+	glm::vec3 extent = bmax - bmin;
+	GLfloat cellSize = max(max(extent.x, extent.y), max(extent.z, FLT_MIN)) / ctx.gridSize;
+	GLint last = ctx.gridSize - 1;
+	GLuint gridSize = ctx.gridSize;
+
+	unordered_map<uint32_t, GLushort> cells;
+	unordered_set<uint64_t> kept;       // Corners of the triangles kept, rotated to start with the smallest
+	vector<ChunkVertex> vertices;
+	vector<GLfloat> weights;
+	vector<GLushort> indices;
+
+	bool read = readSoup(path, [&] (const SoupTriangle& t) {
+		GLushort corner[3];
+		for (int k = 0; k < 3; k++) {
+			const ChunkVertex& v = t.v[k];
+			glm::vec3 cell = (v.position - bmin) / cellSize;
+			uint32_t x = min(max((GLint)cell.x, 0), last);
+			uint32_t y = min(max((GLint)cell.y, 0), last);
+			uint32_t z = min(max((GLint)cell.z, 0), last);
+			uint32_t key = (x * gridSize + y) * gridSize + z;
+
+			auto it = cells.find(key);
+			if (it == cells.end()) {
+				it = cells.insert(make_pair(key, (GLushort)vertices.size())).first;
+				vertices.push_back(emptyVertex());
+				weights.push_back(0.0f);
+			}
+			// Accumulate, averaged below
+			ChunkVertex& merged = vertices[it->second];
+			merged.position += v.position;
+			merged.normal += v.normal;
+			merged.texCoords += v.texCoords;
+			weights[it->second] += 1.0f;
+			corner[k] = it->second;
+		}
+
+		if (corner[0] == corner[1] || corner[1] == corner[2] || corner[0] == corner[2]) {
+			return;
+		}
+		int first = (corner[1] < corner[0]) ? ((corner[2] < corner[1]) ? 2 : 1) : ((corner[2] < corner[0]) ? 2 : 0);
+		uint64_t key = ((uint64_t)corner[first] << 32) | ((uint64_t)corner[(first + 1) % 3] << 16) | corner[(first + 2) % 3];
+		if (kept.insert(key).second) {
+			indices.push_back(corner[0]);
+			indices.push_back(corner[1]);
+			indices.push_back(corner[2]);
+		}
+	});
+	if (!read) {
+		ctx.failed = true;
+	}
+
+	for (size_t i = 0; i < vertices.size(); i++) {
+		vertices[i].position /= weights[i];
+		vertices[i].texCoords /= weights[i];
+		if (glm::dot(vertices[i].normal, vertices[i].normal) > 0.0f) {
+			vertices[i].normal = glm::normalize(vertices[i].normal);
+		}
+	}
+
+	node.error = cellSize * sqrtf(3.0f);
+	writePayload(ctx, node, vertices, indices);
+}
+
+
+// Builds the subtree of the triangles of 'soup', a closed SoupFile that is removed once split or written
+static int32_t
+buildNode(BuildContext& ctx, const SoupFile& soup)
+{
+	int32_t index = ctx.nodes.size();
+	ctx.nodes.push_back(ChunkNode());
+
+	// Don't keep a reference, ctx.nodes grows while building the children
+	{
+		ChunkNode& node = ctx.nodes[index];
+		memset(&node, 0, sizeof(ChunkNode));
+		for (int k = 0; k < 3; k++) {
+			node.boundsMin[k] = soup.boundsMin[k];
+			node.boundsMax[k] = soup.boundsMax[k];
+		}
+		for (int k = 0; k < 8; k++) {
+			node.children[k] = CHUNK_NO_CHILD;
+		}
+
+		if (soup.count <= ctx.maxTriangles) {
+			writeLeaf(ctx, node, soup.path);
+			remove(soup.path.c_str());
+			return index;
+		}
+		writeClustered(ctx, node, soup.path);
+	}
+
+	// Split by the octant of the triangle centroids
+	glm::vec3 center = (soup.boundsMin + soup.boundsMax) * 0.5f;
+	SoupFile octants[8];
+	for (int k = 0; k < 8; k++) {
+		soupOpen(ctx, octants[k]);
+	}
+	bool read = readSoup(soup.path, [&octants, &center] (const SoupTriangle& t) {
+		glm::vec3 c = (t.v[0].position + t.v[1].position + t.v[2].position) / 3.0f;
+		int octant = (c.x > center.x ? 1 : 0) | (c.y > center.y ? 2 : 0) | (c.z > center.z ? 4 : 0);
+		soupAppend(octants[octant], t);
+	});
+	for (int k = 0; k < 8; k++) {
+		soupClose(ctx, octants[k]);
+	}
+
+	// All centroids in the same octant (e.g. many coincident triangles) - split in halves instead
+	for (int k = 0; k < 8 && read; k++) {
+		if (octants[k].count != soup.count) {
+			continue;
+		}
+		for (SoupFile& octant : octants) {
+			remove(octant.path.c_str());
+		}
+		octants[k].count = 0;
+		soupOpen(ctx, octants[0]);
+		soupOpen(ctx, octants[1]);
+
+		uint64_t n = 0, half = soup.count / 2;
+		read = readSoup(soup.path, [&octants, &n, half] (const SoupTriangle& t) {
+			soupAppend(octants[(n++ < half) ? 0 : 1], t);
+		});
+		soupClose(ctx, octants[0]);
+		soupClose(ctx, octants[1]);
+		break;
+	}
+	if (!read) {
+		ctx.failed = true;
+	}
+
+	// The children own the triangles from now on
+	remove(soup.path.c_str());
+
+	int child = 0;
+	for (int k = 0; k < 8; k++) {
+		if (octants[k].count == 0 || ctx.failed) {
+			remove(octants[k].path.c_str());
+			continue;
+		}
+		int32_t childIndex = buildNode(ctx, octants[k]);
+		ctx.nodes[index].children[child++] = childIndex;
+	}
+
+	return index;
+}
+
+
+bool
+ChunkedMeshBuilder::build(const string& sourcePath, const string& outputPath,
+						  GLuint maxTrianglesPerChunk, GLuint lodGridSize)
+{
+	BuildContext ctx;
+	// Chunks are indexed with 16 bits
+	ctx.maxTriangles = min(maxTrianglesPerChunk, 65535u / 3);
+	ctx.gridSize = min(max(lodGridSize, 2u), 40u);
+	ctx.offset = 0;
+	ctx.tempPrefix = outputPath + ".tmp";
+	ctx.tempCount = 0;
+	ctx.failed = false;
+
+	string extension = sourcePath.substr(min(sourcePath.find_last_of('.'), sourcePath.size()));
+	transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+	// Every triangle of the source, in one temporary file
+	SoupFile soup;
+	soupOpen(ctx, soup);
+	bool read = false;
+	if (extension == ".ply") {
+		read = readPly(ctx, sourcePath, soup);
+	}
+	else if (extension == ".obj") {
+		read = readObj(ctx, sourcePath, soup);
+	}
+	else {
+		cout << "Only PLY and OBJ files can be converted: " << sourcePath << endl;
+	}
+	soupClose(ctx, soup);
+
+	if (!read || ctx.failed || soup.count == 0) {
+		if (read && !ctx.failed) {
+			cout << "No triangles in " << sourcePath << endl;
+		}
+		remove(soup.path.c_str());
+		return false;
+	}
+
+	ctx.out.open(outputPath, ios::binary | ios::trunc);
+	if (!ctx.out) {
+		cout << "Unable to write " << outputPath << endl;
+		remove(soup.path.c_str());
+		return false;
+	}
+
+	// The size of the node table is only known once the whole octree is built, so the payloads are
+	// written first, and the header and table are prepended to them at the end.
+	uint64_t triangleCount = soup.count;
+	buildNode(ctx, soup);
+	ctx.out.close();
+	if (ctx.failed) {
+		remove(outputPath.c_str());
+		return false;
+	}
+
+	// Prepend the header and node table to the payloads
+	uint64_t tableSize = sizeof(ChunkFileHeader) + ctx.nodes.size() * sizeof(ChunkNode);
+	for (ChunkNode& node : ctx.nodes) {
+		node.offset += tableSize;
+	}
+
+	ChunkFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHUNK_FILE_MAGIC, sizeof(header.magic));
+	header.version = CHUNK_FILE_VERSION;
+	header.nodeCount = ctx.nodes.size();
+	memcpy(header.boundsMin, ctx.nodes[0].boundsMin, sizeof(header.boundsMin));
+	memcpy(header.boundsMax, ctx.nodes[0].boundsMax, sizeof(header.boundsMax));
+
+	string payloadPath = outputPath + ".payload";
+	if (rename(outputPath.c_str(), payloadPath.c_str()) != 0) {
+		cout << "Unable to write " << outputPath << endl;
+		return false;
+	}
+
+	ifstream payloads(payloadPath, ios::binary);
+	ofstream out(outputPath, ios::binary | ios::trunc);
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)ctx.nodes.data(), ctx.nodes.size() * sizeof(ChunkNode));
+	out << payloads.rdbuf();
+	bool ok = out.good();
+	out.close();
+	payloads.close();
+	remove(payloadPath.c_str());
+
+	cout << "Wrote " << ctx.nodes.size() << " chunks (" << triangleCount << " triangles) to " << outputPath << endl;
+	return ok;
+}
+
+
+//*******************************************************************************//
+//					Streaming
+//*******************************************************************************//
+
+struct StreamedMesh::Loader {
+	thread worker;
+	mutex queueMutex;
+	condition_variable queueCondition;
+	vector<Request> requests;   // Sorted, most important last
+	deque<pair<uint32_t, vector<char> > > completed;
+	int64_t reading;            // Node being read by the worker, -1 if none
+	bool quit;
+
+	Loader() :reading(-1), quit(false) {}
+};
+
+
+StreamedMesh::StreamedMesh(const string& path)
+:maxScreenError(2.0f),
+ cpuBudget(64 << 20),
+ gpuBudget(256 << 20),
+ uploadBudget(4 << 20),
+ fd(-1),
+ frame(0),
+ gpuResident(0),
+ cpuResident(0),
+ loader(new Loader())
+{
+	ChunkFileHeader header;
+
+	this->fd = open(path.c_str(), O_RDONLY);
+	if (this->fd < 0 ||
+		pread(this->fd, &header, sizeof(header), 0) != sizeof(header) ||
+		memcmp(header.magic, CHUNK_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != CHUNK_FILE_VERSION ||
+		header.nodeCount == 0)
+	{
+		cout << "Unable to open chunked mesh: " << path << endl;
+		if (this->fd >= 0) {
+			close(this->fd);
+			this->fd = -1;
+		}
+		return;
+	}
+
+	this->nodes.resize(header.nodeCount);
+	size_t tableSize = header.nodeCount * sizeof(ChunkNode);
+	if (pread(this->fd, this->nodes.data(), tableSize, sizeof(header)) != (ssize_t)tableSize) {
+		cout << "Truncated chunked mesh: " << path << endl;
+		close(this->fd);
+		this->fd = -1;
+		this->nodes.clear();
+		return;
+	}
+
+	this->boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	this->boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+
+	this->data.resize(header.nodeCount);
+	for (size_t i = 0; i < this->data.size(); i++) {
+		NodeData& d = this->data[i];
+		d.state = UNLOADED;
+		d.VAO = d.VBO = d.EBO = 0;
+		d.bytes = this->nodes[i].vertexCount * sizeof(ChunkVertex) + this->nodes[i].indexCount * sizeof(GLushort);
+		d.lastUsedFrame = 0;
+	}
+
+	this->loader->worker = thread(&StreamedMesh::loaderLoop, this);
+}
+
+
+StreamedMesh::~StreamedMesh()
+{
+	if (this->loader->worker.joinable()) {
+		{
+			lock_guard<mutex> lock(this->loader->queueMutex);
+			this->loader->quit = true;
+		}
+		this->loader->queueCondition.notify_all();
+		this->loader->worker.join();
+	}
+	delete this->loader;
+
+	for (size_t i = 0; i < this->data.size(); i++) {
+		if (this->data[i].state == RESIDENT) {
+			this->evict(i);
+		}
+	}
+
+	if (this->fd >= 0) {
+		close(this->fd);
+	}
+}
+
+
+void
+StreamedMesh::loaderLoop()
+{
+	Trace::setThreadName("chunk loader");
+
+	Loader& l = *this->loader;
+
+	while (true) {
+		Request r;
+		{
+			unique_lock<mutex> lock(l.queueMutex);
+			l.queueCondition.wait(lock, [&l] { return l.quit || !l.requests.empty(); });
+			if (l.quit) {
+				return;
+			}
+
+			// Over the CPU budget - wait for the render thread to upload some
+			if (this->cpuResident.load() + this->data[l.requests.back().node].bytes > this->cpuBudget) {
+				l.queueCondition.wait_for(lock, chrono::milliseconds(5));
+				continue;
+			}
+
+			r = l.requests.back();
+			l.requests.pop_back();
+			l.reading = r.node;
+		}
+
+		TraceScope trace("read chunk");
+
+		// The node table (and the sizes in data) is never modified after the constructor, it's safe to read here
+		const ChunkNode& node = this->nodes[r.node];
+		size_t bytes = this->data[r.node].bytes;
+		vector<char> payload(bytes);
+
+		size_t done = 0;
+		while (done < bytes) {
+			ssize_t n = pread(this->fd, &payload[done], bytes - done, node.offset + done);
+			if (n <= 0) {
+				break;
+			}
+			done += n;
+		}
+
+		lock_guard<mutex> lock(l.queueMutex);
+		l.reading = -1;
+		if (done != bytes) {
+			cout << "Failed reading chunk " << r.node << endl;
+			continue;
+		}
+		this->cpuResident += bytes;
+		l.completed.push_back(make_pair(r.node, vector<char>()));
+		l.completed.back().second.swap(payload);
+	}
+}
+
+
+bool
+StreamedMesh::visible(uint32_t index, const glm::vec4 frustum[6]) const
+{
+	const ChunkNode& node = this->nodes[index];
+	glm::vec3 bmin(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+	glm::vec3 bmax(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+
+	return sphereInFrustum(frustum, (bmin + bmax) * 0.5f, glm::length(bmax - bmin) * 0.5f);
+}
+
+
+void
+StreamedMesh::request(uint32_t index, GLuint depth, const glm::vec3& viewPos, const glm::vec3& viewDir)
+{
+	if (this->data[index].state == RESIDENT) {
+		return;
+	}
+
+	const ChunkNode& node = this->nodes[index];
+	glm::vec3 center = (glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]) +
+						glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2])) * 0.5f;
+	glm::vec3 toNode = center - viewPos;
+	GLfloat distance = glm::length(toNode);
+	GLfloat facing = (distance > 0.0f) ? glm::dot(toNode / distance, viewDir) : 1.0f;
+
+	// Close, in front, and coarse first - coarse nodes are the fallback of their children
+	Request r;
+	r.priority = distance * (1.5f - 0.5f * facing) * (1.0f + depth);
+	r.node = index;
+
+	if (this->data[index].state == LOADED) {
+		this->toUpload.push_back(r);
+	}
+	else {
+		this->wanted.push_back(r);
+	}
+}
+
+
+void
+StreamedMesh::select(uint32_t index, GLuint depth, const glm::vec4 frustum[6], const glm::vec3& viewPos,
+					 const glm::vec3& viewDir, GLfloat pixelsPerUnit)
+{
+	const ChunkNode& node = this->nodes[index];
+
+	if (!this->visible(index, frustum)) {
+		return;
+	}
+	this->data[index].lastUsedFrame = this->frame;
+
+	glm::vec3 bmin(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+	glm::vec3 bmax(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+	GLfloat distance = glm::length((bmin + bmax) * 0.5f - viewPos) - glm::length(bmax - bmin) * 0.5f;
+	GLfloat screenError = node.error * pixelsPerUnit / max(distance, 1e-3f);
+
+	bool leaf = (node.children[0] == CHUNK_NO_CHILD);
+	if (leaf || screenError <= this->maxScreenError) {
+		if (this->resident(index)) {
+			this->drawList.push_back(index);
+		}
+		else {
+			this->request(index, depth, viewPos, viewDir);
+		}
+		return;
+	}
+
+	// Refine only once the children that will be drawn can replace this node, until then keep drawing it.
+	// The ones out of the frustum are skipped by select() anyway, waiting for them would never refine.
+	bool ready = true;
+	for (int k = 0; k < 8 && node.children[k] != CHUNK_NO_CHILD; k++) {
+		if (this->visible(node.children[k], frustum) && !this->resident(node.children[k])) {
+			ready = false;
+			this->request(node.children[k], depth + 1, viewPos, viewDir);
+		}
+	}
+
+	if (ready) {
+		for (int k = 0; k < 8 && node.children[k] != CHUNK_NO_CHILD; k++) {
+			this->select(node.children[k], depth + 1, frustum, viewPos, viewDir, pixelsPerUnit);
+		}
+	}
+	else if (this->resident(index)) {
+		this->drawList.push_back(index);
+	}
+	else {
+		this->request(index, depth, viewPos, viewDir);
+	}
+}
+
+
+void
+StreamedMesh::update(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+					 const glm::vec3& viewPos, GLfloat fov, GLuint viewportHeight)
+{
+	if (!this->isOpen()) {
+		return;
+	}
+	this->frame++;
+
+	// 1. Take what the loader has read so far
+	Loader& l = *this->loader;
+	{
+		lock_guard<mutex> lock(l.queueMutex);
+		while (!l.completed.empty()) {
+			NodeData& d = this->data[l.completed.front().first];
+			vector<char>& payload = l.completed.front().second;
+			if (d.state == UNLOADED) {
+				d.payload.swap(payload);
+				d.state = LOADED;
+			}
+			else {
+				this->cpuResident -= payload.size();
+			}
+			l.completed.pop_front();
+		}
+	}
+
+	// 2. Select the nodes to draw - everything is done in model space
+	glm::mat4 inverseModel = glm::inverse(model);
+	glm::vec4 frustum[6];
+	extractFrustumPlanes(projection * view * model, frustum);
+
+	glm::vec3 localViewPos = glm::vec3(inverseModel * glm::vec4(viewPos, 1.0f));
+	glm::vec3 localViewDir = glm::normalize(glm::vec3(inverseModel * glm::vec4(-view[0][2], -view[1][2], -view[2][2], 0.0f)));
+	GLfloat pixelsPerUnit = viewportHeight / (2.0f * tanf(glm::radians(fov) * 0.5f));
+
+	this->drawList.clear();
+	this->wanted.clear();
+	this->toUpload.clear();
+	this->select(0, 0, frustum, localViewPos, localViewDir, pixelsPerUnit);
+
+	// 3. Hand the missing nodes to the loader, most important last
+	sort(this->wanted.begin(), this->wanted.end());
+	reverse(this->wanted.begin(), this->wanted.end());
+	{
+		lock_guard<mutex> lock(l.queueMutex);
+		this->wanted.erase(remove_if(this->wanted.begin(), this->wanted.end(),
+									 [&l] (const Request& r) { return (int64_t)r.node == l.reading; }),
+						   this->wanted.end());
+		l.requests.swap(this->wanted);
+	}
+	l.queueCondition.notify_one();
+
+	// 4. Upload, most important first, within the per frame budget
+	sort(this->toUpload.begin(), this->toUpload.end());
+	size_t uploaded = 0;
+	for (const Request& r : this->toUpload) {
+		if (uploaded > 0 && uploaded + this->data[r.node].bytes > this->uploadBudget) {
+			break;
+		}
+		uploaded += this->data[r.node].bytes;
+		this->upload(r.node);
+	}
+
+	// Chunks read for a view we've already left would block the loader, drop them
+	if (this->cpuResident.load() > this->cpuBudget) {
+		for (size_t i = 0; i < this->data.size(); i++) {
+			NodeData& d = this->data[i];
+			if (d.state == LOADED && d.lastUsedFrame != this->frame) {
+				this->cpuResident -= d.payload.size();
+				vector<char>().swap(d.payload);
+				d.state = UNLOADED;
+			}
+		}
+	}
+
+	// 5. Evict the least recently used nodes over the GPU budget (never the ones used this frame)
+	if (this->gpuResident > this->gpuBudget) {
+		FrameVector<pair<uint64_t, uint32_t> > candidates;
+		for (size_t i = 1; i < this->data.size(); i++) {
+			if (this->data[i].state == RESIDENT && this->data[i].lastUsedFrame != this->frame) {
+				candidates.push_back(make_pair(this->data[i].lastUsedFrame, (uint32_t)i));
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+		for (size_t i = 0; i < candidates.size() && this->gpuResident > this->gpuBudget; i++) {
+			this->evict(candidates[i].second);
+		}
+	}
+}
+
+
+void
+StreamedMesh::upload(uint32_t index)
+{
+	HitchScope hitch(HITCH_CHUNK_UPLOAD);
+	NodeData& d = this->data[index];
+	const ChunkNode& node = this->nodes[index];
+	size_t vertexBytes = node.vertexCount * sizeof(ChunkVertex);
+
+	glGenVertexArrays(1, &d.VAO);
+	glGenBuffers(1, &d.VBO);
+	glGenBuffers(1, &d.EBO);
+
+	glBindVertexArray(d.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, d.VBO);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, d.payload.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, d.EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, node.indexCount * sizeof(GLushort), d.payload.data() + vertexBytes, GL_STATIC_DRAW);
+	RenderStats::frame.bytesUploaded += vertexBytes + node.indexCount * sizeof(GLushort);
+
+	// Same attribute locations as Mesh, so the model programs can draw chunks
+	// Vertex Positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), (GLvoid*)0);
+	// Vertex Normals
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), (GLvoid*)offsetof(ChunkVertex, normal));
+	// Vertex Texture Coords
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ChunkVertex), (GLvoid*)offsetof(ChunkVertex, texCoords));
+
+	glBindVertexArray(0);
+
+	this->cpuResident -= d.payload.size();
+	vector<char>().swap(d.payload);
+	this->gpuResident += d.bytes;
+	d.state = RESIDENT;
+}
+
+
+void
+StreamedMesh::evict(uint32_t index)
+{
+	HitchScope hitch(HITCH_GPU_RELEASE);
+	NodeData& d = this->data[index];
+
+	glDeleteVertexArrays(1, &d.VAO);
+	glDeleteBuffers(1, &d.VBO);
+	glDeleteBuffers(1, &d.EBO);
+	d.VAO = d.VBO = d.EBO = 0;
+
+	this->gpuResident -= d.bytes;
+	d.state = UNLOADED;
+}
+
+
+void
+StreamedMesh::draw(Program& program)
+{
+	// Chunks carry no material, draw them with a plain one
+	program.set(Uniforms::material_ambient, glm::vec3(0.2f));
+	program.set(Uniforms::material_diffuse, glm::vec3(0.8f));
+	program.set(Uniforms::material_specular, glm::vec3(0.2f));
+	program.set(Uniforms::material_shininess, 16.0f);
+
+	for (uint32_t index : this->drawList) {
+		glBindVertexArray(this->data[index].VAO);
+		glDrawElements(GL_TRIANGLES, this->nodes[index].indexCount, GL_UNSIGNED_SHORT, 0);
+		RenderStats::frame.vaoBinds++;
+		RenderStats::frame.draw(GL_TRIANGLES, this->nodes[index].indexCount);
+	}
+	glBindVertexArray(0);
+}
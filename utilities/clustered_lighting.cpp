@@ -0,0 +1,291 @@
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <clustered_lighting.h>
+#include <frustum.h>
+#include <texture_buffer.h>
+#include <trace.h>
+#include <shader_interfaces.h>
+
+
+static inline GLint
+tile(GLfloat ndc, GLuint tiles)
+{
+	return min(max((GLint)floor((ndc * 0.5f + 0.5f) * tiles), 0), (GLint)tiles - 1);
+}
+
+
+
+struct ClusteredLighting::Workers {
+	vector<thread> threads;
+	size_t shares;          // Of the depth slices: one per worker, plus the render thread's
+	mutex lock;
+	condition_variable start, done;
+	uint64_t generation;    // Bumped for every frame's job
+	size_t pending;         // Workers still busy with it
+	bool quit;
+
+	Workers() :shares(1), generation(0), pending(0), quit(false) {}
+};
+
+
+ClusteredLighting::ClusteredLighting()
+:clusterLights(CLUSTER_COUNT),
+ ranges(CLUSTER_COUNT * 2),
+ clusterMin(CLUSTER_COUNT), clusterMax(CLUSTER_COUNT),
+ zNear(0.0f), zFar(0.0f), width(0), height(0),
+ workers(new Workers())
+{
+	glGenBuffers(3, this->buffers);
+	glGenTextures(3, this->textures);
+	for (int i = 0; i < 3; i++) {
+		this->capacities[i] = 0;
+	}
+
+	// The render thread takes one share of the slices, a few workers the others
+	unsigned int cores = thread::hardware_concurrency();
+	size_t count = (cores > 1) ? min(cores, 4u) - 1 : 0;
+	this->workers->shares = count + 1;
+	for (size_t i = 0; i < count; i++) {
+		this->workers->threads.push_back(thread(&ClusteredLighting::workerLoop, this, i + 1));
+	}
+}
+
+
+ClusteredLighting::~ClusteredLighting()
+{
+	{
+		lock_guard<mutex> lock(this->workers->lock);
+		this->workers->quit = true;
+	}
+	this->workers->start.notify_all();
+	for (thread& t : this->workers->threads) {
+		t.join();
+	}
+	delete this->workers;
+
+	glDeleteTextures(3, this->textures);
+	glDeleteBuffers(3, this->buffers);
+}
+
+
+GLint
+ClusteredLighting::slice(GLfloat depth) const
+{
+	GLfloat z = log(depth / this->zNear) / log(this->zFar / this->zNear) * CLUSTER_GRID_Z;
+	return min(max((GLint)floor(z), 0), (GLint)CLUSTER_GRID_Z - 1);
+}
+
+
+void
+ClusteredLighting::buildGrid(const glm::mat4& projection)
+{
+	glm::mat4 inverseProjection = glm::inverse(projection);
+
+	for (GLuint y = 0; y < CLUSTER_GRID_Y; y++) {
+		for (GLuint x = 0; x < CLUSTER_GRID_X; x++) {
+			// The tile's corners on the near plane, the cluster corners are along the same rays
+			glm::vec3 corners[4];
+			for (int c = 0; c < 4; c++) {
+				glm::vec4 ndc((GLfloat)(x + (c & 1)) / CLUSTER_GRID_X * 2.0f - 1.0f,
+							  (GLfloat)(y + (c >> 1)) / CLUSTER_GRID_Y * 2.0f - 1.0f,
+							  -1.0f, 1.0f);
+				glm::vec4 p = inverseProjection * ndc;
+				corners[c] = glm::vec3(p) / p.w;
+			}
+
+			for (GLuint z = 0; z < CLUSTER_GRID_Z; z++) {
+				GLfloat nearDepth = this->zNear * pow(this->zFar / this->zNear, (GLfloat)z / CLUSTER_GRID_Z);
+				GLfloat farDepth = this->zNear * pow(this->zFar / this->zNear, (GLfloat)(z + 1) / CLUSTER_GRID_Z);
+
+				glm::vec3 lo(INFINITY), hi(-INFINITY);
+				for (int c = 0; c < 4; c++) {
+					glm::vec3 atNear = corners[c] * (nearDepth / -corners[c].z);
+					glm::vec3 atFar = corners[c] * (farDepth / -corners[c].z);
+					lo = glm::min(lo, glm::min(atNear, atFar));
+					hi = glm::max(hi, glm::max(atNear, atFar));
+				}
+
+				GLuint cluster = x + CLUSTER_GRID_X * (y + CLUSTER_GRID_Y * z);
+				this->clusterMin[cluster] = lo;
+				this->clusterMax[cluster] = hi;
+			}
+		}
+	}
+
+	this->gridProjection = projection;
+}
+
+
+void
+ClusteredLighting::update(const Scene& scene, const glm::mat4& view, const glm::mat4& projection,
+						  GLfloat zNear, GLfloat zFar, GLuint width, GLuint height)
+{
+	if (projection != this->gridProjection || zNear != this->zNear || zFar != this->zFar) {
+		this->zNear = zNear;
+		this->zFar = zFar;
+		this->buildGrid(projection);
+	}
+	this->width = width;
+	this->height = height;
+
+	// The lights in the frustum, and the box of clusters each one may touch
+	this->lights.clear();
+	this->lightTexels.clear();
+	size_t count = scene.size();
+	for (size_t i = 0; i < count; i++) {
+		if (!(scene.flags[i] & ENTITY_LIGHT)) {
+			continue;
+		}
+
+		const LightParams& params = scene.lights[i];
+		LightBounds light;
+		light.center = glm::vec3(view * glm::vec4(scene.positions[i], 1.0f));
+		light.radius = params.radius;
+
+		GLfloat nearest = -light.center.z - light.radius;
+		GLfloat farthest = -light.center.z + light.radius;
+		if (farthest < zNear || nearest > zFar) {
+			continue;
+		}
+		light.z0 = this->slice(max(nearest, zNear));
+		light.z1 = this->slice(min(farthest, zFar));
+
+		glm::vec2 lo, hi;
+		if (sphereNDCBounds(light.center, light.radius, projection, zNear, lo, hi)) {
+			if (lo.x >= hi.x || lo.y >= hi.y) {
+				continue;
+			}
+			light.x0 = tile(lo.x, CLUSTER_GRID_X);
+			light.x1 = tile(hi.x, CLUSTER_GRID_X);
+			light.y0 = tile(lo.y, CLUSTER_GRID_Y);
+			light.y1 = tile(hi.y, CLUSTER_GRID_Y);
+		}
+		else {
+			// Reaches the camera, every tile may see it
+			light.x0 = 0; light.x1 = CLUSTER_GRID_X - 1;
+			light.y0 = 0; light.y1 = CLUSTER_GRID_Y - 1;
+		}
+
+		this->lights.push_back(light);
+		this->lightTexels.push_back(glm::vec4(light.center, light.radius));
+		this->lightTexels.push_back(glm::vec4(params.ambient, 0.0f));
+		this->lightTexels.push_back(glm::vec4(params.diffuse, 0.0f));
+		this->lightTexels.push_back(glm::vec4(params.specular, 0.0f));
+	}
+
+	// Every worker takes a range of depth slices (so they never write the same cluster), this thread too
+	{
+		lock_guard<mutex> lock(this->workers->lock);
+		this->workers->generation++;
+		this->workers->pending = this->workers->threads.size();
+	}
+	this->workers->start.notify_all();
+	this->assign(0, CLUSTER_GRID_Z / this->workers->shares);
+	{
+		TraceScope trace("cluster wait");
+		unique_lock<mutex> lock(this->workers->lock);
+		this->workers->done.wait(lock, [this]() { return this->workers->pending == 0; });
+	}
+
+	// Pack the lists
+	this->indices.clear();
+	for (GLuint c = 0; c < CLUSTER_COUNT; c++) {
+		const vector<uint32_t>& list = this->clusterLights[c];
+		this->ranges[c * 2] = this->indices.size();
+		this->ranges[c * 2 + 1] = list.size();
+		this->indices.insert(this->indices.end(), list.begin(), list.end());
+	}
+
+	uploadTextureBuffer(this->buffers[0], this->textures[0], GL_RGBA32F, this->lightTexels.data(),
+						this->lightTexels.size() * sizeof(glm::vec4), this->capacities[0]);
+	uploadTextureBuffer(this->buffers[1], this->textures[1], GL_RG32UI, this->ranges.data(),
+						this->ranges.size() * sizeof(uint32_t), this->capacities[1]);
+	uploadTextureBuffer(this->buffers[2], this->textures[2], GL_R32UI, this->indices.data(),
+						this->indices.size() * sizeof(uint32_t), this->capacities[2]);
+}
+
+
+void
+ClusteredLighting::assign(GLint z0, GLint z1)
+{
+	TraceScope trace("cluster assign");
+	for (GLint c = z0 * CLUSTER_GRID_X * CLUSTER_GRID_Y; c < z1 * (GLint)(CLUSTER_GRID_X * CLUSTER_GRID_Y); c++) {
+		this->clusterLights[c].clear();
+	}
+
+	for (uint32_t l = 0; l < this->lights.size(); l++) {
+		const LightBounds& light = this->lights[l];
+		GLfloat radius2 = light.radius * light.radius;
+
+		GLint zEnd = min(light.z1 + 1, z1);
+		for (GLint z = max(light.z0, z0); z < zEnd; z++) {
+			for (GLint y = light.y0; y <= light.y1; y++) {
+				for (GLint x = light.x0; x <= light.x1; x++) {
+					GLuint cluster = x + CLUSTER_GRID_X * (y + CLUSTER_GRID_Y * z);
+
+					// Sphere against the cluster's box
+					glm::vec3 d = glm::clamp(light.center, this->clusterMin[cluster], this->clusterMax[cluster]) - light.center;
+					if (glm::dot(d, d) <= radius2) {
+						this->clusterLights[cluster].push_back(l);
+					}
+				}
+			}
+		}
+	}
+}
+
+
+void
+ClusteredLighting::workerLoop(size_t share)
+{
+	Trace::setThreadName("cluster worker " + to_string(share));
+
+	Workers& w = *this->workers;
+	uint64_t seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(w.lock);
+			w.start.wait(lock, [&]() { return w.quit || w.generation != seen; });
+			if (w.quit) {
+				return;
+			}
+			seen = w.generation;
+		}
+
+		this->assign(CLUSTER_GRID_Z * share / w.shares, CLUSTER_GRID_Z * (share + 1) / w.shares);
+
+		{
+			lock_guard<mutex> lock(w.lock);
+			if (--w.pending == 0) {
+				w.done.notify_one();
+			}
+		}
+	}
+}
+
+
+void
+ClusteredLighting::bind(Program& program) const
+{
+	GLuint units[3] = { CLUSTER_LIGHTS_TEXTURE_UNIT, CLUSTER_RANGES_TEXTURE_UNIT, CLUSTER_INDICES_TEXTURE_UNIT };
+	for (int i = 0; i < 3; i++) {
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, this->textures[i]);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	program.set(Uniforms::clusterLights, (GLint)CLUSTER_LIGHTS_TEXTURE_UNIT);
+	program.set(Uniforms::clusterRanges, (GLint)CLUSTER_RANGES_TEXTURE_UNIT);
+	program.set(Uniforms::clusterIndices, (GLint)CLUSTER_INDICES_TEXTURE_UNIT);
+
+	// slice = log(depth) * scale + bias, see slice()
+	GLfloat logRatio = log(this->zFar / this->zNear);
+	program.set(Uniforms::clusterScale, CLUSTER_GRID_Z / logRatio);
+	program.set(Uniforms::clusterBias, -(GLfloat)CLUSTER_GRID_Z * log(this->zNear) / logRatio);
+	program.set(Uniforms::clusterTileSize, glm::vec2((GLfloat)this->width / CLUSTER_GRID_X,
+													 (GLfloat)this->height / CLUSTER_GRID_Y));
+}
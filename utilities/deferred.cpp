@@ -0,0 +1,193 @@
+#include <cmath>
+#include <algorithm>
+
+#include <deferred.h>
+#include <frustum.h>
+#include <shader_interfaces.h>
+
+
+
+static GLuint
+createTarget(GLint internalFormat, GLenum format, GLenum type, GLuint width, GLuint height)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+	// Read with texelFetch only
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return textureID;
+}
+
+
+
+DeferredRenderer::DeferredRenderer(GLuint width, GLuint height)
+:width(width), height(height), shaded(0)
+{
+	this->albedoSpec = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+	this->normal = createTarget(GL_RGBA16, GL_RGBA, GL_UNSIGNED_SHORT, width, height);
+	this->depth = createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+
+	glGenFramebuffers(1, &this->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->albedoSpec, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->normal, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, this->depth, 0);
+
+	GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "G-buffer framebuffer is not complete." << endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// The light pass has no vertex attributes, but core profile draws need a VAO bound
+	glGenVertexArrays(1, &this->emptyVAO);
+
+	this->lightProgram = new Program("shaders/deferredLight.vs", "shaders/deferredLight.frag");
+}
+
+
+DeferredRenderer::~DeferredRenderer()
+{
+	delete this->lightProgram;
+	glDeleteVertexArrays(1, &this->emptyVAO);
+	glDeleteFramebuffers(1, &this->fbo);
+	glDeleteTextures(1, &this->albedoSpec);
+	glDeleteTextures(1, &this->normal);
+	glDeleteTextures(1, &this->depth);
+}
+
+
+void
+DeferredRenderer::beginGeometry()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	// Albedo 0 leaves the background black, the light pass skips it (depth 1)
+	GLfloat clearColor[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
+
+
+bool
+DeferredRenderer::scissorRect(const glm::vec3& viewCenter, GLfloat radius, const glm::mat4& projection,
+							  GLint rect[4]) const
+{
+	glm::vec2 lo, hi;
+	// Camera inside (or close to) the sphere: use the whole screen
+	if (!sphereNDCBounds(viewCenter, radius, projection, 0.1f, lo, hi)) {
+		rect[0] = 0; rect[1] = 0; rect[2] = this->width; rect[3] = this->height;
+		return true;
+	}
+	if (lo.x >= hi.x || lo.y >= hi.y) {
+		return false;
+	}
+
+	GLint x0 = (GLint)floor((lo.x * 0.5f + 0.5f) * this->width);
+	GLint y0 = (GLint)floor((lo.y * 0.5f + 0.5f) * this->height);
+	GLint x1 = (GLint)ceil((hi.x * 0.5f + 0.5f) * this->width);
+	GLint y1 = (GLint)ceil((hi.y * 0.5f + 0.5f) * this->height);
+	rect[0] = x0; rect[1] = y0; rect[2] = x1 - x0; rect[3] = y1 - y0;
+	return true;
+}
+
+
+void
+DeferredRenderer::shadeLights(const Scene& scene, const glm::mat4& view, const glm::mat4& projection)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Every light adds to what is already there
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	this->lightProgram->use();
+	this->lightProgram->set(Uniforms::inverseProjection, glm::inverse(projection));
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, this->albedoSpec);
+	this->lightProgram->set(Uniforms::gAlbedoSpec, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, this->normal);
+	this->lightProgram->set(Uniforms::gNormal, 1);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, this->depth);
+	this->lightProgram->set(Uniforms::gDepth, 2);
+
+	glBindVertexArray(this->emptyVAO);
+	RenderStats::frame.vaoBinds++;
+
+	// The default framebuffer still holds the clear color under the geometry: a black light over the whole
+	// screen, not blended, zeroes those pixels (the background is discarded so it keeps the clear color)
+	glDisable(GL_BLEND);
+	this->lightProgram->set(Uniforms::light_position, glm::vec3(0.0f));
+	this->lightProgram->set(Uniforms::light_radius, 1e18f);
+	this->lightProgram->set(Uniforms::light_ambient, glm::vec3(0.0f));
+	this->lightProgram->set(Uniforms::light_diffuse, glm::vec3(0.0f));
+	this->lightProgram->set(Uniforms::light_specular, glm::vec3(0.0f));
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	RenderStats::frame.draw(GL_TRIANGLES, 3);
+	glEnable(GL_BLEND);
+	glEnable(GL_SCISSOR_TEST);
+
+	glm::vec4 planes[6];
+	extractFrustumPlanes(projection * view, planes);
+
+	this->shaded = 0;
+	size_t count = scene.size();
+	for (size_t i = 0; i < count; i++) {
+		if (!(scene.flags[i] & ENTITY_LIGHT)) {
+			continue;
+		}
+		const LightParams& light = scene.lights[i];
+		const glm::vec3& position = scene.positions[i];
+		if (!sphereInFrustum(planes, position, light.radius)) {
+			continue;
+		}
+
+		GLint rect[4];
+		if (!this->scissorRect(glm::vec3(view * glm::vec4(position, 1.0f)), light.radius, projection, rect)) {
+			continue;
+		}
+		glScissor(rect[0], rect[1], rect[2], rect[3]);
+
+		this->lightProgram->set(Uniforms::light_position, position);
+		this->lightProgram->set(Uniforms::light_radius, light.radius);
+		this->lightProgram->set(Uniforms::light_ambient, light.ambient);
+		this->lightProgram->set(Uniforms::light_diffuse, light.diffuse);
+		this->lightProgram->set(Uniforms::light_specular, light.specular);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		RenderStats::frame.draw(GL_TRIANGLES, 3);
+		this->shaded++;
+	}
+
+	glBindVertexArray(0);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glDisable(GL_SCISSOR_TEST);
+	glDisable(GL_BLEND);
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+
+	// The forward draws after this (lamps, impostors) are depth tested against the G-buffer geometry
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height,
+					  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
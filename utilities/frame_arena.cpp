@@ -0,0 +1,70 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include <frame_arena.h>
+
+
+
+FrameArena::FrameArena(size_t capacity)
+:block((uint8_t*)malloc(capacity)),
+ size(capacity),
+ offset(0),
+ overflowBytes(0),
+ peak(0)
+{
+}
+
+
+FrameArena::~FrameArena()
+{
+	for (void* p : this->overflow) {
+		free(p);
+	}
+	free(this->block);
+}
+
+
+void*
+FrameArena::allocate(size_t bytes, size_t alignment)
+{
+	size_t start = (this->offset + alignment - 1) & ~(alignment - 1);
+	if (start + bytes <= this->size) {
+		this->offset = start + bytes;
+		this->peak = max(this->peak, this->used());
+		return this->block + start;
+	}
+
+	// malloc is aligned for every fundamental type
+	void* p = malloc(max(bytes, (size_t)1));
+	this->overflow.push_back(p);
+	this->overflowBytes += bytes;
+	this->peak = max(this->peak, this->used());
+	return p;
+}
+
+
+void
+FrameArena::reset()
+{
+	for (void* p : this->overflow) {
+		free(p);
+	}
+	this->overflow.clear();
+	this->overflowBytes = 0;
+	this->offset = 0;
+
+	// The last frames needed more than the block, make it fit them
+	if (this->peak > this->size) {
+		this->size = this->peak + this->peak / 2;
+		free(this->block);
+		this->block = (uint8_t*)malloc(this->size);
+	}
+}
+
+
+FrameArena&
+FrameArena::renderThread()
+{
+	static FrameArena arena;
+	return arena;
+}
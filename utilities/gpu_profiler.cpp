@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+#include <gpu_profiler.h>
+
+
+
+GpuProfiler::GpuProfiler(GLuint latency, size_t historySize, double logInterval)
+:logInterval(logInterval),
+ frames(max(latency, 1u)),
+ frameIndex(0),
+ historySize(historySize),
+ dropped(0),
+ lastLog(chrono::steady_clock::now())
+{
+	for (Frame& frame : this->frames) {
+		frame.used = 0;
+		frame.pending = false;
+	}
+}
+
+
+GpuProfiler::~GpuProfiler()
+{
+	for (Frame& frame : this->frames) {
+		if (!frame.queries.empty()) {
+			glDeleteQueries(frame.queries.size(), frame.queries.data());
+		}
+	}
+}
+
+
+GLuint
+GpuProfiler::timestamp(Frame& frame)
+{
+	if (frame.used == frame.queries.size()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	GLuint index = frame.used++;
+	glQueryCounter(frame.queries[index], GL_TIMESTAMP);
+	return index;
+}
+
+
+void
+GpuProfiler::beginFrame()
+{
+	this->frameIndex++;
+	Frame& frame = this->frames[this->frameIndex % this->frames.size()];
+	if (frame.pending) {
+		this->collect(frame);
+	}
+
+	frame.used = 0;
+	frame.records.clear();
+	this->open.clear();
+	this->begin("frame");
+}
+
+
+void
+GpuProfiler::endFrame()
+{
+	this->end();
+	this->frames[this->frameIndex % this->frames.size()].pending = true;
+
+	for (Scope& scope : this->scopes) {
+		if (scope.cpuTotal >= 0.0) {
+			this->addSample(scope.cpuHistory, scope.cpuNext, scope.cpuTotal);
+			scope.cpuTotal = -1.0;
+		}
+	}
+
+	if (this->logInterval > 0.0) {
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (chrono::duration<double>(now - this->lastLog).count() >= this->logInterval) {
+			this->lastLog = now;
+			// Straight to cout, a string would be allocated
+			cout << "GPU ms (min/avg/p99): ";
+			this->summary(cout);
+			cout << endl;
+		}
+	}
+}
+
+
+void
+GpuProfiler::begin(const char* name)
+{
+	uint32_t scope = 0;
+	while (scope < this->scopes.size() && strcmp(this->scopes[scope].name, name) != 0) {
+		scope++;
+	}
+	if (scope == this->scopes.size()) {
+		Scope s;
+		s.name = name;
+		s.next = 0;
+		s.frameTotal = 0.0;
+		s.cpuNext = 0;
+		s.cpuTotal = -1.0;
+		this->scopes.push_back(s);
+	}
+
+	Frame& frame = this->frames[this->frameIndex % this->frames.size()];
+	Record record;
+	record.scope = scope;
+	record.beginQuery = this->timestamp(frame);
+	record.endQuery = record.beginQuery;
+	record.cpuBegin = chrono::steady_clock::now();
+	this->open.push_back(frame.records.size());
+	frame.records.push_back(record);
+}
+
+
+void
+GpuProfiler::end()
+{
+	if (this->open.empty()) {
+		cout << "GpuProfiler::end - no open scope." << endl;
+		return;
+	}
+
+	Frame& frame = this->frames[this->frameIndex % this->frames.size()];
+	Record& record = frame.records[this->open.back()];
+	record.endQuery = this->timestamp(frame);
+	this->open.pop_back();
+
+	Scope& scope = this->scopes[record.scope];
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - record.cpuBegin).count();
+	scope.cpuTotal = max(scope.cpuTotal, 0.0) + ms;
+}
+
+
+void
+GpuProfiler::collect(Frame& frame)
+{
+	frame.pending = false;
+
+	// The last query of the frame done means all of them are
+	GLint available = 0;
+	glGetQueryObjectiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) {
+		this->dropped++;
+		return;
+	}
+
+	FrameVector<GLuint64> times(frame.used);
+	for (uint32_t q = 0; q < frame.used; q++) {
+		glGetQueryObjectui64v(frame.queries[q], GL_QUERY_RESULT, &times[q]);
+	}
+
+	for (Scope& scope : this->scopes) {
+		scope.frameTotal = -1.0;
+	}
+	for (const Record& record : frame.records) {
+		Scope& scope = this->scopes[record.scope];
+		double ms = (times[record.endQuery] - times[record.beginQuery]) / 1e6;
+		scope.frameTotal = max(scope.frameTotal, 0.0) + ms;
+	}
+
+	// Only the scopes entered in that frame get a sample
+	for (Scope& scope : this->scopes) {
+		if (scope.frameTotal >= 0.0) {
+			this->addSample(scope.history, scope.next, scope.frameTotal);
+		}
+	}
+}
+
+
+void
+GpuProfiler::addSample(vector<double>& history, size_t& next, double value) const
+{
+	if (history.size() < this->historySize) {
+		history.push_back(value);
+	}
+	else {
+		history[next] = value;
+	}
+	next = (next + 1) % this->historySize;
+}
+
+
+FrameVector<GpuScopeStats>
+GpuProfiler::stats() const
+{
+	FrameVector<GpuScopeStats> result;
+	result.reserve(this->scopes.size());
+	FrameVector<double> sorted;
+	for (const Scope& scope : this->scopes) {
+		GpuScopeStats s;
+		s.name = scope.name;
+		s.samples = scope.history.size();
+		s.min = s.avg = s.p99 = 0.0;
+		if (s.samples > 0) {
+			sorted.assign(scope.history.begin(), scope.history.end());
+			size_t p99 = min(sorted.size() - 1, (size_t)(sorted.size() * 0.99));
+			nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+			s.p99 = sorted[p99];
+			s.min = *min_element(sorted.begin(), sorted.end());
+			double sum = 0.0;
+			for (double t : sorted) {
+				sum += t;
+			}
+			s.avg = sum / s.samples;
+		}
+		s.cpu = 0.0;
+		for (double t : scope.cpuHistory) {
+			s.cpu += t;
+		}
+		if (!scope.cpuHistory.empty()) {
+			s.cpu /= scope.cpuHistory.size();
+		}
+		result.push_back(s);
+	}
+	return result;
+}
+
+
+string
+GpuProfiler::summary() const
+{
+	stringstream ss;
+	this->summary(ss);
+	return ss.str();
+}
+
+
+void
+GpuProfiler::summary(ostream& out) const
+{
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << fixed << setprecision(2);
+	for (const GpuScopeStats& s : this->stats()) {
+		out << s.name << " " << s.min << "/" << s.avg << "/" << s.p99 << "  ";
+	}
+	if (this->dropped > 0) {
+		out << "(" << this->dropped << " frames dropped)";
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include <hitch_detector.h>
+#include <trace.h>
+
+
+double HitchDetector::frameMs[HITCH_SUBSYSTEM_COUNT];
+uint32_t HitchDetector::frameCalls[HITCH_SUBSYSTEM_COUNT];
+
+// Hitches are kept up to this many, the report would be useless past it anyway
+static const size_t MAX_HITCHES = 1000;
+
+
+
+const char*
+hitchSubsystemName(HitchSubsystem subsystem)
+{
+	static const char* names[HITCH_SUBSYSTEM_COUNT] = {
+		"model load", "texture upload", "shader compile", "chunk upload", "GPU release"
+	};
+	return names[subsystem];
+}
+
+
+
+HitchDetector::HitchDetector(double threshold, size_t historySize)
+:threshold(threshold), historySize(max(historySize, (size_t)1)), next(0), frames(0),
+ frameStart(Trace::now())
+{
+	// Recording a hitch must not allocate, the frames with one would show in --alloc-check
+	this->history.reserve(this->historySize);
+	this->sorted.reserve(this->historySize);
+	this->hitches.reserve(MAX_HITCHES);
+}
+
+
+void
+HitchDetector::endFrame()
+{
+	int64_t now = Trace::now();
+	double frameMs = (now - this->frameStart) / 1e6;
+	this->frameStart = now;
+	this->frames++;
+
+	// Until the history is full the median means little (and the first frames pay for the loading)
+	size_t historySize = this->historySize;
+	if (this->history.size() == historySize) {
+		this->sorted = this->history;
+		nth_element(this->sorted.begin(), this->sorted.begin() + historySize / 2, this->sorted.end());
+		double median = this->sorted[historySize / 2];
+
+		if (frameMs > median * this->threshold && this->hitches.size() < MAX_HITCHES) {
+			Hitch hitch;
+			hitch.frame = this->frames;
+			hitch.ms = frameMs;
+			hitch.median = median;
+			for (int s = 0; s < HITCH_SUBSYSTEM_COUNT; s++) {
+				hitch.subsystemMs[s] = HitchDetector::frameMs[s];
+				hitch.subsystemCalls[s] = HitchDetector::frameCalls[s];
+			}
+			this->hitches.push_back(hitch);
+		}
+		this->history[this->next] = frameMs;
+	}
+	else {
+		this->history.push_back(frameMs);
+	}
+	this->next = (this->next + 1) % historySize;
+
+	for (int s = 0; s < HITCH_SUBSYSTEM_COUNT; s++) {
+		HitchDetector::frameMs[s] = 0.0;
+		HitchDetector::frameCalls[s] = 0;
+	}
+}
+
+
+string
+HitchDetector::report() const
+{
+	stringstream ss;
+	ss << fixed << setprecision(2);
+	ss << this->hitches.size() << " hitches in " << this->frames << " frames (over " << this->threshold
+	   << "x the median of the last " << this->historySize << " frames)" << endl;
+
+	for (const Hitch& hitch : this->hitches) {
+		ss << "frame " << hitch.frame << ": " << hitch.ms << " ms (median " << hitch.median << ")";
+		bool any = false;
+		for (int s = 0; s < HITCH_SUBSYSTEM_COUNT; s++) {
+			if (hitch.subsystemCalls[s] == 0) {
+				continue;
+			}
+			ss << (any ? ", " : " - ") << hitchSubsystemName((HitchSubsystem)s) << " "
+			   << hitch.subsystemMs[s] << " ms x" << hitch.subsystemCalls[s];
+			any = true;
+		}
+		if (!any) {
+			ss << " - no tracked subsystem";
+		}
+		ss << endl;
+	}
+	return ss.str();
+}
+
+
+bool
+HitchDetector::writeReport(const string& path) const
+{
+	ofstream out(path.c_str());
+	if (!out) {
+		cout << "Could not write the hitch report to " << path << endl;
+		return false;
+	}
+	out << this->report();
+	return true;
+}
+
+
+void
+HitchDetector::record(HitchSubsystem subsystem, double ms)
+{
+	HitchDetector::frameMs[subsystem] += ms;
+	HitchDetector::frameCalls[subsystem]++;
+}
+
+
+
+HitchScope::HitchScope(HitchSubsystem subsystem)
+:subsystem(subsystem), start(Trace::now())
+{
+}
+
+
+HitchScope::~HitchScope()
+{
+	HitchDetector::record(this->subsystem, (Trace::now() - this->start) / 1e6);
+}
@@ -0,0 +1,282 @@
+#include <cstddef>
+#include <algorithm>
+
+#include <hud.h>
+#include <shader_interfaces.h>
+
+
+// Printable ASCII (32 to 126), one byte per row from the top, bit 0 being the leftmost pixel (font8x8, public domain)
+static const GLubyte FONT[95][HUD_GLYPH_SIZE] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // space
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },   // !
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // "
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },   // #
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },   // $
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },   // %
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },   // &
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },   // '
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },   // (
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },   // )
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },   // *
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },   // +
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ,
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },   // -
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // .
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },   // /
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },   // 0
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },   // 1
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },   // 2
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },   // 3
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },   // 4
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },   // 5
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },   // 6
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },   // 7
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },   // 8
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },   // 9
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },   // :
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },   // ;
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },   // <
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },   // =
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },   // >
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },   // ?
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },   // @
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },   // A
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },   // B
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },   // C
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },   // D
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },   // E
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },   // F
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },   // G
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },   // H
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // I
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },   // J
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },   // K
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },   // L
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },   // M
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },   // N
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },   // O
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },   // P
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },   // Q
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },   // R
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },   // S
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // T
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },   // U
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // V
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },   // W
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },   // X
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },   // Y
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },   // Z
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },   // [
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },   // backslash
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },   // ]
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },   // ^
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },   // _
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },   // `
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },   // a
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },   // b
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },   // c
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },   // d
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },   // e
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },   // f
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // g
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },   // h
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // i
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },   // j
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },   // k
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },   // l
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },   // m
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },   // n
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },   // o
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },   // p
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },   // q
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },   // r
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },   // s
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },   // t
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },   // u
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },   // v
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },   // w
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },   // x
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },   // y
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },   // z
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },   // {
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },   // |
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },   // }
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },   // ~
+};
+
+static const char FIRST_GLYPH = ' ';
+static const char LAST_GLYPH = '~';
+
+
+
+Hud::Hud()
+:visible(false), scale(2.0f), instanceCapacity(0)
+{
+	this->program = new Program("shaders/hud.vs", "shaders/hud.frag");
+
+	// One row of glyphs
+	GLuint count = LAST_GLYPH - FIRST_GLYPH + 1;
+	vector<GLubyte> texels(count * HUD_GLYPH_SIZE * HUD_GLYPH_SIZE);
+	for (GLuint g = 0; g < count; g++) {
+		for (GLuint y = 0; y < HUD_GLYPH_SIZE; y++) {
+			for (GLuint x = 0; x < HUD_GLYPH_SIZE; x++) {
+				texels[y * count * HUD_GLYPH_SIZE + g * HUD_GLYPH_SIZE + x] = ((FONT[g][y] >> x) & 1) ? 255 : 0;
+			}
+		}
+	}
+
+	glGenTextures(1, &this->font);
+	glBindTexture(GL_TEXTURE_2D, this->font);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, count * HUD_GLYPH_SIZE, HUD_GLYPH_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// No vertex buffer, the corners come from gl_VertexID
+	glGenVertexArrays(1, &this->VAO);
+	glGenBuffers(1, &this->instanceVBO);
+	glBindVertexArray(this->VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Quad), (GLvoid*)offsetof(Quad, rect));
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Quad), (GLvoid*)offsetof(Quad, color));
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Quad), (GLvoid*)offsetof(Quad, glyph));
+	glVertexAttribDivisor(2, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+
+Hud::~Hud()
+{
+	delete this->program;
+	glDeleteTextures(1, &this->font);
+	glDeleteBuffers(1, &this->instanceVBO);
+	glDeleteVertexArrays(1, &this->VAO);
+}
+
+
+void
+Hud::text(GLfloat x, GLfloat y, const char* s, const glm::vec4& color)
+{
+	if (!this->visible) {
+		return;
+	}
+
+	GLfloat size = HUD_GLYPH_SIZE * this->scale;
+	GLfloat left = x;
+	for (; *s; s++) {
+		char c = *s;
+		if (c == '\n') {
+			x = left;
+			y += this->lineHeight();
+			continue;
+		}
+		if (c != ' ') {
+			Quad quad;
+			quad.rect = glm::vec4(x, y, size, size);
+			quad.color = color;
+			quad.glyph = (c >= FIRST_GLYPH && c <= LAST_GLYPH) ? c - FIRST_GLYPH : '?' - FIRST_GLYPH;
+			this->quads.push_back(quad);
+		}
+		x += size;
+	}
+}
+
+
+void
+Hud::rect(GLfloat x, GLfloat y, GLfloat width, GLfloat height, const glm::vec4& color)
+{
+	if (!this->visible) {
+		return;
+	}
+
+	Quad quad;
+	quad.rect = glm::vec4(x, y, width, height);
+	quad.color = color;
+	quad.glyph = -1.0f;
+	this->quads.push_back(quad);
+}
+
+
+void
+Hud::graph(GLfloat x, GLfloat y, GLfloat width, GLfloat height,
+		   const vector<GLfloat>& values, size_t next, GLfloat top, GLfloat budget)
+{
+	if (!this->visible || values.empty()) {
+		return;
+	}
+
+	this->rect(x, y, width, height, glm::vec4(0.0f, 0.0f, 0.0f, 0.5f));
+
+	GLfloat barWidth = width / values.size();
+	for (size_t i = 0; i < values.size(); i++) {
+		GLfloat value = values[(next + i) % values.size()];
+		GLfloat barHeight = min(value / top, 1.0f) * height;
+		glm::vec4 color = (value > budget) ? glm::vec4(1.0f, 0.3f, 0.2f, 1.0f) : glm::vec4(0.3f, 0.9f, 0.3f, 1.0f);
+		this->rect(x + i * barWidth, y + height - barHeight, barWidth, barHeight, color);
+	}
+
+	// The budget line
+	if (budget < top) {
+		this->rect(x, y + height - budget / top * height, width, 1.0f, glm::vec4(1.0f, 1.0f, 1.0f, 0.6f));
+	}
+}
+
+
+void
+Hud::draw(GLuint width, GLuint height)
+{
+	if (!this->visible || this->quads.empty()) {
+		this->quads.clear();
+		return;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+	if (this->quads.size() > this->instanceCapacity) {
+		this->instanceCapacity = this->quads.size();
+		glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(Quad), this->quads.data(), GL_STREAM_DRAW);
+	}
+	else {
+		glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(Quad), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, this->quads.size() * sizeof(Quad), this->quads.data());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	RenderStats::frame.bytesUploaded += this->quads.size() * sizeof(Quad);
+
+	// Over everything, blended
+	GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+	GLboolean blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	this->program->use();
+	this->program->set(Uniforms::hudScreenSize, glm::vec2(width, height));
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, this->font);
+	this->program->set(Uniforms::hudFont, 0);
+
+	glBindVertexArray(this->VAO);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, this->quads.size());
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	RenderStats::frame.vaoBinds++;
+	RenderStats::frame.textureBinds++;
+	RenderStats::frame.draw(GL_TRIANGLE_STRIP, 4, this->quads.size());
+
+	if (depthTest) {
+		glEnable(GL_DEPTH_TEST);
+	}
+	if (!blend) {
+		glDisable(GL_BLEND);
+	}
+
+	this->quads.clear();
+}
@@ -0,0 +1,270 @@
+#include <cmath>
+
+#include <impostor.h>
+#include <transform_system.h>
+#include <shader_interfaces.h>
+
+
+// Mip levels of the atlases past the base one, at most. Fewer when frameSize is too small or not a multiple.
+static const GLuint IMPOSTOR_MAX_MIP_LEVEL = 3;
+
+
+// Maps a point of the [-1, 1]^2 square to a unit direction (octahedral mapping, y is up).
+// Must match octDecode() in shaders/impostorShader.vs
+static glm::vec3
+octDecode(glm::vec2 p)
+{
+	glm::vec3 n(p.x, 1.0f - fabs(p.x) - fabs(p.y), p.y);
+	if (n.y < 0.0f) {
+		GLfloat x = n.x, z = n.z;
+		n.x = (1.0f - fabs(z)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.z = (1.0f - fabs(x)) * (z >= 0.0f ? 1.0f : -1.0f);
+	}
+	return glm::normalize(n);
+}
+
+
+// Up vector used to build the capture camera for a given direction.
+// Must match the one used in shaders/impostorShader.vs
+static glm::vec3
+captureUp(const glm::vec3& dir)
+{
+	return (fabs(dir.y) > 0.99f) ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+
+static GLuint
+createAtlasTexture(GLuint size, GLint internalFormat, GLenum format, GLenum type, GLuint maxMipLevel)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, format, type, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxMipLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return textureID;
+}
+
+
+
+Impostor::Impostor(const Model& model, ShaderPermutations& shaders, GLfloat distance, GLuint framesPerSide, GLuint frameSize)
+:colorAtlas(0), normalAtlas(0), depthAtlas(0),
+ framesPerSide(framesPerSide), frameSize(frameSize), maxMipLevel(0),
+ distance(distance),
+ quadVAO(0), quadVBO(0), instanceVBO(0), instanceCapacity(0)
+{
+	// A texel of mip level L spans 2^L base texels, so frames aligned on 2^L and a border of 2^L empty
+	// texels keep every filtered sample of a frame inside it, at every level up to L
+	while (this->maxMipLevel < IMPOSTOR_MAX_MIP_LEVEL && frameSize % (2u << this->maxMipLevel) == 0 &&
+		   (4u << this->maxMipLevel) < frameSize) {
+		this->maxMipLevel++;
+	}
+	this->framePadding = 1u << this->maxMipLevel;
+
+	this->center = (model.boundsMin + model.boundsMax) * 0.5f;
+	this->radius = glm::length(model.boundsMax - model.boundsMin) * 0.5f;
+
+	// The capture camera sits at 2 * radius from the center, so the whole bounding sphere is in [radius, 3 * radius]
+	this->captureNear = this->radius;
+	this->captureFar = this->radius * 3.0f;
+
+	this->capture(model, shaders);
+	this->setupQuad();
+}
+
+
+Impostor::~Impostor()
+{
+	glDeleteTextures(1, &this->colorAtlas);
+	glDeleteTextures(1, &this->normalAtlas);
+	glDeleteTextures(1, &this->depthAtlas);
+	glDeleteBuffers(1, &this->quadVBO);
+	glDeleteBuffers(1, &this->instanceVBO);
+	glDeleteVertexArrays(1, &this->quadVAO);
+}
+
+
+void
+Impostor::capture(const Model& model, ShaderPermutations& shaders)
+{
+	GLuint atlasSize = this->framesPerSide * this->frameSize;
+
+	// Save the state we are about to change
+	GLint viewport[4], previousFBO;
+	GLfloat clearColor[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFBO);
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+
+	// Depth is linear over [captureNear, captureFar], 8 bits would step by a hundredth of the model
+	this->colorAtlas = createAtlasTexture(atlasSize, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, this->maxMipLevel);
+	this->normalAtlas = createAtlasTexture(atlasSize, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, this->maxMipLevel);
+	this->depthAtlas = createAtlasTexture(atlasSize, GL_R32F, GL_RED, GL_FLOAT, this->maxMipLevel);
+
+	GLuint fbo, depthRBO;
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->colorAtlas, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->normalAtlas, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, this->depthAtlas, 0);
+
+	glGenRenderbuffers(1, &depthRBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+	// The capture variants write albedo to location 0, the normal to location 1 and the depth to location 2
+	GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+	glDrawBuffers(3, drawBuffers);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "Impostor capture framebuffer is not complete." << endl;
+	}
+
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glm::mat4 projection = glm::ortho(-this->radius, this->radius, -this->radius, this->radius,
+									  this->captureNear, this->captureFar);
+
+	// One draw per frame, frame (x, y) gets draw index y * framesPerSide + x
+	TransformSystem transforms;
+	for (GLuint y = 0; y < this->framesPerSide; y++) {
+		for (GLuint x = 0; x < this->framesPerSide; x++) {
+
+			glm::vec2 p = (glm::vec2(x + 0.5f, y + 0.5f) / (GLfloat)this->framesPerSide) * 2.0f - 1.0f;
+			glm::vec3 dir = octDecode(p);
+
+			glm::mat4 view = glm::lookAt(this->center + dir * (2.0f * this->radius), this->center, captureUp(dir));
+			transforms.push(glm::mat4(), view, projection);
+		}
+	}
+	transforms.upload();
+
+	// Unlit, so the impostor program lights the capture once, with the actual lamp
+	for (const Mesh& mesh : model.meshes) {
+		Program* program = shaders.get(mesh.shaderFeatures | SHADER_IMPOSTOR_CAPTURE);
+		program->use();
+		program->set(Uniforms::g_color, glm::vec3(1.0f));
+		program->set(Uniforms::g_diffuse, glm::vec3(1.0f));
+		transforms.bind(*program);
+	}
+
+	GLuint inner = this->frameSize - 2 * this->framePadding;
+	for (GLuint y = 0; y < this->framesPerSide; y++) {
+		for (GLuint x = 0; x < this->framesPerSide; x++) {
+			glViewport(x * this->frameSize + this->framePadding, y * this->frameSize + this->framePadding, inner, inner);
+			for (const Mesh& mesh : model.meshes) {
+				Program* program = shaders.get(mesh.shaderFeatures | SHADER_IMPOSTOR_CAPTURE);
+				program->use();
+				program->set(Uniforms::drawIndex, (GLint)(y * this->framesPerSide + x));
+				mesh.draw(*program);
+			}
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D, this->colorAtlas);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, this->normalAtlas);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, this->depthAtlas);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Restore state
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFBO);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+
+	glDeleteRenderbuffers(1, &depthRBO);
+	glDeleteFramebuffers(1, &fbo);
+}
+
+
+void
+Impostor::setupQuad()
+{
+	GLfloat corners[] = {
+		-1.0f, -1.0f,
+		 1.0f, -1.0f,
+		-1.0f,  1.0f,
+		 1.0f,  1.0f
+	};
+
+	glGenVertexArrays(1, &this->quadVAO);
+	glGenBuffers(1, &this->quadVBO);
+	glGenBuffers(1, &this->instanceVBO);
+
+	glBindVertexArray(this->quadVAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->quadVBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	// Quad corner
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (GLvoid*)0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+	// Instance position and scale
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (GLvoid*)0);
+	glVertexAttribDivisor(1, 1);
+
+	glBindVertexArray(0);
+}
+
+
+void
+Impostor::draw(Program& program, const vector<glm::vec4>& instances)
+{
+	if (instances.empty()) {
+		return;
+	}
+
+	// Upload the instances, growing the buffer only when needed
+	glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+	if ((GLsizei)instances.size() > this->instanceCapacity) {
+		this->instanceCapacity = instances.size();
+		glBufferData(GL_ARRAY_BUFFER, this->instanceCapacity * sizeof(glm::vec4), &instances[0], GL_STREAM_DRAW);
+	}
+	else {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(glm::vec4), &instances[0]);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	RenderStats::frame.bytesUploaded += instances.size() * sizeof(glm::vec4);
+
+	program.use();
+	program.set(Uniforms::center, this->center);
+	program.set(Uniforms::radius, this->radius);
+	program.set(Uniforms::framesPerSide, (GLfloat)this->framesPerSide);
+	program.set(Uniforms::frameInset, (GLfloat)(this->frameSize - 2 * this->framePadding) / this->frameSize);
+	program.set(Uniforms::captureNear, this->captureNear);
+	program.set(Uniforms::captureFar, this->captureFar);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, this->colorAtlas);
+	program.set(Uniforms::colorAtlas, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, this->normalAtlas);
+	program.set(Uniforms::normalAtlas, 1);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, this->depthAtlas);
+	program.set(Uniforms::depthAtlas, 2);
+
+	glBindVertexArray(this->quadVAO);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instances.size());
+	glBindVertexArray(0);
+	RenderStats::frame.vaoBinds++;
+	RenderStats::frame.textureBinds += 3;
+	RenderStats::frame.draw(GL_TRIANGLE_STRIP, 4, instances.size());
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
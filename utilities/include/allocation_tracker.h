@@ -0,0 +1,56 @@
+#pragma once
+// Std. Includes
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+
+// Tags an allocation can be counted under, the first one being everything out of an AllocationScope
+const size_t ALLOCATION_TAGS = 32;
+
+
+struct AllocationCounts {
+    uint64_t allocations;
+    uint64_t bytes;
+};
+
+
+// Heap allocations of the render thread, per frame and per tagged scope. Only counts when built with
+// TRACK_ALLOCATIONS (make alloc_check, or project1_alloc), which replaces the global operator new and delete;
+// otherwise every count stays zero. Each thread counts into its own thread_local counters, so the
+// loader and worker threads never show in the render thread's frames, and counting takes no lock.
+class AllocationTracker
+{
+public:
+    /*  Functions  */
+    // Whether the global operator new is instrumented
+    static bool enabled();
+
+    // Call once per frame, on the render thread: the counts since the previous call become the last frame's
+    static void endFrame();
+
+    static AllocationCounts lastFrame();
+    // Of the last frame, tag 0 being the untagged allocations
+    static AllocationCounts lastFrame(size_t tag);
+    static const char* tagName(size_t tag);
+    static size_t tagCount();
+
+    // Every thread, since the start of the process
+    static AllocationCounts total();
+
+    // See AllocationScope. Tags are told apart by address, so names must be string literals.
+    static void pushTag(const char* name);
+    static void popTag();
+
+    // Called by the instrumented operator new
+    static void record(size_t bytes);
+};
+
+
+// Counts the allocations of the enclosing block under 'name' (the innermost scope wins)
+class AllocationScope
+{
+public:
+    AllocationScope(const char* name) { AllocationTracker::pushTag(name); }
+    ~AllocationScope() { AllocationTracker::popTag(); }
+};
@@ -0,0 +1,58 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include <model.h>
+
+
+// A model is imported and uploaded once and then only read: meshes (GPU buffers), materials, textures and bounds.
+// Everything that differs between two copies of it on screen lives in the scene (see ModelInstance).
+typedef Model ModelAsset;
+typedef shared_ptr<const ModelAsset> ModelAssetRef;
+
+
+// Time taken by an import (Assimp, textures and upload), and where it went
+struct AssetLoad {
+    string path;
+    double seconds;
+    ModelLoadReport report;
+};
+
+
+// Loads model assets keyed by path. Asking twice for a path that is still in use returns the same asset,
+// so the Assimp import, the texture loads and the GPU upload happen once. The manager doesn't keep assets
+// alive: the last reference going away releases the GL objects (the GL context must still be current then).
+class AssetManager
+{
+public:
+    // What the meshes of the models loaded from now on keep in CPU memory
+    MeshCpuData meshCpuData;
+
+    /*  Functions  */
+    AssetManager();
+
+    ModelAssetRef loadModel(const string& path, bool gamma = false);
+
+    // Number of assets still referenced somewhere
+    size_t loadedCount();
+
+    // Every import done, in order
+    inline const vector<AssetLoad>& loads() const { return loadTimes; }
+
+    // CPU and GPU memory of every asset still in use, biggest first, with their meshes and textures
+    string memoryReport() const;
+
+    // The load reports of every import, false if the file can't be written
+    bool writeLoadReport(const string& path) const;
+
+private:
+    unordered_map<string, weak_ptr<const ModelAsset> > models;
+    vector<AssetLoad> loadTimes;
+
+    // Forgets the assets that were released
+    void collect();
+};
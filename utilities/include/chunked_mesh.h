@@ -0,0 +1,151 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+
+
+// On disk chunked mesh format (".chk")
+// -----------------------------------
+// [ChunkFileHeader][ChunkNode x nodeCount][payload][payload]...
+//
+// The nodes form an octree over the mesh triangles. Leaves hold the full resolution triangles of their
+// cell, inner nodes hold a simplified version (vertex clustering) of everything below them, with
+// 'error' being the world space size of the simplification. A payload is vertexCount ChunkVertex
+// followed by indexCount 16 bit indices, so a chunk is uploaded to the GPU as is.
+
+const char CHUNK_FILE_MAGIC[4] = { 'C', 'H', 'N', 'K' };
+const uint32_t CHUNK_FILE_VERSION = 1;
+const int32_t CHUNK_NO_CHILD = -1;
+
+struct ChunkFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t reserved;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct ChunkNode {
+    float boundsMin[3];
+    float boundsMax[3];
+    float error;                // World space error of this level of detail, 0 for leaves.
+    int32_t children[8];        // CHUNK_NO_CHILD when absent.
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint64_t offset;            // Of the payload, from the beginning of the file.
+};
+
+struct ChunkVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+};
+
+static_assert(sizeof(ChunkFileHeader) == 40, "ChunkFileHeader layout is part of the file format");
+static_assert(sizeof(ChunkNode) == 80, "ChunkNode layout is part of the file format");
+static_assert(sizeof(ChunkVertex) == 32, "ChunkVertex layout is part of the file format");
+
+
+// Offline conversion of a PLY (ascii or binary) or OBJ model to the chunked format. Out of core: the source
+// is read as a stream and partitioned through temporary files next to the output, so memory is bounded by a
+// chunk and the LOD grid whatever the size of the model. Sources without normals get flat ones.
+class ChunkedMeshBuilder
+{
+public:
+    static bool build(const string& sourcePath, const string& outputPath,
+                      GLuint maxTrianglesPerChunk = 16384, GLuint lodGridSize = 32);
+};
+
+
+// Streams a chunked mesh from disk. A loader thread reads the chunks requested by the render thread
+// (most important first), and the render thread uploads a bounded amount of them to the GPU every frame.
+// Nodes that are not resident yet are replaced by their (coarser) parent, so drawing never waits for I/O.
+class StreamedMesh
+{
+public:
+    /*  Streaming options  */
+    GLfloat maxScreenError;     // Refine a node while its error projects to more pixels than this.
+    size_t cpuBudget;           // Bytes of chunks read from disk but not uploaded yet.
+    size_t gpuBudget;           // Bytes of chunks resident on the GPU.
+    size_t uploadBudget;        // Bytes uploaded to the GPU per frame.
+
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    /*  Functions  */
+    // Constructor, expects a file written by ChunkedMeshBuilder. Only the node table is read here.
+    StreamedMesh(const string& path);
+    ~StreamedMesh();
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Selects the nodes to draw for this camera, requests the missing ones, uploads and evicts.
+    // Must be called once per frame, from the GL thread, before draw().
+    void update(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+                const glm::vec3& viewPos, GLfloat fov, GLuint viewportHeight);
+
+    // Draws the nodes selected by the last update()
+    void draw(Program& program);
+
+    // Current memory use, for the budgets above
+    size_t cpuBytes() const { return cpuResident.load(); }
+    size_t gpuBytes() const { return gpuResident; }
+
+private:
+    enum NodeState {
+        UNLOADED,       // Only in the node table (possibly requested from the loader)
+        LOADED,         // Read by the loader, waiting for upload
+        RESIDENT        // On the GPU
+    };
+
+    struct NodeData {
+        NodeState state;
+        GLuint VAO, VBO, EBO;
+        size_t bytes;
+        uint64_t lastUsedFrame;
+        vector<char> payload;   // Only while LOADED
+    };
+
+    struct Request {
+        GLfloat priority;       // Smaller is more important
+        uint32_t node;
+        bool operator<(const Request& other) const { return priority < other.priority; }
+    };
+
+    // Shared with the loader thread, see chunked_mesh.cpp
+    struct Loader;
+
+    int fd;
+    vector<ChunkNode> nodes;
+    vector<NodeData> data;
+    uint64_t frame;
+    size_t gpuResident;
+    atomic<size_t> cpuResident;
+
+    vector<uint32_t> drawList;
+    vector<Request> wanted;
+    vector<Request> toUpload;
+
+    Loader* loader;
+
+    /*  Functions    */
+    void select(uint32_t index, GLuint depth, const glm::vec4 frustum[6], const glm::vec3& viewPos,
+                const glm::vec3& viewDir, GLfloat pixelsPerUnit);
+    void request(uint32_t index, GLuint depth, const glm::vec3& viewPos, const glm::vec3& viewDir);
+    bool visible(uint32_t index, const glm::vec4 frustum[6]) const;
+    bool resident(uint32_t index) const { return data[index].state == RESIDENT; }
+
+    void upload(uint32_t index);
+    void evict(uint32_t index);
+
+    void loaderLoop();
+};
@@ -0,0 +1,97 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <scene.h>
+
+
+// Cluster grid: screen tiles in x and y, exponential depth slices in z. The CLUSTERED shader variants get
+// these as #defines (see ShaderPermutations::defines()).
+const GLuint CLUSTER_GRID_X = 16;
+const GLuint CLUSTER_GRID_Y = 9;
+const GLuint CLUSTER_GRID_Z = 24;
+const GLuint CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+// Texels (RGBA32F) per light in the lights buffer: view space position + radius, ambient, diffuse, specular.
+// Must match CLUSTER_LIGHT_TEXELS in shaders/nanoShader.frag.
+const GLint CLUSTER_LIGHT_TEXELS = 4;
+
+// Texture units of the three buffers - below TRANSFORM_TEXTURE_UNIT, clear of the material textures.
+const GLuint CLUSTER_LIGHTS_TEXTURE_UNIT = 12;
+const GLuint CLUSTER_RANGES_TEXTURE_UNIT = 13;
+const GLuint CLUSTER_INDICES_TEXTURE_UNIT = 14;
+
+
+// Clustered forward lighting: every frame the light entities of the scene are assigned to the clusters
+// of the view frustum they touch (on worker threads, one range of depth slices each), and the CLUSTERED
+// variants of the nano shader loop over the lights of their fragment's cluster only. Unlike the deferred
+// path, shading stays in the forward pass.
+//
+// GPU data, as buffer textures:
+//  - lights (RGBA32F): CLUSTER_LIGHT_TEXELS per light
+//  - ranges (RG32UI): offset in indices and light count, per cluster
+//  - indices (R32UI): the light lists of all the clusters, packed
+class ClusteredLighting
+{
+public:
+    /*  Functions  */
+    ClusteredLighting();
+    ~ClusteredLighting();
+
+    ClusteredLighting(const ClusteredLighting&) = delete;
+    ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+    // Assigns the lights of the scene and uploads the buffers. zNear and zFar must be those of the
+    // (perspective) projection, width and height the viewport's.
+    void update(const Scene& scene, const glm::mat4& view, const glm::mat4& projection,
+                GLfloat zNear, GLfloat zFar, GLuint width, GLuint height);
+
+    // Binds the buffers and sets the cluster uniforms of a CLUSTERED variant
+    void bind(Program& program) const;
+
+    // Of the last update(): lights in the frustum, and light references in all the clusters
+    inline size_t lightCount() const { return lights.size(); }
+    inline size_t indexCount() const { return indices.size(); }
+
+private:
+    // A light in the view frustum, with the range of clusters its bounding box touches
+    struct LightBounds {
+        glm::vec3 center;       // View space
+        GLfloat radius;
+        GLint x0, x1, y0, y1, z0, z1;   // Inclusive
+    };
+
+    struct Workers;
+
+    // Per frame
+    vector<LightBounds> lights;
+    vector<glm::vec4> lightTexels;
+    vector<vector<uint32_t> > clusterLights;    // Light indices of each cluster, filled by the workers
+    vector<uint32_t> ranges;                    // Offset and count of each cluster
+    vector<uint32_t> indices;
+
+    // View space bounding boxes of the clusters, rebuilt when the projection changes
+    vector<glm::vec3> clusterMin, clusterMax;
+    glm::mat4 gridProjection;
+    GLfloat zNear, zFar;
+    GLuint width, height;
+
+    GLuint buffers[3], textures[3];
+    size_t capacities[3];
+
+    Workers* workers;
+
+    /*  Functions    */
+    void buildGrid(const glm::mat4& projection);
+    GLint slice(GLfloat depth) const;
+
+    // Assigns all the lights to the clusters of depth slices [z0, z1), run by every worker
+    void assign(GLint z0, GLint z1);
+    void workerLoop(size_t share);
+};
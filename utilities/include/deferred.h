@@ -0,0 +1,48 @@
+#pragma once
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <scene.h>
+
+
+// Deferred shading: the geometry pass writes the material of every visible pixel to a G-buffer (the
+// GBUFFER variants of the nano shader), then every light is added in screen space, so a light costs the
+// pixels it touches instead of a loop iteration in every fragment of every mesh.
+//
+// G-buffer layout:
+//  - albedoSpec (RGBA8): diffuse color, specular intensity
+//  - normal (RGBA16): octahedral view space normal, log2(shininess) / 10, ambient factor
+//  - depth (DEPTH24_STENCIL8): view space position is rebuilt from it with the inverse projection
+class DeferredRenderer
+{
+public:
+    /*  Functions  */
+    DeferredRenderer(GLuint width, GLuint height);
+    ~DeferredRenderer();
+
+    DeferredRenderer(const DeferredRenderer&) = delete;
+    DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+    // Binds and clears the G-buffer, the GBUFFER variants are then drawn as usual
+    void beginGeometry();
+
+    // Adds every light entity of the scene to the default framebuffer (additive, one scissored full screen
+    // triangle per light in the frustum), then copies the G-buffer depth there so forward draws can follow.
+    void shadeLights(const Scene& scene, const glm::mat4& view, const glm::mat4& projection);
+
+    // Lights shaded by the last shadeLights()
+    inline GLuint lightsShaded() const { return shaded; }
+
+private:
+    GLuint width, height;
+    GLuint fbo;
+    GLuint albedoSpec, normal, depth;
+    GLuint emptyVAO;
+    Program* lightProgram;
+    GLuint shaded;
+
+    // Screen rectangle covering the light's sphere, false if it is entirely off screen
+    bool scissorRect(const glm::vec3& viewCenter, GLfloat radius, const glm::mat4& projection, GLint rect[4]) const;
+};
@@ -0,0 +1,66 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+
+// Linear allocator for what only lives during a frame: allocating bumps a pointer, freeing does nothing,
+// and reset() at the start of the next frame drops everything at once. A frame that needs more than the
+// block takes the rest from the heap, and the block is regrown to fit at the next reset(), so after a
+// few frames the steady state never touches the heap.
+class FrameArena
+{
+public:
+    /*  Functions  */
+    FrameArena(size_t capacity = 1 << 20);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment);
+
+    // Invalidates everything allocated since the previous reset()
+    void reset();
+
+    inline size_t capacity() const { return size; }
+    // Bytes used by the current frame, and most used by a frame so far
+    inline size_t used() const { return offset + overflowBytes; }
+    inline size_t highWater() const { return peak; }
+
+    // The render thread's, reset at the start of every frame
+    static FrameArena& renderThread();
+
+private:
+    uint8_t* block;
+    size_t size;
+    size_t offset;
+
+    vector<void*> overflow;     // Heap allocations past the block, freed by reset()
+    size_t overflowBytes;
+    size_t peak;
+};
+
+
+// Standard allocator on the render thread's FrameArena, for the containers that don't outlive the frame
+template <typename T>
+class FrameAllocator
+{
+public:
+    typedef T value_type;
+
+    FrameAllocator() {}
+    template <typename U> FrameAllocator(const FrameAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)FrameArena::renderThread().allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U> bool operator==(const FrameAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const FrameAllocator<U>&) const { return false; }
+};
+
+
+template <typename T>
+using FrameVector = vector<T, FrameAllocator<T> >;
@@ -0,0 +1,61 @@
+#pragma once
+// GL Includes
+#include <glm/glm.hpp>
+
+
+// Extracts the 6 planes (xyz normal pointing inside, w distance) of the frustum of a clip matrix.
+// With a view-projection matrix the planes are in world space, with a model-view-projection in model space.
+inline void
+extractFrustumPlanes(const glm::mat4& clip, glm::vec4 planes[6])
+{
+	for (int i = 0; i < 3; i++) {
+		for (int side = 0; side < 2; side++) {
+			glm::vec4& plane = planes[i * 2 + side];
+			float sign = side ? -1.0f : 1.0f;
+			for (int c = 0; c < 4; c++) {
+				plane[c] = clip[c][3] + sign * clip[c][i];
+			}
+			plane /= glm::length(glm::vec3(plane));
+		}
+	}
+}
+
+
+inline bool
+sphereInFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius)
+{
+	for (int i = 0; i < 6; i++) {
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// NDC rectangle covering a view space sphere: the projected corners of its bounding cube, clamped to
+// [-1, 1]. False when the sphere reaches the plane z = -zNear (the corners can't be projected there),
+// otherwise lo >= hi on an axis means the sphere is off screen.
+inline bool
+sphereNDCBounds(const glm::vec3& center, float radius, const glm::mat4& projection, float zNear,
+				glm::vec2& lo, glm::vec2& hi)
+{
+	if (center.z + radius > -zNear) {
+		return false;
+	}
+
+	lo = glm::vec2(1.0f);
+	hi = glm::vec2(-1.0f);
+	for (int c = 0; c < 8; c++) {
+		glm::vec3 corner = center + glm::vec3((c & 1) ? radius : -radius,
+											  (c & 2) ? radius : -radius,
+											  (c & 4) ? radius : -radius);
+		glm::vec4 clip = projection * glm::vec4(corner, 1.0f);
+		glm::vec2 ndc = glm::vec2(clip) / clip.w;
+		lo = glm::min(lo, ndc);
+		hi = glm::max(hi, ndc);
+	}
+	lo = glm::max(lo, glm::vec2(-1.0f));
+	hi = glm::min(hi, glm::vec2(1.0f));
+	return true;
+}
@@ -0,0 +1,113 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+#include <frame_arena.h>
+
+
+// Rolling GPU time of a named scope, in milliseconds
+struct GpuScopeStats {
+    const char* name;
+    double min;
+    double avg;
+    double p99;
+    size_t samples;
+    double cpu;         // Average time the render thread spent in the scope (submitting)
+};
+
+
+// GPU time of named scopes, from GL_TIMESTAMP queries around them (timestamps rather than GL_TIME_ELAPSED so
+// scopes can nest). The queries of a frame are read back 'latency' frames later, when the GPU is long
+// done with them, so the profiler never waits: a frame whose results still aren't there is dropped.
+// Every scope keeps its last historySize frames (a scope entered several times in a frame counts the sum),
+// "frame" being the whole frame from beginFrame() to endFrame(). The CPU time of the scopes is kept too.
+class GpuProfiler
+{
+public:
+    // Seconds between two log lines of all the scopes, 0 for none
+    double logInterval;
+
+    /*  Functions  */
+    GpuProfiler(GLuint latency = 4, size_t historySize = 240, double logInterval = 5.0);
+    ~GpuProfiler();
+
+    GpuProfiler(const GpuProfiler&) = delete;
+    GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+    // Around everything of the frame, buffer swap included
+    void beginFrame();
+    void endFrame();
+
+    // Scopes must be properly nested, and within a frame. Scopes are told apart by name, which must outlive
+    // the profiler (string literals do).
+    void begin(const char* name);
+    void end();
+
+    // Every scope seen so far, in order of first appearance. Lives in the frame arena, until the next frame.
+    FrameVector<GpuScopeStats> stats() const;
+    // One line, "name min/avg/p99" of every scope
+    string summary() const;
+    void summary(ostream& out) const;
+
+    // Frames whose results were not available in time
+    inline uint64_t droppedFrames() const { return dropped; }
+
+private:
+    struct Record {
+        uint32_t scope;
+        uint32_t beginQuery, endQuery;  // Indices in the frame's queries
+        chrono::steady_clock::time_point cpuBegin;
+    };
+
+    struct Frame {
+        vector<GLuint> queries;     // Grown as needed, reused
+        uint32_t used;
+        vector<Record> records;
+        bool pending;               // Queries issued, results not read yet
+    };
+
+    struct Scope {
+        const char* name;
+        vector<double> history;     // Ring of the last frames' times (ms)
+        size_t next;
+        double frameTotal;          // Being summed for the frame read back
+
+        vector<double> cpuHistory;  // Same, for the CPU times, which are known right away
+        size_t cpuNext;
+        double cpuTotal;            // Of the current frame, negative if not entered
+    };
+
+    vector<Frame> frames;
+    uint64_t frameIndex;
+    vector<uint32_t> open;          // Records of the scopes not ended yet
+
+    vector<Scope> scopes;            // Few, searched linearly
+    size_t historySize;
+    uint64_t dropped;
+
+    chrono::steady_clock::time_point lastLog;
+
+    /*  Functions    */
+    GLuint timestamp(Frame& frame);
+    void collect(Frame& frame);
+    void addSample(vector<double>& history, size_t& next, double value) const;
+};
+
+
+// Profiles the enclosing block
+class GpuScope
+{
+public:
+    GpuScope(GpuProfiler& profiler, const char* name) :profiler(profiler) { profiler.begin(name); }
+    ~GpuScope() { profiler.end(); }
+
+private:
+    GpuProfiler& profiler;
+};
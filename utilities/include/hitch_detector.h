@@ -0,0 +1,80 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+
+// Work that can stall a frame, timed by HitchScope where it happens
+enum HitchSubsystem {
+    HITCH_MODEL_LOAD,       // Model import
+    HITCH_TEXTURE_UPLOAD,   // Image decode and texture creation
+    HITCH_SHADER_COMPILE,   // Program compile and link, or the wait for it on first use
+    HITCH_CHUNK_UPLOAD,     // Streamed mesh chunks sent to the GPU
+    HITCH_GPU_RELEASE,      // GL objects of models and chunks deleted
+
+    HITCH_SUBSYSTEM_COUNT
+};
+
+const char* hitchSubsystemName(HitchSubsystem subsystem);
+
+
+// Flags the frames slower than 'threshold' times the median of the last frames, and keeps what the subsystems
+// did during each of them, so a stall can be traced to a shader compiled on first use or a texture upload.
+// The subsystems are only timed on the render thread.
+class HitchDetector
+{
+public:
+    // Multiple of the rolling median over which a frame is a hitch
+    double threshold;
+
+    /*  Functions  */
+    HitchDetector(double threshold = 2.0, size_t historySize = 120);
+
+    // Call once per frame: the frame is the time since the previous call, and the work recorded meanwhile
+    void endFrame();
+
+    // Compact report of every hitch, one line each
+    string report() const;
+    bool writeReport(const string& path) const;
+
+    inline size_t hitchCount() const { return hitches.size(); }
+
+    // Adds to the current frame, see HitchScope
+    static void record(HitchSubsystem subsystem, double ms);
+
+private:
+    struct Hitch {
+        uint64_t frame;
+        double ms, median;
+        double subsystemMs[HITCH_SUBSYSTEM_COUNT];
+        uint32_t subsystemCalls[HITCH_SUBSYSTEM_COUNT];
+    };
+
+    vector<double> history;     // Ring of the last frame times
+    size_t historySize;
+    size_t next;
+    vector<double> sorted;      // Scratch for the median
+    uint64_t frames;
+    int64_t frameStart;         // Trace::now() of the previous endFrame()
+
+    vector<Hitch> hitches;
+
+    // Of the frame being run
+    static double frameMs[HITCH_SUBSYSTEM_COUNT];
+    static uint32_t frameCalls[HITCH_SUBSYSTEM_COUNT];
+};
+
+
+// Times the enclosing block as work of a subsystem
+class HitchScope
+{
+public:
+    HitchScope(HitchSubsystem subsystem);
+    ~HitchScope();
+
+private:
+    HitchSubsystem subsystem;
+    int64_t start;
+};
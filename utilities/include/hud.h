@@ -0,0 +1,63 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+
+
+// Pixels of a glyph side, must match HUD_GLYPH_SIZE in shaders/hud.frag
+const GLuint HUD_GLYPH_SIZE = 8;
+
+
+// Text and flat rectangles drawn over the frame, for watching a running viewer without a profiler.
+// Everything queued during a frame goes to the GPU as one instance buffer and one instanced draw; the font
+// is a built in 8x8 bitmap of printable ASCII, so there is nothing to load.
+class Hud
+{
+public:
+    bool visible;
+
+    // Screen pixels per font pixel
+    GLfloat scale;
+
+    /*  Functions  */
+    Hud();
+    ~Hud();
+
+    Hud(const Hud&) = delete;
+    Hud& operator=(const Hud&) = delete;
+
+    // Positions are in pixels from the top left corner of the window
+    void text(GLfloat x, GLfloat y, const char* s, const glm::vec4& color = glm::vec4(1.0f));
+    void rect(GLfloat x, GLfloat y, GLfloat width, GLfloat height, const glm::vec4& color);
+
+    // Bar graph of a ring of values ('next' being the oldest), a value of 'top' filling the height.
+    // Bars over 'budget' are red.
+    void graph(GLfloat x, GLfloat y, GLfloat width, GLfloat height,
+               const vector<GLfloat>& values, size_t next, GLfloat top, GLfloat budget);
+
+    // Height of a line of text
+    inline GLfloat lineHeight() const { return (HUD_GLYPH_SIZE + 2) * scale; }
+
+    // Draws what was queued since the last call (nothing if not visible) and forgets it
+    void draw(GLuint width, GLuint height);
+
+private:
+    struct Quad {
+        glm::vec4 rect;
+        glm::vec4 color;
+        GLfloat glyph;
+    };
+
+    vector<Quad> quads;
+
+    Program* program;
+    GLuint font;
+    GLuint VAO, instanceVBO;
+    size_t instanceCapacity;
+};
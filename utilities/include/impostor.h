@@ -0,0 +1,74 @@
+#pragma once
+// Std. Includes
+#include <vector>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <program.h>
+#include <model.h>
+#include <shader_permutations.h>
+
+
+// An impostor replaces a distant model by a camera facing quad.
+// At load time the model is rendered (with the IMPOSTOR_CAPTURE variants of its shaders) from
+// framesPerSide x framesPerSide directions laid out on an octahedral map, into three atlases: unlit albedo,
+// view space normal, and linear depth as a float. The impostor program lights them with the actual lamp.
+// At draw time every instance picks the frame captured closest to its view direction, so a crowd of
+// far away models costs one instanced draw call of quads.
+// Each frame keeps an empty border as wide as a texel of its smallest mip level, so filtering never reaches
+// into the neighbouring frames.
+class Impostor
+{
+public:
+    /*  Impostor Data  */
+    GLuint colorAtlas;
+    GLuint normalAtlas;
+    GLuint depthAtlas;
+    GLuint framesPerSide;
+    GLuint frameSize;
+    GLuint maxMipLevel;
+
+    // Bounding sphere of the captured model, in model space.
+    glm::vec3 center;
+    GLfloat radius;
+
+    // Beyond this distance (world units, from the camera to the instance) the impostor is drawn instead of the model.
+    GLfloat distance;
+
+    /*  Functions  */
+    // Constructor, captures the atlases of the model, each mesh with its capture variant of the given shaders.
+    Impostor(const Model& model, ShaderPermutations& shaders, GLfloat distance = 15.0f, GLuint framesPerSide = 8, GLuint frameSize = 128);
+    ~Impostor();
+
+    // Whether an instance placed at 'position' (world space) should be drawn as an impostor.
+    inline bool useImpostor(const glm::vec3& position, const glm::vec3& viewPos) const
+    {
+        glm::vec3 d = position - viewPos;
+        return glm::dot(d, d) > distance * distance;
+    }
+
+    // Draws all the instances in one call. Each instance is (x, y, z, scale) - the same
+    // translation and uniform scale that would have been given to the model matrix.
+    // The program is expected to have its view, projection and light uniforms already set.
+    void draw(Program& program, const vector<glm::vec4>& instances);
+
+private:
+    /*  Render data  */
+    GLuint quadVAO, quadVBO, instanceVBO;
+    GLsizei instanceCapacity;
+
+    GLfloat captureNear, captureFar;
+
+    // Empty texels around each frame, 1 << maxMipLevel
+    GLuint framePadding;
+
+    /*  Functions    */
+    // Renders the model from every direction of the octahedral map into the atlases.
+    void capture(const Model& model, ShaderPermutations& shaders);
+
+    // Initializes the quad and instance buffers.
+    void setupQuad();
+};
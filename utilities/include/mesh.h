@@ -12,6 +12,8 @@ using namespace std;
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <program.h>
+#include <shader_permutations.h>
+#include <quality.h>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -27,10 +29,34 @@ struct Vertex {
     glm::vec3 bitangent; // Bitangent
 };
 
+// Compact vertex layouts of the cheaper quality tiers
+struct GouraudVertex {
+    glm::vec3 position;
+    GLuint normal;          // GL_INT_2_10_10_10_REV, normalized
+    GLushort texCoords[2];  // Half floats
+};
+
+struct UnlitVertex {
+    glm::vec3 position;
+    GLushort texCoords[2];  // Half floats
+};
+
+// Floats per Vertex, for shaders reading the vertex buffer directly. Must match VERTEX_FLOATS in the shaders.
+const GLint VERTEX_FLOATS = 14;
+static_assert(sizeof(Vertex) == VERTEX_FLOATS * sizeof(GLfloat), "Vertex must be tightly packed floats");
+
+// What a mesh keeps in CPU memory once uploaded
+enum MeshCpuData {
+    MESH_CPU_KEEP,          // Vertices and indices
+    MESH_CPU_COLLISION,     // Positions and indices only, for collision queries
+    MESH_CPU_DROP           // Nothing but the counts and bounds
+};
+
 struct Texture {
     GLuint id;
     string type;
     aiString path;
+    size_t bytes;       // GPU memory, all levels
 };
 
 class Mesh {
@@ -38,31 +64,77 @@ public:
 
 	bool textured;
     /*  Mesh Data  */
+    // Empty once dropped (see dropCpuData), the counts and bounds stay
     vector<Vertex> vertices;
     vector<GLuint> indices;
     vector<Texture> textures;
 
+    GLsizei vertexCount, indexCount;
+    glm::vec3 boundsMin, boundsMax;
+    // Vertex positions kept with MESH_CPU_COLLISION, when the vertices are dropped
+    vector<glm::vec3> positions;
+
     glm::vec3 ambient;
     glm::vec3 diffuse;
     glm::vec3 specular;
     GLfloat shininess;
 
+    // ShaderFeature bits of the variant to draw it with, picked at import
+    uint32_t shaderFeatures;
+
     GLuint VAO;
 
+    // GPU memory of the buffers created so far (the layouts of other tiers and the position stream are lazy)
+    mutable size_t gpuBytes;
+
     /*  Functions  */
     // Constructor
-    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, vector<glm::vec3>& colors, GLfloat shininess);
+    // Without upload, no GL object is created (nor released) and the mesh can't be drawn
+    Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures, vector<glm::vec3>& colors, GLfloat shininess,
+         bool upload = true);
 
-    // Render the mesh
-    void draw(Program program);
+    // Frees the CPU copies of what was uploaded. The lazily built layouts are then made from a read back
+    // of the vertex buffer.
+    void dropCpuData(MeshCpuData keep);
+
+    // CPU memory of the vertices, indices and positions kept
+    size_t cpuBytes() const;
+
+    // Render the mesh, with the vertex layout of the quality tier (the program must be a variant for it)
+    void draw(const Program& program, QualityTier tier = QUALITY_FULL) const;
+
+    // Render positions only (attribute 0), from a packed stream - for passes that need no material
+    void drawPositions() const;
+
+    // Material uniforms and textures (units 0 and up) of the program, as draw() sets them, and their reset
+    void bindMaterial(const Program& program) const;
+    void unbindMaterial() const;
+
+    // Binds the vertices (R32F, Vertex as VERTEX_FLOATS floats) and indices (R32UI) as buffer textures,
+    // for shaders that fetch the attributes themselves (see VisibilityRenderer)
+    void bindVertexData(GLuint vertexUnit, GLuint indexUnit) const;
+
+    // Deletes the GL objects of the mesh
+    void release();
 
 private:
     /*  Render data  */
     GLuint VBO, EBO;
 
+    // Vertex layouts of the other tiers (they share the EBO), built the first time a tier is drawn
+    mutable GLuint layoutVAO[QUALITY_TIER_COUNT], layoutVBO[QUALITY_TIER_COUNT];
+
+    // Position only stream, and the buffer textures over VBO and EBO - built on first use too
+    mutable GLuint positionVAO, positionVBO;
+    mutable GLuint vertexTexture, indexTexture;
+
     /*  Functions    */
     // Initializes all the buffer objects/arrays
     void setupMesh();
+    GLuint setupLayout(QualityTier tier) const;
+
+    // The vertices, or if they were dropped, 'readback' filled from the vertex buffer
+    const vector<Vertex>& sourceVertices(vector<Vertex>& readback) const;
 };
 
 
@@ -0,0 +1,77 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+using namespace std;
+
+
+// Model load durations kept in a snapshot, and the length of their names
+const size_t METRICS_MAX_LOADS = 16;
+const size_t METRICS_NAME_SIZE = 128;
+
+
+// Resident set size of the process, 0 if unknown
+uint64_t residentBytes();
+// Highest resident set size of the process since it started (kernel high water mark), 0 if unknown
+uint64_t peakResidentBytes();
+
+
+// Everything served, as the render thread last published it. Plain data: it is copied, never shared.
+struct MetricsSnapshot {
+    uint64_t frames;
+    double frameSeconds;            // Sum of all the frame times
+    double frameQuantiles[4];       // 0.5, 0.9, 0.99 and 1 (max) over the recent frames, in seconds
+
+    uint32_t modelsLoaded;
+    uint32_t texturesLoaded;
+    uint64_t meshGpuBytes;
+    uint64_t textureGpuBytes;
+    uint64_t meshCpuBytes;          // Vertices, indices and positions kept in RAM by the meshes
+
+    struct Load {
+        char model[METRICS_NAME_SIZE];
+        double seconds;
+    };
+    Load loads[METRICS_MAX_LOADS];
+    uint32_t loadCount;
+};
+
+
+// Serves the metrics in the Prometheus text format over HTTP, on a local TCP port ("127.0.0.1:9100") or a
+// Unix socket ("unix:/tmp/viewer.sock"), from its own thread. The render thread fills snapshot() and
+// publish()es it; snapshots go through a triple buffer, so neither side ever waits for the other.
+class MetricsServer
+{
+public:
+    /*  Functions  */
+    MetricsServer(const string& address);
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // False if the address could not be listened on
+    inline bool isRunning() const { return listener >= 0; }
+
+    // Render thread: the snapshot to fill (every field, it holds older data), then hand it to the server
+    inline MetricsSnapshot& snapshot() { return buffers[back]; }
+    void publish();
+
+private:
+    MetricsSnapshot buffers[3];
+    uint32_t back;                  // Render thread's
+    atomic<uint32_t> middle;        // Index, with NEW_SNAPSHOT set when published and not taken yet
+    uint32_t front;                 // Server thread's
+    bool published;
+
+    int listener;
+    string unixPath;
+    atomic<bool> quit;
+    thread server;
+
+    /*  Functions    */
+    void serve();
+    string render();
+};
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cstdint>
 using namespace std;
 // GL Includes
 #include <GL/glew.h> // Contains all the necessery OpenGL includes
@@ -22,6 +23,45 @@ using namespace std;
 
 GLint TextureFromFile(const char* path, string directory, bool gamma = false);
 
+
+// A texture file loaded by a model
+struct TextureLoad {
+    string path;
+    GLint width, height;
+    GLint bitsPerPixel;     // Of the file, before the conversion to 32 bits
+    size_t bytes;           // GPU memory, level 0
+    double decodeMs;        // File read and conversion
+    double uploadMs;        // Texture creation and mipmaps (CPU side, the driver may finish later)
+};
+
+
+// Where the time of a model import went, in milliseconds. The upload times are what the render thread spent
+// submitting them. Peak resident is the process RSS, sampled between the phases.
+struct ModelLoadReport {
+    string path;
+    double parseMs;             // Assimp import, no post-processing
+    double postProcessMs;       // Triangulation, tangents, UV flip
+    double vertexMs;            // Assimp meshes to Vertex and indices
+    double materialMs;          // Material colors and texture lookups, the texture loads aside
+    double textureDecodeMs;
+    double textureUploadMs;
+    double meshUploadMs;        // Vertex and index buffers
+    double totalMs;
+
+    size_t meshes, vertices, triangles;
+    size_t assimpBytes;         // Of the imported scene
+    uint64_t peakResident;      // Process RSS high water mark once loaded, so it includes every transient of the load
+
+    vector<TextureLoad> textures;
+
+    /*  Functions  */
+    ModelLoadReport();
+
+    string summary() const;
+    // The summary, then one line per texture
+    string report() const;
+};
+
 class Model
 {
 public:
@@ -31,14 +71,38 @@ public:
     string directory;
     bool gammaCorrection;
 
+    // Axis aligned bounds of all the meshes, in model space.
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    ModelLoadReport loadReport;
+
     /*  Functions   */
-    // Constructor, expects a filepath to a 3D model.
-    Model(string const & path, bool gamma = false);
+    // Constructor, expects a filepath to a 3D model. 'cpuData' is what the meshes keep once uploaded.
+    // Without upload (tools, no GL context) nothing is sent to the GPU: the meshes keep their data whatever
+    // 'cpuData' is, and the textures are decoded for their size only (their id is 0).
+    Model(string const & path, bool gamma = false, MeshCpuData cpuData = MESH_CPU_KEEP, bool upload = true);
+    // Releases the GL objects of the meshes and textures
+    ~Model();
+
+    // A model owns GL objects, share it (see AssetManager) instead of copying it
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
 
     // Draws the model, and thus all its meshes
-    void draw(Program program);
+    void draw(const Program& program) const;
+
+    // GPU memory of the mesh buffers and of the textures
+    size_t meshBytes() const;
+    size_t textureBytes() const;
+    // CPU memory of the vertices, indices and positions the meshes keep
+    size_t cpuBytes() const;
+
+    // Memory of every mesh and texture, one line each
+    string memoryReport() const;
 
 private:
+    bool gpuUpload;
 
     /*  Functions   */
     // Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
@@ -57,6 +121,7 @@ private:
 //    GLint loadTextureFromFile(const char* path, string directory, bool gamma = false);
 
 
+    // Also adds the file to loadReport.textures
     GLuint loadTexture(const char* filename, GLenum minificationFilter = GL_LINEAR, GLenum magnificationFilter = GL_LINEAR);
 };
 
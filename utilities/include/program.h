@@ -9,6 +9,18 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
+
+#include <render_stats.h>
+
+
+
+// Typed handle of a uniform. They are generated from the shaders (Uniforms::* in shader_interfaces.h),
+// so a misspelled name or a value of the wrong type doesn't compile.
+template <typename T>
+struct Uniform {
+	GLuint index;       // In UNIFORM_NAMES, and in Program::locations
+};
 
 
 
@@ -19,86 +31,84 @@ public:
 	// Faster no function calls
 	GLuint id;
 
+	// Where linked program binaries are kept between launches (empty disables the cache)
+	static std::string binaryCacheDirectory;
+
+	// Lets the driver compile on its own threads (GL_KHR/ARB_parallel_shader_compile), call once
+	// before creating the programs. Without the extension, compiling is still deferred - see finish().
+	static void enableParallelCompile();
+
 
 
 public:
 
+	// 'defines' (e.g. "#define TEXTURED\n") is inserted right after the #version line of every stage
 	Program (const GLchar* vertexShaderPath,
 			const GLchar* fragmentShaderPath,
-			const GLchar* geometryShaderPath = nullptr);
+			const GLchar* geometryShaderPath = nullptr,
+			const std::string& defines = "");
 
 
 
-	inline void use() { glUseProgram(id); }
+	// The first use waits for the program to be compiled and reports errors
+	inline void use()
+	{
+		if (pending) finish();
+		if (id != current) {
+			current = id;
+			RenderStats::frame.programSwitches++;
+		}
+		glUseProgram(id);
+	}
 
-    // utility uniform functions
-    // ------------------------------------------------------------------------
-    inline void setBool(const std::string &name, bool value) const
-    {
-        glUniform1i(glGetUniformLocation(id, name.c_str()), (int)value);
-    }
-    // ------------------------------------------------------------------------
-    inline void setInt(const std::string &name, int value) const
-    {
-        glUniform1i(glGetUniformLocation(id, name.c_str()), value);
-    }
-    // ------------------------------------------------------------------------
-    inline void setFloat(const std::string &name, float value) const
-    {
-        glUniform1f(glGetUniformLocation(id, name.c_str()), value);
-    }
-    // ------------------------------------------------------------------------
-    inline void setVec2(const std::string &name, const glm::vec2 &value) const
-    {
-        glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-    }
-    inline void setVec2(const std::string &name, float x, float y) const
-    {
-        glUniform2f(glGetUniformLocation(id, name.c_str()), x, y);
-    }
-    // ------------------------------------------------------------------------
-    inline void setVec3(const std::string &name, const glm::vec3 &value) const
-    {
-        glUniform3fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-    }
-    inline void setVec3(const std::string &name, float x, float y, float z) const
-    {
-        glUniform3f(glGetUniformLocation(id, name.c_str()), x, y, z);
-    }
-    // ------------------------------------------------------------------------
-    inline void setVec4(const std::string &name, const glm::vec4 &value) const
-    {
-        glUniform4fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
-    }
-    inline void setVec4(const std::string &name, float x, float y, float z, float w)
-    {
-        glUniform4f(glGetUniformLocation(id, name.c_str()), x, y, z, w);
-    }
-    // ------------------------------------------------------------------------
-    inline void setMat2(const std::string &name, const glm::mat2 &mat) const
-    {
-        glUniformMatrix2fv(glGetUniformLocation(id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    // ------------------------------------------------------------------------
-    inline void setMat3(const std::string &name, const glm::mat3 &mat) const
-    {
-        glUniformMatrix3fv(glGetUniformLocation(id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-    }
-    // ------------------------------------------------------------------------
-    inline void setMat4(const std::string &name, const glm::mat4 &mat) const
-    {
-        glUniformMatrix4fv(glGetUniformLocation(id, name.c_str()), 1, GL_FALSE, &mat[0][0]);
-        //glUniformMatrix4fv(glGetUniformLocation(id, name.c_str()), 1, GL_FALSE, glm::value_ptr(mat));
-    }
+	// False while the driver is still compiling the program (only known with parallel compile)
+	bool isReady() const;
 
+	// Waits for the compilation and link, reports errors and stores the binary. Called by the first use().
+	void finish();
 
+    // typed uniform functions (locations resolved once, when the program is linked)
+    // ------------------------------------------------------------------------
+    inline void set(Uniform<bool> u, bool value) const { RenderStats::frame.uniformUploads++; glUniform1i(locations[u.index], (int)value); }
+    inline void set(Uniform<GLint> u, GLint value) const { RenderStats::frame.uniformUploads++; glUniform1i(locations[u.index], value); }
+    inline void set(Uniform<GLuint> u, GLuint value) const { RenderStats::frame.uniformUploads++; glUniform1ui(locations[u.index], value); }
+    inline void set(Uniform<GLfloat> u, GLfloat value) const { RenderStats::frame.uniformUploads++; glUniform1f(locations[u.index], value); }
+    inline void set(Uniform<glm::vec2> u, const glm::vec2& value) const { RenderStats::frame.uniformUploads++; glUniform2fv(locations[u.index], 1, &value[0]); }
+    inline void set(Uniform<glm::vec3> u, const glm::vec3& value) const { RenderStats::frame.uniformUploads++; glUniform3fv(locations[u.index], 1, &value[0]); }
+    inline void set(Uniform<glm::vec4> u, const glm::vec4& value) const { RenderStats::frame.uniformUploads++; glUniform4fv(locations[u.index], 1, &value[0]); }
+    inline void set(Uniform<glm::mat2> u, const glm::mat2& mat) const { RenderStats::frame.uniformUploads++; glUniformMatrix2fv(locations[u.index], 1, GL_FALSE, &mat[0][0]); }
+    inline void set(Uniform<glm::mat3> u, const glm::mat3& mat) const { RenderStats::frame.uniformUploads++; glUniformMatrix3fv(locations[u.index], 1, GL_FALSE, &mat[0][0]); }
+    inline void set(Uniform<glm::mat4> u, const glm::mat4& mat) const { RenderStats::frame.uniformUploads++; glUniformMatrix4fv(locations[u.index], 1, GL_FALSE, &mat[0][0]); }
 
 
 private:
 
+	static bool parallelCompile;
+
+	// Last program used, to count the switches
+	static GLuint current;
+
+	// Location of every generated uniform (-1 for the ones this program doesn't have, or until it is linked)
+	std::vector<GLint> locations;
+
+	// Compiled and linked, status not checked yet
+	bool pending;
+	GLuint shaders[3];
+	std::string cachePath;
+
 	std::string readFile(const GLchar* fileName);
 
+	// Cached binary of the program, keyed by its sources and the driver
+	std::string binaryCachePath(const std::string& vertexCode, const std::string& fragmentCode,
+								const std::string& geometryCode) const;
+	bool loadBinary(const std::string& path);
+	void saveBinary(const std::string& path) const;
+
+	// Locations of the generated uniforms and binding points of the uniform blocks
+	void resolveInterface();
+
 	GLuint compileShader(GLuint shaderType, const GLchar* shaderCode);
+	void reportShader(GLuint shaderHandler);
 
 	void linkShaders(GLuint vertexShaderH, GLuint fragmentShaderH, GLuint geometryShaderH);
 };
@@ -0,0 +1,53 @@
+#pragma once
+// Std. Includes
+#include <cstdint>
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+
+// Shading quality, from the most to the least expensive. Each tier draws with its own shader variant
+// (see tierShaderFeatures()) and its own vertex layout (see Mesh::draw()).
+enum QualityTier {
+    QUALITY_FULL,       // Per pixel Phong, every map of the material - 56 bytes per vertex
+    QUALITY_GOURAUD,    // Per vertex lighting, diffuse map only - 20 bytes per vertex
+    QUALITY_UNLIT,      // Diffuse map (or color) only - 16 bytes per vertex
+
+    QUALITY_TIER_COUNT
+};
+
+const char* tierName(QualityTier tier);
+
+// The shader features (ShaderFeature) to draw a mesh with, given the ones its material uses
+uint32_t tierShaderFeatures(QualityTier tier, uint32_t meshFeatures);
+
+
+// Picks the tier. Manual by default, in automatic mode it steps down when frames are slower than the target
+// and back up when there is plenty of headroom. Meant for software rasterizers (llvmpipe) and low end GPUs,
+// where the fragment shading dominates the frame time.
+class QualityController
+{
+public:
+    QualityTier tier;
+    bool automatic;
+
+    // Frame time (seconds) automatic mode aims to stay under
+    GLfloat targetFrameTime;
+
+    /*  Functions  */
+    QualityController(GLfloat targetFrameTime = 1.0f / 30.0f);
+
+    // Call once per frame with the last frame's duration
+    void update(GLfloat frameTime);
+
+    // Manual selection (leaves automatic mode)
+    void setTier(QualityTier tier);
+    void nextTier();
+
+private:
+    GLfloat smoothedFrameTime;
+    GLuint framesSinceSwitch;
+    GLuint upgradeCooldown;     // Grows every time an upgrade has to be undone
+    bool upgraded;              // The last switch was an automatic step up
+
+    void switchTo(QualityTier tier);
+};
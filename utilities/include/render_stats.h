@@ -0,0 +1,45 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+
+// Driver work of a frame, counted where the calls are made (Mesh, Program, the buffer uploads and the
+// full screen passes), so an optimization can be checked to actually issue fewer of them.
+struct RenderStats {
+    uint64_t drawCalls;
+    uint64_t triangles;
+    uint64_t vertices;          // Vertices (indices) the draws submit
+    uint64_t programSwitches;   // use() of another program than the current one
+    uint64_t vaoBinds;
+    uint64_t textureBinds;
+    uint64_t uniformUploads;    // Uniform values set, the uniform blocks count as bytesUploaded
+    uint64_t bytesUploaded;     // Buffer contents sent to the GPU
+
+    // The frame being counted, and the last complete one
+    static RenderStats frame;
+    static RenderStats lastFrame;
+
+    /*  Functions  */
+    RenderStats() { this->reset(); }
+
+    void reset();
+
+    // A draw of 'count' vertices, 'instances' times (GL_TRIANGLES or GL_TRIANGLE_STRIP)
+    inline void draw(GLenum mode, GLsizei count, GLsizei instances = 1)
+    {
+        GLsizei primitives = (mode == GL_TRIANGLE_STRIP) ? ((count > 2) ? count - 2 : 0) : count / 3;
+        this->drawCalls++;
+        this->triangles += (uint64_t)primitives * instances;
+        this->vertices += (uint64_t)count * instances;
+    }
+
+    // One line with every counter
+    string summary() const;
+
+    // Call once the frame is submitted: makes it lastFrame and starts counting the next one
+    static void endFrame();
+};
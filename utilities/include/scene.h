@@ -0,0 +1,153 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <model.h>
+#include <impostor.h>
+#include <asset_manager.h>
+#include <shader_permutations.h>
+
+
+// Stable reference to an entity. Entities move around in the component tables when others are
+// destroyed, the handle stays valid until its own entity is destroyed (generation is then bumped).
+struct EntityHandle {
+    uint32_t index;         // Slot in the sparse table
+    uint32_t generation;
+
+    EntityHandle() :index(UINT32_MAX), generation(0) {}
+};
+
+enum EntityFlags {
+    ENTITY_DRAWABLE     = 1 << 0,   // Has a model
+    ENTITY_LIGHT        = 1 << 1,   // Has light params
+    ENTITY_MATERIAL     = 1 << 2,   // Has a material override
+    ENTITY_STATIC       = 1 << 3,   // Never moves - cached in the static shadow map
+};
+
+// Per object factors applied on top of the mesh materials (the g_* uniforms of the model program)
+struct MaterialOverride {
+    glm::vec3 color     = glm::vec3(1.0f, 1.0f, 1.0f);
+    glm::vec3 ambient   = glm::vec3(1.0f, 1.0f, 1.0f);
+    glm::vec3 diffuse   = glm::vec3(1.0f, 0.5f, 0.31f);
+    glm::vec3 specular  = glm::vec3(0.5f, 0.5f, 0.5f);
+    GLfloat shininess   = 4.0f;
+};
+
+// Point light, positioned by the entity transform
+struct LightParams {
+    glm::vec3 color     = glm::vec3(1.0f, 1.0f, 1.0f);
+    glm::vec3 ambient   = glm::vec3(0.8f, 0.8f, 0.8f);
+    glm::vec3 diffuse   = glm::vec3(0.5f, 0.5f, 0.5f);
+    glm::vec3 specular  = glm::vec3(1.0f, 1.0f, 1.0f);
+    GLfloat radius      = 10.0f;    // Range, the light fades out to nothing there (deferred path)
+};
+
+// Placement of a shared model asset: a transform and the per instance material, nothing to load or upload.
+struct ModelInstance {
+    ModelAssetRef asset;
+    glm::vec3 position      = glm::vec3(0.0f, 0.0f, 0.0f);
+    glm::vec4 rotation      = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);   // Quaternion (x, y, z, w)
+    glm::vec3 scale         = glm::vec3(1.0f, 1.0f, 1.0f);
+    uint32_t flags          = 0;                                    // Extra EntityFlags (ENTITY_DRAWABLE is implied)
+    MaterialOverride material;
+};
+
+// A model registered in the scene, entities refer to it by its index. The scene holds a reference to the asset.
+struct ModelEntry {
+    ModelAssetRef model;
+    Program* program;               // Draws all the meshes, or
+    ShaderPermutations* shaders;    // each mesh with its variant (Mesh::shaderFeatures)
+    Impostor* impostor;             // Optional, used beyond impostor->distance
+    uint32_t programIndex;
+};
+
+// One entry of the draw list: sort key (program, then model) and the entity's dense index
+struct DrawItem {
+    uint32_t key;
+    uint32_t index;
+
+    bool operator<(const DrawItem& other) const { return key < other.key; }
+};
+
+
+// Data oriented scene store. Every component is a table (structure of arrays) indexed by the entity's
+// dense index in [0, size()), kept packed when entities are destroyed, so the systems below walk
+// contiguous memory. Tables of components an entity doesn't have hold defaults.
+class Scene
+{
+public:
+    /*  Component tables  */
+    // Transform
+    vector<glm::vec3> positions;
+    vector<glm::vec4> rotations;        // Quaternion (x, y, z, w)
+    vector<glm::vec3> scales;
+    vector<glm::mat4> worldMatrices;    // Output of updateTransforms()
+
+    // Bounds (model space sphere, and its world space version from updateTransforms())
+    vector<glm::vec4> localBounds;      // Center (xyz), radius (w)
+    vector<glm::vec4> worldBounds;
+
+    vector<uint32_t> models;            // Index in modelTable
+    vector<MaterialOverride> materials;
+    vector<LightParams> lights;
+    vector<uint32_t> flags;             // EntityFlags
+    vector<uint8_t> visible;            // Output of cull()
+
+    /*  Model table  */
+    vector<ModelEntry> modelTable;
+    vector<const void*> programTable;                           // Distinct programs and shaders, for the sort key
+    unordered_map<const ModelAsset*, uint32_t> modelIndices;    // Asset -> index in modelTable
+
+    /*  Functions  */
+    Scene();
+
+    // Entities
+    EntityHandle create(uint32_t flags);
+    void destroy(EntityHandle handle);
+    bool alive(EntityHandle handle) const;
+    // Dense index of a live entity, valid until the next destroy()
+    inline uint32_t indexOf(EntityHandle handle) const { return slots[handle.index].dense; }
+    inline size_t size() const { return positions.size(); }
+
+    // Registers a model, returns the index to give to setModel()
+    uint32_t addModel(const ModelAssetRef& model, Program* program, Impostor* impostor = nullptr);
+    uint32_t addModel(const ModelAssetRef& model, ShaderPermutations* shaders, Impostor* impostor = nullptr);
+    void setModel(EntityHandle handle, uint32_t model);
+
+    // New entity for an instance of a registered model (addModel()), invalid handle if it isn't registered
+    EntityHandle spawn(const ModelInstance& instance);
+
+    // Destroys all the entities and drops the model references
+    void clear();
+
+    /*  Systems  */
+    // World matrices and bounds of all the entities
+    void updateTransforms();
+
+    // Visibility of all the entities against the frustum of the view-projection matrix
+    void cull(const glm::mat4& viewProjection);
+
+    // Visible drawables sorted by program and model. Drawables with an impostor that are far enough from
+    // viewPos are left out of drawList and appended to impostorInstances[model] instead (position, scale).
+    void buildDrawList(const glm::vec3& viewPos, vector<DrawItem>& drawList,
+                       vector<vector<glm::vec4> >& impostorInstances) const;
+
+private:
+    struct Slot {
+        uint32_t dense;         // Index in the component tables while alive, next free slot otherwise
+        uint32_t generation;
+    };
+
+    uint32_t addModel(ModelEntry& entry, const void* program);
+
+    vector<Slot> slots;
+    vector<uint32_t> denseToSlot;
+    uint32_t freeSlot;
+};
@@ -0,0 +1,59 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+#include <program.h>
+
+
+// Compile time features of a shader, each one is a #define in the sources
+enum ShaderFeature {
+    SHADER_TEXTURED         = 1 << 0,   // TEXTURED: diffuse map
+    SHADER_HAS_SPECULAR_MAP = 1 << 1,   // HAS_SPECULAR_MAP: specular map (only with TEXTURED)
+    SHADER_NORMAL_MAP       = 1 << 2,   // NORMAL_MAP: tangent space normal map
+    SHADER_INSTANCED        = 1 << 3,   // INSTANCED: draw index is drawIndex + gl_InstanceID
+    SHADER_GOURAUD          = 1 << 4,   // GOURAUD: lit per vertex (QUALITY_GOURAUD vertex layout)
+    SHADER_UNLIT            = 1 << 5,   // UNLIT: no lighting (QUALITY_UNLIT vertex layout)
+    SHADER_GBUFFER          = 1 << 6,   // GBUFFER: writes the G-buffer of DeferredRenderer, full vertex layout
+    SHADER_CLUSTERED        = 1 << 7,   // CLUSTERED: lights from ClusteredLighting instead of the frame block
+    SHADER_SHADOWS          = 1 << 8,   // SHADOWS: the first frame light is shadowed by ShadowMap
+    SHADER_IMPOSTOR_CAPTURE = 1 << 9,   // IMPOSTOR_CAPTURE: unlit albedo, normal and depth for Impostor
+
+    SHADER_FEATURE_COUNT    = 10
+};
+
+
+// Variants of one shader, one per combination of features. A variant is compiled the first time it is
+// asked for and then kept, so picking one is an array lookup. Uniforms are per program: per frame values
+// must be set on every variant, see programs().
+class ShaderPermutations
+{
+public:
+    /*  Functions  */
+    ShaderPermutations(const GLchar* vertexShaderPath, const GLchar* fragmentShaderPath,
+                       GLuint numPointLights = 1);
+    ~ShaderPermutations();
+
+    ShaderPermutations(const ShaderPermutations&) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+    // The variant with exactly these features (ShaderFeature bits)
+    Program* get(uint32_t features);
+
+    // Variants compiled so far
+    inline const vector<Program*>& programs() const { return compiled; }
+
+    // The #define block of a variant
+    static string defines(uint32_t features, GLuint numPointLights);
+
+private:
+    string vertexShaderPath, fragmentShaderPath;
+    GLuint numPointLights;
+
+    Program* variants[1 << SHADER_FEATURE_COUNT];
+    vector<Program*> compiled;
+};
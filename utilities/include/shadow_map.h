@@ -0,0 +1,70 @@
+#pragma once
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <scene.h>
+#include <transform_system.h>
+
+
+// Texture units of the two cube maps - clear of the material textures and the other buffer textures.
+const GLuint SHADOW_STATIC_TEXTURE_UNIT = 6;
+const GLuint SHADOW_DYNAMIC_TEXTURE_UNIT = 7;
+
+
+// Cube shadow map of one point light, holding the distance to the light (over 'far') of the nearest caster.
+// Casters are the drawables that aren't lights. Two cube maps are kept, and the shaders take the nearest
+// of both:
+//  - static: ENTITY_STATIC casters. Kept between frames with the light position it was rendered from, which
+//    the shaders compare against, so it stays consistent while the light moves. It is re-rendered once the
+//    light is more than maxDrift away from that position, or after invalidateStatic(): the orbiting lamp
+//    costs a static render every maxDrift of its path instead of every frame, its static shadows lagging
+//    by at most that much.
+//  - dynamic: every other caster, re-rendered each frame from the current position - skipped when there
+//    are none.
+// Each render is a single layered pass (shaders/shadowDepth.gs) over the six faces.
+class ShadowMap
+{
+public:
+    /*  Functions  */
+    ShadowMap(GLuint size = 512, GLfloat far = 25.0f, GLfloat maxDrift = 0.1f);
+    ~ShadowMap();
+
+    ShadowMap(const ShadowMap&) = delete;
+    ShadowMap& operator=(const ShadowMap&) = delete;
+
+    // Brings both cube maps up to date for a light at lightPosition (world space).
+    // Expects the transforms of the frame to be uploaded (entity i is draw index i).
+    void update(const Scene& scene, const glm::vec3& lightPosition, const TransformSystem& transforms);
+
+    // The static casters changed (added, removed or moved), re-render all the static faces on the next update()
+    void invalidateStatic();
+
+    // Binds the cube maps and sets the shadow uniforms of a SHADOWS variant
+    void bind(const Program& program) const;
+
+    // Faces rendered by the last update(), static and dynamic
+    inline GLuint facesRendered() const { return rendered; }
+
+private:
+    GLuint size;
+    GLfloat far;
+    GLfloat maxDrift;
+
+    GLuint fbo;
+    GLuint staticCube, dynamicCube;
+    Program* depthProgram;
+
+    // Light position the static cube was rendered from, and whether it is valid at all
+    glm::vec3 staticPosition;
+    bool staticValid;
+    bool dynamicEmpty;
+
+    glm::vec3 lightPosition;
+    GLuint rendered;
+
+    /*  Functions    */
+    // Clears the cube and draws the casters (static ones or the others, none if !any) from lightPosition
+    void render(const Scene& scene, const TransformSystem& transforms, GLuint cube, bool staticCasters, bool any);
+};
@@ -0,0 +1,34 @@
+#pragma once
+// Std. Includes
+#include <cstddef>
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+#include <render_stats.h>
+
+
+// Replaces the contents of a buffer texture's storage with the same scheme as TransformSystem::upload():
+// the storage grows (and the texture is reattached, with the given format) only when needed, otherwise
+// the previous frame's storage is orphaned so we don't wait for draws still reading it.
+inline void
+uploadTextureBuffer(GLuint buffer, GLuint texture, GLenum format, const void* data, size_t bytes, size_t& capacity)
+{
+	if (bytes == 0) {
+		return;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	if (bytes > capacity) {
+		capacity = bytes;
+		glBufferData(GL_TEXTURE_BUFFER, capacity, data, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	else {
+		glBufferData(GL_TEXTURE_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	RenderStats::frame.bytesUploaded += bytes;
+}
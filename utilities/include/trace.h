@@ -0,0 +1,50 @@
+#pragma once
+// Std. Includes
+#include <string>
+#include <cstdint>
+using namespace std;
+
+
+// Events kept per thread - the oldest are overwritten once a thread has recorded more
+const size_t TRACE_EVENTS_PER_THREAD = 1 << 16;
+
+
+// A timed CPU scope, in nanoseconds since the start of the process
+struct TraceEvent {
+    const char* name;       // Must outlive the trace, string literals are
+    int64_t start;
+    int64_t duration;
+};
+
+
+// CPU scope timings of every thread. Each thread records into its own ring of events, so recording takes
+// no lock and never waits for the other threads, and write() dumps all of them at once in the Chrome
+// trace-event format (chrome://tracing, ui.perfetto.dev).
+class Trace
+{
+public:
+    /*  Functions  */
+    // Nanoseconds since the start of the process
+    static int64_t now();
+
+    static void record(const char* name, int64_t start, int64_t end);
+
+    // Shown as the thread's name in the trace
+    static void setThreadName(const string& name);
+
+    // The events of every thread (that recorded any) as JSON, false if the file can't be written
+    static bool write(const string& path);
+};
+
+
+// Records the enclosing block
+class TraceScope
+{
+public:
+    TraceScope(const char* name) :name(name), start(Trace::now()) {}
+    ~TraceScope() { Trace::record(this->name, this->start, Trace::now()); }
+
+private:
+    const char* name;
+    int64_t start;
+};
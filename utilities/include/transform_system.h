@@ -0,0 +1,49 @@
+#pragma once
+// Std. Includes
+#include <vector>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <scene.h>
+
+
+// Texels (RGBA32F) per draw in the transforms buffer: model (4), model-view (4), model-view-projection (4),
+// view space normal matrix (3 columns) and one of padding. Must match TRANSFORM_TEXELS in the shaders.
+const GLint TRANSFORM_TEXELS = 16;
+
+// Texture unit of the transforms buffer - kept clear of the units Mesh::draw binds material textures to.
+const GLuint TRANSFORM_TEXTURE_UNIT = 15;
+
+
+// Computes the per draw matrices of every entity once per frame (SSE where available) and uploads them
+// as one buffer texture. Shaders read them with texelFetch at drawIndex * TRANSFORM_TEXELS, so nothing
+// is inverted or multiplied per vertex, and a draw only has to set its index.
+class TransformSystem
+{
+public:
+    TransformSystem();
+    ~TransformSystem();
+
+    // Matrices of all the scene entities, entity i (dense index) gets draw index i.
+    // Expects Scene::updateTransforms() to have run, and a rigid view matrix (as Camera's).
+    void update(const Scene& scene, const glm::mat4& view, const glm::mat4& projection);
+
+    // Appends one draw that is not a scene entity, returns its draw index.
+    GLint push(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection);
+
+    // Sends everything given since the last update() to the GPU
+    void upload();
+
+    // Binds the buffer on TRANSFORM_TEXTURE_UNIT and points the program's 'transforms' sampler to it
+    void bind(Program& program) const;
+
+private:
+    vector<glm::vec4> staging;
+    GLsizei count;
+
+    GLuint buffer, texture;
+    size_t capacity;
+};
@@ -0,0 +1,44 @@
+#pragma once
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+
+#include <render_stats.h>
+
+
+// Buffer of a uniform block, T being its generated std140 struct (e.g. FrameBlock). The programs have the
+// block bound to 'binding' already (see Program::resolveInterface()), so uploading is all there is to do.
+template <typename T>
+class UniformBuffer
+{
+public:
+    UniformBuffer(GLuint binding)
+    :binding(binding)
+    {
+        glGenBuffers(1, &this->id);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    ~UniformBuffer()
+    {
+        glDeleteBuffers(1, &this->id);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    // Replaces the contents (orphaning the previous ones) and binds the buffer to its binding point
+    void upload(const T& data)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, this->id);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, this->binding, this->id);
+        RenderStats::frame.bytesUploaded += sizeof(T);
+    }
+
+private:
+    GLuint id;
+    GLuint binding;
+};
@@ -0,0 +1,82 @@
+#pragma once
+// Std. Includes
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+using namespace std;
+// GL Includes
+#include <GL/glew.h> // Contains all the necessery OpenGL includes
+#include <glm/glm.hpp>
+
+#include <program.h>
+#include <scene.h>
+#include <transform_system.h>
+#include <shader_permutations.h>
+
+
+// Bits of a visibility id given to the triangle, the rest is the draw (+ 1, 0 is the background).
+// Must match the shaders/visibility* shaders.
+const GLuint VISIBILITY_TRIANGLE_BITS = 19;
+const GLuint VISIBILITY_MAX_DRAWS = (1u << (32 - VISIBILITY_TRIANGLE_BITS)) - 1;
+
+// Texels (RGBA32F) per draw in the draw table: draw index + mesh slot + shininess, color, ambient,
+// diffuse, specular (the MaterialOverride of the entity)
+const GLint VISIBILITY_DRAW_TEXELS = 5;
+
+// Distinct meshes per frame, a mesh's depth in the resolve passes is (slot + 1) / VISIBILITY_MAX_MESHES
+const GLuint VISIBILITY_MAX_MESHES = 1024;
+
+// Texture units of the resolve passes - clear of the material textures and of TRANSFORM_TEXTURE_UNIT
+const GLuint VISIBILITY_IDS_TEXTURE_UNIT = 8;
+const GLuint VISIBILITY_DRAWS_TEXTURE_UNIT = 9;
+const GLuint VISIBILITY_VERTICES_TEXTURE_UNIT = 10;
+const GLuint VISIBILITY_INDICES_TEXTURE_UNIT = 11;
+
+
+// Visibility buffer rendering: the geometry pass only writes, per pixel, the draw and triangle that cover
+// it (positions only, 32 bits per pixel). Shading then happens once per pixel, whatever the overdraw:
+//  - a full screen pass turns each pixel's draw into its mesh's depth ((slot + 1) / VISIBILITY_MAX_MESHES)
+//  - one full screen pass per distinct mesh, at that depth with GL_EQUAL, so the depth test keeps only
+//    the mesh's pixels. It fetches the triangle's vertices, interpolates them and shades with the mesh's
+//    material.
+// Afterwards the scene depth is copied to the default framebuffer for the forward draws.
+class VisibilityRenderer
+{
+public:
+    /*  Functions  */
+    VisibilityRenderer(GLuint width, GLuint height, GLuint numPointLights = 1);
+    ~VisibilityRenderer();
+
+    VisibilityRenderer(const VisibilityRenderer&) = delete;
+    VisibilityRenderer& operator=(const VisibilityRenderer&) = delete;
+
+    // Draws and shades the items of the draw list whose model uses shader variants (the others are
+    // left to the forward pass), into the default framebuffer. The transforms must be uploaded.
+    void render(const Scene& scene, const vector<DrawItem>& drawList, const TransformSystem& transforms);
+
+    // Of the last render()
+    inline size_t drawCount() const { return draws.size(); }
+    inline size_t meshCount() const { return meshes.size(); }
+
+private:
+    GLuint width, height;
+    GLuint fbo;
+    GLuint ids, depth;
+    GLuint emptyVAO;
+    GLuint drawBuffer, drawTexture;
+    size_t drawCapacity;
+
+    Program* visibilityProgram;
+    Program* materialProgram;
+    ShaderPermutations* resolveShaders;
+
+    // Per frame: the draw table, and the distinct meshes (index = slot)
+    vector<glm::vec4> draws;
+    vector<const Mesh*> meshes;
+    unordered_map<const Mesh*, uint32_t> meshSlots;
+
+    /*  Functions    */
+    void drawVisibility(const Scene& scene, const vector<DrawItem>& drawList, const TransformSystem& transforms);
+    void uploadDraws();
+    void resolve(const TransformSystem& transforms);
+};
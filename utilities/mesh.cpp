@@ -1,7 +1,12 @@
 
 
 
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
 #include <mesh.h>
+#include <shader_interfaces.h>
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -16,15 +21,64 @@ printVec3(const string& name, const glm::vec3& vec)
 }
 
 
+// Float to half float, rounded. Tiny values flush to zero, huge ones become infinities.
+static GLushort
+toHalf(GLfloat value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0) {
+		return sign;
+	}
+	if (exponent >= 31) {
+		return sign | 0x7C00;
+	}
+	// Adding the rounded mantissa carries into the exponent when needed
+	return sign | (((uint32_t)exponent << 10) + ((mantissa + 0x1000) >> 13));
+}
+
+
+// Unit vector to GL_INT_2_10_10_10_REV (signed normalized, w left to 0)
+static GLuint
+packNormal(const glm::vec3& n)
+{
+	GLuint packed = 0;
+	for (int i = 0; i < 3; i++) {
+		GLfloat c = fmax(-1.0f, fmin(1.0f, n[i]));
+		packed |= ((GLuint)(GLint)roundf(c * 511.0f) & 0x3FF) << (10 * i);
+	}
+	return packed;
+}
+
+
 Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures,
-		   vector<glm::vec3>& colors, GLfloat shininess)
-:VAO(GL_INVALID_INDEX), VBO(GL_INVALID_INDEX), EBO(GL_INVALID_INDEX)
+		   vector<glm::vec3>& colors, GLfloat shininess, bool upload)
+:VAO(GL_INVALID_INDEX), gpuBytes(0), VBO(GL_INVALID_INDEX), EBO(GL_INVALID_INDEX),
+ positionVAO(0), positionVBO(0), vertexTexture(0), indexTexture(0)
 {
+	for (int tier = 0; tier < QUALITY_TIER_COUNT; tier++) {
+		this->layoutVAO[tier] = this->layoutVBO[tier] = 0;
+	}
+
+	this->vertices.swap(vertices);
+	this->indices.swap(indices);
+	this->vertexCount = this->vertices.size();
+	this->indexCount = this->indices.size();
+
+	this->boundsMin = glm::vec3(FLT_MAX);
+	this->boundsMax = glm::vec3(-FLT_MAX);
+	for (const Vertex& v : this->vertices) {
+		this->boundsMin = glm::min(this->boundsMin, v.position);
+		this->boundsMax = glm::max(this->boundsMax, v.position);
+	}
 
-	this->vertices = vertices;
-	this->indices = indices;
 	if (textures.size() > 0) {
-		this->textures = textures;
+		this->textures.swap(textures);
 		textured = true;
 	}
 	else {
@@ -37,60 +91,141 @@ Mesh::Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> text
 	this->specular   = colors[2];
 	this->shininess  = shininess;
 
+	// The shader variant this mesh needs, only what its material uses
+	this->shaderFeatures = 0;
+	for (const Texture& texture : this->textures) {
+		if (texture.type == "texture_diffuse") {
+			this->shaderFeatures |= SHADER_TEXTURED;
+		}
+		else if (texture.type == "texture_specular") {
+			this->shaderFeatures |= SHADER_HAS_SPECULAR_MAP;
+		}
+		else if (texture.type == "texture_normal") {
+			this->shaderFeatures |= SHADER_NORMAL_MAP;
+		}
+	}
+	if (!(this->shaderFeatures & SHADER_TEXTURED)) {
+		this->shaderFeatures &= ~SHADER_HAS_SPECULAR_MAP;
+	}
+
 	// Now that we have all the required data, set the vertex buffers and its attribute pointers.
-	this->setupMesh();
+	if (upload) {
+		this->setupMesh();
+	}
 }
 
 
 // Render the mesh
 void
-Mesh::draw(Program shader)
+Mesh::draw(const Program& shader, QualityTier tier) const
 {
-	shader.setVec3("material.ambient", ambient);
-	shader.setVec3("material.diffuse", diffuse);
-	shader.setVec3("material.specular", specular);
-	shader.setFloat("material.shininess", shininess);
+	this->bindMaterial(shader);
+
+	// Draw mesh
+	GLuint vao = this->VAO;
+	if (tier != QUALITY_FULL) {
+		vao = this->layoutVAO[tier] ? this->layoutVAO[tier] : this->setupLayout(tier);
+	}
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+	RenderStats::frame.vaoBinds++;
+	RenderStats::frame.draw(GL_TRIANGLES, this->indexCount);
+
+	this->unbindMaterial();
+}
+
+
+void
+Mesh::drawPositions() const
+{
+	if (!this->positionVAO) {
+		vector<Vertex> readback;
+		const vector<Vertex>& vertices = this->sourceVertices(readback);
+		vector<glm::vec3> stream(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			stream[i] = vertices[i].position;
+		}
+
+		glGenVertexArrays(1, &this->positionVAO);
+		glGenBuffers(1, &this->positionVBO);
+		glBindVertexArray(this->positionVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, stream.size() * sizeof(glm::vec3), stream.data(), GL_STATIC_DRAW);
+		RenderStats::frame.bytesUploaded += stream.size() * sizeof(glm::vec3);
+		this->gpuBytes += stream.size() * sizeof(glm::vec3);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+	}
+	else {
+		glBindVertexArray(this->positionVAO);
+	}
+
+	glDrawElements(GL_TRIANGLES, this->indexCount, GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+	RenderStats::frame.vaoBinds++;
+	RenderStats::frame.draw(GL_TRIANGLES, this->indexCount);
+}
+
+
+void
+Mesh::bindVertexData(GLuint vertexUnit, GLuint indexUnit) const
+{
+	if (!this->vertexTexture) {
+		// Views of the existing buffers, nothing is copied
+		glGenTextures(1, &this->vertexTexture);
+		glBindTexture(GL_TEXTURE_BUFFER, this->vertexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, this->VBO);
+		glGenTextures(1, &this->indexTexture);
+		glBindTexture(GL_TEXTURE_BUFFER, this->indexTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, this->EBO);
+	}
+
+	glActiveTexture(GL_TEXTURE0 + vertexUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, this->vertexTexture);
+	glActiveTexture(GL_TEXTURE0 + indexUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, this->indexTexture);
+	glActiveTexture(GL_TEXTURE0);
+	RenderStats::frame.textureBinds += 2;
+}
+
+
+void
+Mesh::bindMaterial(const Program& shader) const
+{
+	shader.set(Uniforms::material_ambient, ambient);
+	shader.set(Uniforms::material_diffuse, diffuse);
+	shader.set(Uniforms::material_specular, specular);
+	shader.set(Uniforms::material_shininess, shininess);
 
 	if (textured) {
 		// Bind appropriate textures
 		GLuint diffuseNr = 1;
 		GLuint specularNr = 1;
 		GLuint normalNr = 1;
-		GLuint heightNr = 1;
 		for(GLuint i = 0; i < this->textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i); // Active proper texture unit before binding
-			// Retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = this->textures[i].type;
-			if(name == "texture_diffuse")
-				ss << diffuseNr++; // Transfer GLuint to stream
-			else if(name == "texture_specular")
-				ss << specularNr++; // Transfer GLuint to stream
-			else if(name == "texture_normal")
-				ss << normalNr++; // Transfer GLuint to stream
-			else if(name == "texture_height")
-				ss << heightNr++; // Transfer GLuint to stream
-			number = ss.str();
-			// Now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.id, (name + number).c_str()), i);
+			// Point the sampler to the texture unit - the shaders only sample the first map of each kind
+			const string& name = this->textures[i].type;
+			if(name == "texture_diffuse" && diffuseNr++ == 1)
+				shader.set(Uniforms::material_texture_diffuse1, (GLint)i);
+			else if(name == "texture_specular" && specularNr++ == 1)
+				shader.set(Uniforms::material_texture_specular1, (GLint)i);
+			else if(name == "texture_normal" && normalNr++ == 1)
+				shader.set(Uniforms::material_texture_normal1, (GLint)i);
 			// And finally bind the texture
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
-
-		shader.setBool("material.textured", true);
-	}
-
-	else {
-		shader.setBool("material.textured", false);
+		RenderStats::frame.textureBinds += this->textures.size();
 	}
+}
 
-	// Draw mesh
-	glBindVertexArray(this->VAO);
-	glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-	glBindVertexArray(0);
 
+void
+Mesh::unbindMaterial() const
+{
 	// Always good practice to set everything back to defaults once configured.
 	for (GLuint i = 0; i < this->textures.size(); i++)
 	{
@@ -101,6 +236,83 @@ Mesh::draw(Program shader)
 
 
 
+void
+Mesh::dropCpuData(MeshCpuData keep)
+{
+	if (keep == MESH_CPU_KEEP) {
+		return;
+	}
+	if (keep == MESH_CPU_COLLISION && this->positions.empty()) {
+		this->positions.resize(this->vertices.size());
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			this->positions[i] = this->vertices[i].position;
+		}
+	}
+	vector<Vertex>().swap(this->vertices);
+	if (keep == MESH_CPU_DROP) {
+		vector<glm::vec3>().swap(this->positions);
+		vector<GLuint>().swap(this->indices);
+	}
+}
+
+
+size_t
+Mesh::cpuBytes() const
+{
+	return this->vertices.capacity() * sizeof(Vertex) +
+		   this->indices.capacity() * sizeof(GLuint) +
+		   this->positions.capacity() * sizeof(glm::vec3);
+}
+
+
+const vector<Vertex>&
+Mesh::sourceVertices(vector<Vertex>& readback) const
+{
+	if (!this->vertices.empty() || this->vertexCount == 0) {
+		return this->vertices;
+	}
+	readback.resize(this->vertexCount);
+	glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+	glGetBufferSubData(GL_ARRAY_BUFFER, 0, readback.size() * sizeof(Vertex), readback.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return readback;
+}
+
+
+
+void
+Mesh::release()
+{
+	if (this->VAO == GL_INVALID_INDEX) {
+		return;
+	}
+	glDeleteVertexArrays(1, &this->VAO);
+	glDeleteBuffers(1, &this->VBO);
+	glDeleteBuffers(1, &this->EBO);
+	this->VAO = this->VBO = this->EBO = GL_INVALID_INDEX;
+
+	for (int tier = 0; tier < QUALITY_TIER_COUNT; tier++) {
+		if (this->layoutVAO[tier]) {
+			glDeleteVertexArrays(1, &this->layoutVAO[tier]);
+			glDeleteBuffers(1, &this->layoutVBO[tier]);
+			this->layoutVAO[tier] = this->layoutVBO[tier] = 0;
+		}
+	}
+
+	if (this->positionVAO) {
+		glDeleteVertexArrays(1, &this->positionVAO);
+		glDeleteBuffers(1, &this->positionVBO);
+		this->positionVAO = this->positionVBO = 0;
+	}
+	if (this->vertexTexture) {
+		glDeleteTextures(1, &this->vertexTexture);
+		glDeleteTextures(1, &this->indexTexture);
+		this->vertexTexture = this->indexTexture = 0;
+	}
+}
+
+
+
 void
 Mesh::setupMesh()
 {
@@ -119,6 +331,7 @@ Mesh::setupMesh()
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+	this->gpuBytes += this->vertices.size() * sizeof(Vertex) + this->indices.size() * sizeof(GLuint);
 
 	// Set the vertex attribute pointers
 	// Vertex Positions
@@ -139,3 +352,60 @@ Mesh::setupMesh()
 
 	glBindVertexArray(0);
 }
+
+
+GLuint
+Mesh::setupLayout(QualityTier tier) const
+{
+	GLuint& vao = this->layoutVAO[tier];
+	GLuint& vbo = this->layoutVBO[tier];
+
+	vector<Vertex> readback;
+	const vector<Vertex>& vertices = this->sourceVertices(readback);
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	if (tier == QUALITY_GOURAUD) {
+		vector<GouraudVertex> packed(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const Vertex& v = vertices[i];
+			packed[i].position = v.position;
+			packed[i].normal = packNormal(v.normal);
+			packed[i].texCoords[0] = toHalf(v.texCoords.x);
+			packed[i].texCoords[1] = toHalf(v.texCoords.y);
+		}
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(GouraudVertex), packed.data(), GL_STATIC_DRAW);
+		this->gpuBytes += packed.size() * sizeof(GouraudVertex);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GouraudVertex), (GLvoid*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(GouraudVertex), (GLvoid*)offsetof(GouraudVertex, normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(GouraudVertex), (GLvoid*)offsetof(GouraudVertex, texCoords));
+	}
+	else {
+		vector<UnlitVertex> packed(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			const Vertex& v = vertices[i];
+			packed[i].position = v.position;
+			packed[i].texCoords[0] = toHalf(v.texCoords.x);
+			packed[i].texCoords[1] = toHalf(v.texCoords.y);
+		}
+		glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(UnlitVertex), packed.data(), GL_STATIC_DRAW);
+		this->gpuBytes += packed.size() * sizeof(UnlitVertex);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(UnlitVertex), (GLvoid*)0);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(UnlitVertex), (GLvoid*)offsetof(UnlitVertex, texCoords));
+	}
+
+	// Same indices as the full layout
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
+	glBindVertexArray(0);
+	return vao;
+}
@@ -0,0 +1,266 @@
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <iostream>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <metrics_server.h>
+
+
+// Set in 'middle' when it holds a snapshot the server hasn't taken yet
+static const uint32_t NEW_SNAPSHOT = 4;
+
+// How often the server thread checks for quitting, in milliseconds
+static const int POLL_INTERVAL = 200;
+
+
+
+static int
+listenOn(const string& address, string& unixPath)
+{
+	int fd;
+	if (address.compare(0, 5, "unix:") == 0) {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		unixPath = address.substr(5);
+		if (unixPath.empty() || unixPath.size() >= sizeof(addr.sun_path)) {
+			cout << "Metrics: bad socket path " << unixPath << endl;
+			return -1;
+		}
+		strcpy(addr.sun_path, unixPath.c_str());
+		unlink(unixPath.c_str());
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+			cout << "Metrics: could not bind " << address << endl;
+			if (fd >= 0) {
+				close(fd);
+			}
+			return -1;
+		}
+	}
+	else {
+		// host:port, the host defaulting to the loopback
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		size_t colon = address.rfind(':');
+		string host = (colon == string::npos) ? "127.0.0.1" : address.substr(0, colon);
+		int port = atoi(address.substr(colon == string::npos ? 0 : colon + 1).c_str());
+		if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+			cout << "Metrics: bad address " << address << endl;
+			return -1;
+		}
+		addr.sin_port = htons(port);
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		int yes = 1;
+		if (fd >= 0) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		}
+		if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+			cout << "Metrics: could not bind " << address << endl;
+			if (fd >= 0) {
+				close(fd);
+			}
+			return -1;
+		}
+	}
+
+	if (listen(fd, 4) < 0) {
+		cout << "Metrics: could not listen on " << address << endl;
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+static void
+writeAll(int fd, const string& data)
+{
+	size_t done = 0;
+	while (done < data.size()) {
+		ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return;
+		}
+		done += n;
+	}
+}
+
+
+// Label values are quoted: backslashes, quotes and newlines escaped
+static string
+labelValue(const char* value)
+{
+	string escaped;
+	for (const char* c = value; *c; c++) {
+		if (*c == '\\' || *c == '"') {
+			escaped += '\\';
+			escaped += *c;
+		}
+		else if (*c == '\n') {
+			escaped += "\\n";
+		}
+		else {
+			escaped += *c;
+		}
+	}
+	return escaped;
+}
+
+
+uint64_t
+residentBytes()
+{
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f) {
+		return 0;
+	}
+	unsigned long size = 0, resident = 0;
+	int read = fscanf(f, "%lu %lu", &size, &resident);
+	fclose(f);
+	return (read == 2) ? (uint64_t)resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+
+uint64_t
+peakResidentBytes()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	// In KiB on Linux
+	return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+
+
+MetricsServer::MetricsServer(const string& address)
+:back(0), middle(1), front(2), published(false), listener(-1), quit(false)
+{
+	memset(this->buffers, 0, sizeof(this->buffers));
+
+	this->listener = listenOn(address, this->unixPath);
+	if (this->listener >= 0) {
+		cout << "Metrics served on " << address << endl;
+		this->server = thread(&MetricsServer::serve, this);
+	}
+}
+
+
+MetricsServer::~MetricsServer()
+{
+	if (this->server.joinable()) {
+		this->quit = true;
+		this->server.join();
+	}
+	if (this->listener >= 0) {
+		close(this->listener);
+	}
+	if (!this->unixPath.empty()) {
+		unlink(this->unixPath.c_str());
+	}
+}
+
+
+void
+MetricsServer::publish()
+{
+	this->back = this->middle.exchange(this->back | NEW_SNAPSHOT, memory_order_acq_rel) & ~NEW_SNAPSHOT;
+}
+
+
+void
+MetricsServer::serve()
+{
+	while (!this->quit) {
+		pollfd p;
+		p.fd = this->listener;
+		p.events = POLLIN;
+		if (poll(&p, 1, POLL_INTERVAL) <= 0) {
+			continue;
+		}
+
+		int client = accept(this->listener, nullptr, nullptr);
+		if (client < 0) {
+			continue;
+		}
+
+		// Any request gets the metrics, only wait (briefly) for it to arrive
+		char request[1024];
+		pollfd c;
+		c.fd = client;
+		c.events = POLLIN;
+		if (poll(&c, 1, POLL_INTERVAL) > 0) {
+			recv(client, request, sizeof(request), 0);
+		}
+
+		string body = this->render();
+		stringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+				 << "Content-Type: text/plain; version=0.0.4\r\n"
+				 << "Content-Length: " << body.size() << "\r\n"
+				 << "Connection: close\r\n\r\n"
+				 << body;
+		writeAll(client, response.str());
+		close(client);
+	}
+}
+
+
+string
+MetricsServer::render()
+{
+	// Take the last snapshot published, if any since the previous request
+	if (this->middle.load(memory_order_relaxed) & NEW_SNAPSHOT) {
+		this->front = this->middle.exchange(this->front, memory_order_acq_rel) & ~NEW_SNAPSHOT;
+		this->published = true;
+	}
+	const MetricsSnapshot& s = this->buffers[this->front];
+
+	stringstream out;
+	out << "# HELP viewer_frame_time_seconds Frame time over the recent frames.\n"
+		<< "# TYPE viewer_frame_time_seconds summary\n";
+	if (this->published) {
+		static const char* quantiles[4] = { "0.5", "0.9", "0.99", "1" };
+		for (int q = 0; q < 4; q++) {
+			out << "viewer_frame_time_seconds{quantile=\"" << quantiles[q] << "\"} " << s.frameQuantiles[q] << "\n";
+		}
+	}
+	out << "viewer_frame_time_seconds_sum " << s.frameSeconds << "\n"
+		<< "viewer_frame_time_seconds_count " << s.frames << "\n";
+
+	out << "# HELP viewer_models_loaded Model assets in memory.\n"
+		<< "# TYPE viewer_models_loaded gauge\n"
+		<< "viewer_models_loaded " << s.modelsLoaded << "\n"
+		<< "# HELP viewer_textures_loaded Textures of the model assets in memory.\n"
+		<< "# TYPE viewer_textures_loaded gauge\n"
+		<< "viewer_textures_loaded " << s.texturesLoaded << "\n";
+
+	out << "# HELP viewer_gpu_memory_bytes GPU memory of the model assets.\n"
+		<< "# TYPE viewer_gpu_memory_bytes gauge\n"
+		<< "viewer_gpu_memory_bytes{kind=\"mesh\"} " << s.meshGpuBytes << "\n"
+		<< "viewer_gpu_memory_bytes{kind=\"texture\"} " << s.textureGpuBytes << "\n"
+		<< "# HELP viewer_cpu_memory_bytes CPU memory of the process and of the model assets.\n"
+		<< "# TYPE viewer_cpu_memory_bytes gauge\n"
+		<< "viewer_cpu_memory_bytes{kind=\"resident\"} " << residentBytes() << "\n"
+		<< "viewer_cpu_memory_bytes{kind=\"mesh\"} " << s.meshCpuBytes << "\n";
+
+	out << "# HELP viewer_model_load_seconds Time taken to load each model asset.\n"
+		<< "# TYPE viewer_model_load_seconds gauge\n";
+	for (uint32_t i = 0; i < s.loadCount && i < METRICS_MAX_LOADS; i++) {
+		out << "viewer_model_load_seconds{model=\"" << labelValue(s.loads[i].model) << "\"} " << s.loads[i].seconds << "\n";
+	}
+	return out.str();
+}
@@ -1,49 +1,189 @@
 
 
 
+#include <cfloat>
+#include <iomanip>
+
 #include <model.h>
 #include <program.h>
+#include <trace.h>
+#include <hitch_detector.h>
+#include <metrics_server.h>
 
 //GLint TextureFromFile(const char* path, string directory, bool gamma = false);
 
 
+static double
+elapsedMs(int64_t start)
+{
+	return (Trace::now() - start) / 1e6;
+}
+
+
+
+ModelLoadReport::ModelLoadReport()
+:parseMs(0.0), postProcessMs(0.0), vertexMs(0.0), materialMs(0.0),
+ textureDecodeMs(0.0), textureUploadMs(0.0), meshUploadMs(0.0), totalMs(0.0),
+ meshes(0), vertices(0), triangles(0), assimpBytes(0), peakResident(0)
+{
+}
+
+
+string
+ModelLoadReport::summary() const
+{
+	stringstream ss;
+	ss << fixed << setprecision(1);
+	ss << this->path << ": " << this->totalMs << " ms - parse " << this->parseMs << ", post-process " << this->postProcessMs
+	   << ", vertices " << this->vertexMs << ", materials " << this->materialMs << ", texture decode " << this->textureDecodeMs
+	   << ", texture upload " << this->textureUploadMs << ", mesh upload " << this->meshUploadMs << "; "
+	   << this->meshes << " meshes, " << this->vertices << " vertices, " << this->triangles << " triangles, "
+	   << this->textures.size() << " textures; assimp scene " << this->assimpBytes / 1048576.0 << " MiB, peak RSS "
+	   << this->peakResident / 1048576.0 << " MiB";
+	return ss.str();
+}
+
+
+string
+ModelLoadReport::report() const
+{
+	stringstream ss;
+	ss << fixed << setprecision(1);
+	ss << this->summary() << endl;
+	for (const TextureLoad& texture : this->textures) {
+		ss << "  " << texture.path << ": " << texture.width << "x" << texture.height << ", " << texture.bitsPerPixel
+		   << " bpp, " << texture.bytes / 1024.0 << " KiB - decode " << texture.decodeMs << " ms, upload "
+		   << texture.uploadMs << " ms" << endl;
+	}
+	return ss.str();
+}
+
 
 
 
-Model::Model (const string& path, bool gamma)
-:gammaCorrection(gamma)
+
+Model::Model (const string& path, bool gamma, MeshCpuData cpuData, bool upload)
+:gammaCorrection(gamma),
+ boundsMin(glm::vec3(FLT_MAX)),
+ boundsMax(glm::vec3(-FLT_MAX)),
+ gpuUpload(upload)
 {
+	this->loadReport.path = path;
 	this->loadModel(path);
+	// Dropped data is read back from the GPU when needed, there must be one
+	for (Mesh& mesh : this->meshes) {
+		mesh.dropCpuData(upload ? cpuData : MESH_CPU_KEEP);
+	}
+}
+
+
+Model::~Model()
+{
+	HitchScope hitch(HITCH_GPU_RELEASE);
+	for (Mesh& mesh : this->meshes) {
+		mesh.release();
+	}
+	for (Texture& texture : this->textures_loaded) {
+		if (texture.id) {
+			glDeleteTextures(1, &texture.id);
+		}
+	}
 }
 
 
 void
-Model::draw(Program program)
+Model::draw(const Program& program) const
 {
 
-	for (Mesh m : this->meshes) {
+	for (const Mesh& m : this->meshes) {
 		m.draw(program);
 	}
 }
 
 
+size_t
+Model::meshBytes() const
+{
+	size_t bytes = 0;
+	for (const Mesh& mesh : this->meshes) {
+		bytes += mesh.gpuBytes;
+	}
+	return bytes;
+}
+
+
+size_t
+Model::textureBytes() const
+{
+	size_t bytes = 0;
+	for (const Texture& texture : this->textures_loaded) {
+		bytes += texture.bytes;
+	}
+	return bytes;
+}
+
+
+size_t
+Model::cpuBytes() const
+{
+	size_t bytes = 0;
+	for (const Mesh& mesh : this->meshes) {
+		bytes += mesh.cpuBytes();
+	}
+	return bytes;
+}
+
+
+string
+Model::memoryReport() const
+{
+	stringstream ss;
+	ss << fixed << setprecision(1);
+	for (size_t i = 0; i < this->meshes.size(); i++) {
+		const Mesh& mesh = this->meshes[i];
+		ss << "  mesh " << i << ": " << mesh.vertexCount << " vertices, " << mesh.indexCount / 3 << " triangles - cpu "
+		   << mesh.cpuBytes() / 1024.0 << " KiB, gpu " << mesh.gpuBytes / 1024.0 << " KiB" << endl;
+	}
+	for (const Texture& texture : this->textures_loaded) {
+		ss << "  texture " << texture.path.C_Str() << " (" << texture.type << "): gpu "
+		   << texture.bytes / 1024.0 << " KiB" << endl;
+	}
+	return ss.str();
+}
+
+
 void
 Model::loadModel(string path)
 {
-	// Read file via ASSIMP
+	TraceScope trace("Model::loadModel");
+	HitchScope hitch(HITCH_MODEL_LOAD);
+	int64_t start = Trace::now();
+	// Read file via ASSIMP, then post-process it (apart, to time them apart)
 	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+	const aiScene* scene = importer.ReadFile(path, 0);
+	this->loadReport.parseMs = elapsedMs(start);
+	if (scene) {
+		int64_t postProcess = Trace::now();
+		scene = importer.ApplyPostProcessing(aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+		this->loadReport.postProcessMs = elapsedMs(postProcess);
+	}
 	// Check for errors
 	if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 	{
 		cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 		return;
 	}
+	aiMemoryInfo memory;
+	importer.GetMemoryRequirements(memory);
+	this->loadReport.assimpBytes = memory.total;
+
 	// Retrieve the directory path of the filepath
 	this->directory = path.substr(0, path.find_last_of('/'));
 
 	// Process ASSIMP's root node recursively
 	this->processNode(scene->mRootNode, scene);
+	this->loadReport.totalMs = elapsedMs(start);
+	this->loadReport.peakResident = peakResidentBytes();
 }
 
 
@@ -51,6 +191,7 @@ Model::loadModel(string path)
 void
 Model::processNode(aiNode* node, const aiScene* scene)
 {
+	TraceScope trace("Model::processNode");
 	// Process each mesh located at the current node
 	for(GLuint i = 0; i < node->mNumMeshes; i++)
 	{
@@ -81,6 +222,8 @@ printVec3(const string& name, const glm::vec3& vec)
 Mesh
 Model::processMesh(aiMesh* mesh, const aiScene* scene)
 {
+	TraceScope trace("Model::processMesh");
+	int64_t start = Trace::now();
 	// Data to fill
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
@@ -100,6 +243,9 @@ Model::processMesh(aiMesh* mesh, const aiScene* scene)
 			vector.y = mesh->mVertices[i].y;
 			vector.z = mesh->mVertices[i].z;
 			vertex.position = vector;
+
+			this->boundsMin = glm::min(this->boundsMin, vector);
+			this->boundsMax = glm::max(this->boundsMax, vector);
 		}
 		// Normals
 		if (mesh->mNormals) {
@@ -146,8 +292,14 @@ Model::processMesh(aiMesh* mesh, const aiScene* scene)
 		for(GLuint j = 0; j < face.mNumIndices; j++)
 			indices.push_back(face.mIndices[j]);
 	}
-	cout << "HERE" << endl;
-	// Process materials
+	this->loadReport.vertexMs += elapsedMs(start);
+	this->loadReport.meshes++;
+	this->loadReport.vertices += vertices.size();
+	this->loadReport.triangles += indices.size() / 3;
+
+	// Process materials, the texture loads are timed by loadTexture()
+	start = Trace::now();
+	double textureMs = this->loadReport.textureDecodeMs + this->loadReport.textureUploadMs;
 	if(mesh->mMaterialIndex >= 0)
 	{
 
@@ -196,9 +348,14 @@ Model::processMesh(aiMesh* mesh, const aiScene* scene)
 				colors[2] = glm::vec3(c.r, c.g, c.b);
 				material->Get(AI_MATKEY_SHININESS, shininess);
 	}
-
-	// Return a mesh object created from the extracted mesh data
-	return Mesh(vertices, indices, textures, colors, shininess);
+	this->loadReport.materialMs += elapsedMs(start) -
+		(this->loadReport.textureDecodeMs + this->loadReport.textureUploadMs - textureMs);
+
+	// Return a mesh object created from the extracted mesh data (moved, the import peak holds one copy)
+	start = Trace::now();
+	Mesh result(move(vertices), move(indices), move(textures), colors, shininess, this->gpuUpload);
+	this->loadReport.meshUploadMs += elapsedMs(start);
+	return result;
 }
 
 
@@ -228,6 +385,8 @@ Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName
 			//texture.id = loadTextureFromFile(str.C_Str(), this->directory);
 			string path = this->directory + '/' + string(str.C_Str());
 			texture.id = loadTexture(path.c_str());
+			// RGBA8, without mipmaps with the default filters
+			texture.bytes = this->loadReport.textures.back().bytes;
 			texture.type = typeName;
 			texture.path = str;
 			textures.push_back(texture);
@@ -272,6 +431,9 @@ Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName
 // Method to load an image into a texture using the freeimageplus library. Returns the texture ID or dies trying.
 GLuint Model::loadTexture(const char* filename, GLenum minificationFilter, GLenum magnificationFilter)
 {
+    TraceScope trace("Model::loadTexture");
+    HitchScope hitch(HITCH_TEXTURE_UPLOAD);
+    int64_t start = Trace::now();
     // Get the filename as a pointer to a const char array to play nice with FreeImage
     //const char* filename = filenameString.c_str();
 
@@ -333,19 +495,38 @@ GLuint Model::loadTexture(const char* filename, GLenum minificationFilter, GLenu
     FIBITMAP* bitmap32;
     if (bitsPerPixel == 32)
     {
-        cout << "Source image has " << bitsPerPixel << " bits per pixel. Skipping conversion." << endl;
         bitmap32 = bitmap;
     }
     else
     {
-        cout << "Source image has " << bitsPerPixel << " bits per pixel. Converting to 32-bit colour." << endl;
         bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
     }
 
-    // Some basic image info - strip it out if you don't care
+    // Some basic image info, for the load report
     int imageWidth  = FreeImage_GetWidth(bitmap32);
     int imageHeight = FreeImage_GetHeight(bitmap32);
-    cout << "Image: " << filename << " is size: " << imageWidth << "x" << imageHeight << "." << endl;
+    TextureLoad load;
+    load.path = filename;
+    load.width = imageWidth;
+    load.height = imageHeight;
+    load.bitsPerPixel = bitsPerPixel;
+    load.bytes = (size_t)imageWidth * imageHeight * 4;
+    load.decodeMs = elapsedMs(start);
+
+    // Without upload (no GL context, see the constructor) the image is only decoded, for the report
+    if (!this->gpuUpload)
+    {
+        load.uploadMs = 0.0;
+        this->loadReport.textureDecodeMs += load.decodeMs;
+        this->loadReport.textures.push_back(load);
+        FreeImage_Unload(bitmap32);
+        if (bitsPerPixel != 32)
+        {
+            FreeImage_Unload(bitmap);
+        }
+        return 0;
+    }
+    int64_t uploadStart = Trace::now();
 
     // Get a pointer to the texture data as an array of unsigned bytes.
     // Note: At this point bitmap32 ALWAYS holds a 32-bit colour version of our image - so we get our data from that.
@@ -384,6 +565,10 @@ GLuint Model::loadTexture(const char* filename, GLenum minificationFilter, GLenu
     {
         glGenerateMipmap(GL_TEXTURE_2D);
     }
+    load.uploadMs = elapsedMs(uploadStart);
+    this->loadReport.textureDecodeMs += load.decodeMs;
+    this->loadReport.textureUploadMs += load.uploadMs;
+    this->loadReport.textures.push_back(load);
 
     while(true)
     {
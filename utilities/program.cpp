@@ -5,20 +5,113 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <cstdint>
+#include <sys/stat.h>
 #include <program.h>
+#include <trace.h>
+#include <hitch_detector.h>
+#include <shader_interfaces.h>
+
+
+std::string Program::binaryCacheDirectory = "shader_cache";
+bool Program::parallelCompile = false;
+GLuint Program::current = 0;
+
+
+
+// FNV-1a, continuing from 'hash'
+static uint64_t
+hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+static uint64_t
+hashString(const std::string& s, uint64_t hash)
+{
+	// Hash the size too, so ("ab", "c") and ("a", "bc") differ
+	uint64_t size = s.size();
+	hash = hashBytes(&size, sizeof(size), hash);
+	return hashBytes(s.data(), s.size(), hash);
+}
+
+
+static std::string
+glString(GLenum name)
+{
+	const GLubyte* s = glGetString(name);
+	return s ? std::string((const char*)s) : std::string();
+}
+
+
+// The #version directive must stay first, so the defines go on the line after it
+static std::string
+injectDefines(const std::string& source, const std::string& defines)
+{
+	if (defines.empty()) {
+		return source;
+	}
+
+	size_t version = source.find("#version");
+	if (version == std::string::npos) {
+		return defines + source;
+	}
+	size_t lineEnd = source.find('\n', version);
+	if (lineEnd == std::string::npos) {
+		return source + "\n" + defines;
+	}
+	return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
+
+
+static bool
+programBinarySupported()
+{
+	if (!GLEW_ARB_get_program_binary && !GLEW_VERSION_4_1) {
+		return false;
+	}
+
+	// Some drivers (llvmpipe among them in older versions) expose the API but no format
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
 
 
 Program::Program (const GLchar* vertexShaderPath,
 		const GLchar* fragmentShaderPath,
-		const GLchar* geometryShaderPath)
+		const GLchar* geometryShaderPath,
+		const std::string& defines)
+:locations(UNIFORM_COUNT, -1), pending(false)
 {
+	TraceScope trace("Program compile");
+	HitchScope hitch(HITCH_SHADER_COMPILE);
+	this->shaders[0] = this->shaders[1] = this->shaders[2] = GL_INVALID_INDEX;
+
 	std::string vertexShaderCode, fragmentShaderCode, geometryShaderCode;
-	GLuint vertexShaderH, fragmentShaderH, geometryShaderH;
 
-	vertexShaderCode = readFile(vertexShaderPath);
-	fragmentShaderCode = readFile(fragmentShaderPath);
+	vertexShaderCode = injectDefines(readFile(vertexShaderPath), defines);
+	fragmentShaderCode = injectDefines(readFile(fragmentShaderPath), defines);
 	if (geometryShaderPath) {
-		geometryShaderCode = readFile(geometryShaderPath);
+		geometryShaderCode = injectDefines(readFile(geometryShaderPath), defines);
+	}
+
+	// Try the binary of a previous launch first - it skips both compilation and linking
+	std::string cachePath;
+	if (!binaryCacheDirectory.empty() && programBinarySupported()) {
+		cachePath = binaryCachePath(vertexShaderCode, fragmentShaderCode, geometryShaderCode);
+		if (loadBinary(cachePath)) {
+			resolveInterface();
+			return;
+		}
 	}
 
 	const GLchar* vShaderCode = vertexShaderCode.c_str();
@@ -26,24 +119,97 @@ Program::Program (const GLchar* vertexShaderPath,
 	const GLchar* gShaderCode = (geometryShaderPath) ? geometryShaderCode.c_str() : nullptr;
 
 
-	// Compile shaders
-	GLuint vertex, fragment, geometry = GL_INVALID_INDEX;
-	vertex = compileShader(GL_VERTEX_SHADER, vShaderCode);
-	fragment = compileShader(GL_FRAGMENT_SHADER, fShaderCode);
+	// Compile shaders. Nothing below waits for the driver: the status is only checked by finish(),
+	// so the compilation runs while the caller goes on (e.g. loading models).
+	this->shaders[0] = compileShader(GL_VERTEX_SHADER, vShaderCode);
+	this->shaders[1] = compileShader(GL_FRAGMENT_SHADER, fShaderCode);
 	if (gShaderCode) {
-		geometry = compileShader(GL_GEOMETRY_SHADER, gShaderCode);
+		this->shaders[2] = compileShader(GL_GEOMETRY_SHADER, gShaderCode);
 	}
 
 	// Link Shaders
 	this->id = glCreateProgram();
-	linkShaders(vertex, fragment, geometry);
+	if (!cachePath.empty()) {
+		glProgramParameteri(this->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	linkShaders(this->shaders[0], this->shaders[1], this->shaders[2]);
+
+	this->cachePath = cachePath;
+	this->pending = true;
+}
+
+
+void
+Program::enableParallelCompile()
+{
+	// 0xFFFFFFFF lets the driver pick the number of compiler threads
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+	else if (GLEW_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		parallelCompile = true;
+	}
+}
+
+
+bool
+Program::isReady() const
+{
+	if (!this->pending) {
+		return true;
+	}
+	if (!parallelCompile) {
+		// No way to ask without waiting
+		return false;
+	}
+
+	GLint done = GL_FALSE;
+	glGetProgramiv(this->id, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+
+void
+Program::finish()
+{
+	if (!this->pending) {
+		return;
+	}
+	this->pending = false;
+	TraceScope trace("Program::finish");
+	HitchScope hitch(HITCH_SHADER_COMPILE);
 
+	// Blocks until the driver is done with this program
+	GLint success;
+	glGetProgramiv(this->id, GL_LINK_STATUS, &success);
+	if (!success) {
+		for (int i = 0; i < 3; i++) {
+			if (this->shaders[i] != GL_INVALID_INDEX) {
+				reportShader(this->shaders[i]);
+			}
+		}
+
+		GLchar infoLog[1024];
+		glGetProgramInfoLog(this->id, 1024, NULL, infoLog);
+		std::cout << "Error while Linking: " << std::endl;
+		std::cout << infoLog << std::endl;
+	}
+	else {
+		resolveInterface();
+		if (!this->cachePath.empty()) {
+			saveBinary(this->cachePath);
+		}
+	}
 
 	// Delete the shaders as they're linked into our program now and no longer necessery
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
-	if (geometry != GL_INVALID_INDEX) {
-		glDeleteShader(geometry);
+	for (int i = 0; i < 3; i++) {
+		if (this->shaders[i] != GL_INVALID_INDEX) {
+			glDetachShader(this->id, this->shaders[i]);
+			glDeleteShader(this->shaders[i]);
+			this->shaders[i] = GL_INVALID_INDEX;
+		}
 	}
 }
 
@@ -82,13 +248,115 @@ Program::readFile(const GLchar* fileName)
 }
 
 
+std::string
+Program::binaryCachePath(const std::string& vertexCode, const std::string& fragmentCode,
+						 const std::string& geometryCode) const
+{
+	// The defines are already part of the sources. A driver update changes the version string,
+	// which is enough to stop handing it binaries it may no longer accept.
+	uint64_t hash = hashBytes(nullptr, 0);
+	hash = hashString(vertexCode, hash);
+	hash = hashString(fragmentCode, hash);
+	hash = hashString(geometryCode, hash);
+	hash = hashString(glString(GL_VENDOR), hash);
+	hash = hashString(glString(GL_RENDERER), hash);
+	hash = hashString(glString(GL_VERSION), hash);
+
+	std::stringstream path;
+	path << binaryCacheDirectory << "/" << std::hex << hash << ".bin";
+	return path.str();
+}
+
+
+bool
+Program::loadBinary(const std::string& path)
+{
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	// File: binary format (GLenum), then the binary itself
+	GLenum format;
+	file.read((char*)&format, sizeof(format));
+	if (file.gcount() != (std::streamsize)sizeof(format)) {
+		return false;
+	}
+
+	file.seekg(0, std::ios::end);
+	std::streamoff size = (std::streamoff)file.tellg() - (std::streamoff)sizeof(format);
+	if (!file || size <= 0) {
+		return false;
+	}
+	std::vector<char> binary(size);
+	file.seekg(sizeof(format), std::ios::beg);
+	file.read(binary.data(), size);
+	if (file.gcount() != size) {
+		return false;
+	}
+
+	this->id = glCreateProgram();
+	glProgramBinary(this->id, format, binary.data(), binary.size());
+
+	// The driver may reject binaries of another build of itself, compile from source then
+	GLint success;
+	glGetProgramiv(this->id, GL_LINK_STATUS, &success);
+	if (!success) {
+		glDeleteProgram(this->id);
+		this->id = 0;
+		return false;
+	}
+	return true;
+}
+
+
+void
+Program::saveBinary(const std::string& path) const
+{
+	GLint success, length = 0;
+	glGetProgramiv(this->id, GL_LINK_STATUS, &success);
+	glGetProgramiv(this->id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (!success || length <= 0) {
+		return;
+	}
+
+	GLenum format;
+	std::vector<char> binary(length);
+	glGetProgramBinary(this->id, length, nullptr, &format, binary.data());
+
+	mkdir(binaryCacheDirectory.c_str(), 0755);
+	std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "Unable to write program binary: " << path << std::endl;
+		return;
+	}
+	file.write((const char*)&format, sizeof(format));
+	file.write(binary.data(), binary.size());
+}
+
+
+void
+Program::resolveInterface()
+{
+	for (GLuint i = 0; i < UNIFORM_COUNT; i++) {
+		this->locations[i] = glGetUniformLocation(this->id, UNIFORM_NAMES[i]);
+	}
+
+	// Block binding points are fixed, so one buffer per block serves every program
+	for (GLuint i = 0; i < UNIFORM_BLOCK_COUNT; i++) {
+		GLuint block = glGetUniformBlockIndex(this->id, UNIFORM_BLOCK_NAMES[i]);
+		if (block != GL_INVALID_INDEX) {
+			glUniformBlockBinding(this->id, block, i);
+		}
+	}
+}
+
+
 GLuint
 Program::compileShader(GLuint shaderType, const GLchar* shaderCode)
 {
 
 	GLuint shaderHandler;
-	GLint success;
-	GLchar infoLog[512];
 
 
 	shaderHandler = glCreateShader(shaderType);
@@ -96,10 +364,23 @@ Program::compileShader(GLuint shaderType, const GLchar* shaderCode)
 	glCompileShader(shaderHandler);
 
 
+	return shaderHandler;
+}
+
+
+void
+Program::reportShader(GLuint shaderHandler)
+{
+
+	GLint success, shaderType;
+	GLchar infoLog[512];
+
+
 	glGetShaderiv(shaderHandler, GL_COMPILE_STATUS, &success);
 	if(!success)
 	{
 		glGetShaderInfoLog(shaderHandler, 512, NULL, infoLog);
+		glGetShaderiv(shaderHandler, GL_SHADER_TYPE, &shaderType);
 
 		// Ternary if to identify the currect type of vertex.
 		std::string name = (shaderType == GL_VERTEX_SHADER) ? "Vertex Shader" :
@@ -109,9 +390,6 @@ Program::compileShader(GLuint shaderType, const GLchar* shaderCode)
 		std::cout << "Error while compiling " << name << ":" << std::endl;
 		std::cout << infoLog << std::endl;
 	}
-
-
-	return shaderHandler;
 }
 
 
@@ -119,27 +397,15 @@ void
 Program::linkShaders(GLuint vertexShaderH, GLuint fragmentShaderH, GLuint geometryShaderH)
 {
 
-
-	GLint success;
-	GLchar infoLog[1024];
-
 	glAttachShader(this->id, vertexShaderH);
 	glAttachShader(this->id, fragmentShaderH);
 	if (geometryShaderH != GL_INVALID_INDEX) {
 		glAttachShader(this->id, geometryShaderH);
 	}
 
-	// Link shaders to the program
+	// Link shaders to the program, the status is checked by finish()
 	glLinkProgram(this->id);
 
-	glGetProgramiv(this->id, GL_LINK_STATUS, &success);
-	if(!success)
-	{
-		glGetProgramInfoLog(this->id, 1024, NULL, infoLog);
-		std::cout << "Error while Linking: " << std::endl;
-		std::cout << infoLog << std::endl;
-	}
-
 }
 
 
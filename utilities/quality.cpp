@@ -0,0 +1,101 @@
+#include <iostream>
+
+#include <quality.h>
+#include <shader_permutations.h>
+using namespace std;
+
+
+// Frames to let the smoothed frame time settle after a switch
+static const GLuint SETTLE_FRAMES = 30;
+static const GLuint MIN_UPGRADE_COOLDOWN = 120;
+static const GLuint MAX_UPGRADE_COOLDOWN = 3600;
+
+
+
+const char*
+tierName(QualityTier tier)
+{
+	switch (tier) {
+	case QUALITY_FULL:		return "full (per pixel)";
+	case QUALITY_GOURAUD:	return "gouraud (per vertex)";
+	case QUALITY_UNLIT:		return "unlit";
+	default:				return "unknown";
+	}
+}
+
+
+uint32_t
+tierShaderFeatures(QualityTier tier, uint32_t meshFeatures)
+{
+	switch (tier) {
+	case QUALITY_GOURAUD:
+		// Only the diffuse map is sampled per fragment
+		return (meshFeatures & (SHADER_TEXTURED | SHADER_INSTANCED)) | SHADER_GOURAUD;
+	case QUALITY_UNLIT:
+		return (meshFeatures & (SHADER_TEXTURED | SHADER_INSTANCED)) | SHADER_UNLIT;
+	default:
+		return meshFeatures;
+	}
+}
+
+
+
+QualityController::QualityController(GLfloat targetFrameTime)
+:tier(QUALITY_FULL), automatic(false), targetFrameTime(targetFrameTime),
+ smoothedFrameTime(0.0f), framesSinceSwitch(0), upgradeCooldown(MIN_UPGRADE_COOLDOWN), upgraded(false)
+{
+}
+
+
+void
+QualityController::update(GLfloat frameTime)
+{
+	this->framesSinceSwitch++;
+	// Exponential moving average, a single slow frame (loading, a hitch) should not switch tiers
+	this->smoothedFrameTime = (this->smoothedFrameTime == 0.0f) ? frameTime :
+							  this->smoothedFrameTime * 0.9f + frameTime * 0.1f;
+
+	if (!this->automatic || this->framesSinceSwitch < SETTLE_FRAMES) {
+		return;
+	}
+
+	if (this->smoothedFrameTime > this->targetFrameTime * 1.1f && this->tier + 1 < QUALITY_TIER_COUNT) {
+		// Stepping down right after an upgrade means the upgrade didn't fit: wait longer before the next one
+		if (this->upgraded && this->framesSinceSwitch < this->upgradeCooldown) {
+			this->upgradeCooldown = min(this->upgradeCooldown * 2, MAX_UPGRADE_COOLDOWN);
+		}
+		this->switchTo((QualityTier)(this->tier + 1));
+	}
+	else if (this->smoothedFrameTime < this->targetFrameTime * 0.5f && this->tier > QUALITY_FULL &&
+			 this->framesSinceSwitch >= this->upgradeCooldown) {
+		this->switchTo((QualityTier)(this->tier - 1));
+		this->upgraded = true;
+	}
+}
+
+
+void
+QualityController::setTier(QualityTier tier)
+{
+	this->automatic = false;
+	this->switchTo(tier);
+}
+
+
+void
+QualityController::nextTier()
+{
+	this->setTier((QualityTier)((this->tier + 1) % QUALITY_TIER_COUNT));
+}
+
+
+void
+QualityController::switchTo(QualityTier tier)
+{
+	if (tier != this->tier) {
+		cout << "Shading quality: " << tierName(tier) << endl;
+	}
+	this->tier = tier;
+	this->framesSinceSwitch = 0;
+	this->upgraded = false;
+}
@@ -0,0 +1,46 @@
+#include <sstream>
+
+#include <render_stats.h>
+
+
+RenderStats RenderStats::frame;
+RenderStats RenderStats::lastFrame;
+
+
+
+void
+RenderStats::reset()
+{
+	this->drawCalls = 0;
+	this->triangles = 0;
+	this->vertices = 0;
+	this->programSwitches = 0;
+	this->vaoBinds = 0;
+	this->textureBinds = 0;
+	this->uniformUploads = 0;
+	this->bytesUploaded = 0;
+}
+
+
+string
+RenderStats::summary() const
+{
+	ostringstream out;
+	out << this->drawCalls << " draws, "
+		<< this->triangles << " triangles, "
+		<< this->vertices << " vertices, "
+		<< this->programSwitches << " program switches, "
+		<< this->vaoBinds << " VAO binds, "
+		<< this->textureBinds << " texture binds, "
+		<< this->uniformUploads << " uniforms, "
+		<< this->bytesUploaded / 1024 << " KiB uploaded";
+	return out.str();
+}
+
+
+void
+RenderStats::endFrame()
+{
+	lastFrame = frame;
+	frame.reset();
+}
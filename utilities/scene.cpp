@@ -0,0 +1,282 @@
+#include <cmath>
+#include <algorithm>
+
+#include <scene.h>
+#include <frustum.h>
+
+
+
+Scene::Scene()
+:freeSlot(UINT32_MAX)
+{
+}
+
+
+EntityHandle
+Scene::create(uint32_t flags)
+{
+	// Reuse a free slot if there is one
+	uint32_t slot;
+	if (this->freeSlot != UINT32_MAX) {
+		slot = this->freeSlot;
+		this->freeSlot = this->slots[slot].dense;
+	}
+	else {
+		slot = this->slots.size();
+		Slot s;
+		s.generation = 0;
+		this->slots.push_back(s);
+	}
+
+	uint32_t dense = this->positions.size();
+	this->slots[slot].dense = dense;
+	this->denseToSlot.push_back(slot);
+
+	this->positions.push_back(glm::vec3(0.0f));
+	this->rotations.push_back(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+	this->scales.push_back(glm::vec3(1.0f));
+	this->worldMatrices.push_back(glm::mat4());
+	this->localBounds.push_back(glm::vec4(0.0f));
+	this->worldBounds.push_back(glm::vec4(0.0f));
+	this->models.push_back(UINT32_MAX);
+	this->materials.push_back(MaterialOverride());
+	this->lights.push_back(LightParams());
+	this->flags.push_back(flags);
+	this->visible.push_back(0);
+
+	EntityHandle handle;
+	handle.index = slot;
+	handle.generation = this->slots[slot].generation;
+	return handle;
+}
+
+
+void
+Scene::destroy(EntityHandle handle)
+{
+	if (!this->alive(handle)) {
+		return;
+	}
+
+	// Move the last entity into the hole, so the tables stay packed
+	uint32_t dense = this->slots[handle.index].dense;
+	uint32_t last = this->positions.size() - 1;
+
+	this->positions[dense] = this->positions[last];
+	this->rotations[dense] = this->rotations[last];
+	this->scales[dense] = this->scales[last];
+	this->worldMatrices[dense] = this->worldMatrices[last];
+	this->localBounds[dense] = this->localBounds[last];
+	this->worldBounds[dense] = this->worldBounds[last];
+	this->models[dense] = this->models[last];
+	this->materials[dense] = this->materials[last];
+	this->lights[dense] = this->lights[last];
+	this->flags[dense] = this->flags[last];
+	this->visible[dense] = this->visible[last];
+	this->denseToSlot[dense] = this->denseToSlot[last];
+	this->slots[this->denseToSlot[dense]].dense = dense;
+
+	this->positions.pop_back();
+	this->rotations.pop_back();
+	this->scales.pop_back();
+	this->worldMatrices.pop_back();
+	this->localBounds.pop_back();
+	this->worldBounds.pop_back();
+	this->models.pop_back();
+	this->materials.pop_back();
+	this->lights.pop_back();
+	this->flags.pop_back();
+	this->visible.pop_back();
+	this->denseToSlot.pop_back();
+
+	// Invalidate the handle and put the slot on the free list
+	this->slots[handle.index].generation++;
+	this->slots[handle.index].dense = this->freeSlot;
+	this->freeSlot = handle.index;
+}
+
+
+bool
+Scene::alive(EntityHandle handle) const
+{
+	return handle.index < this->slots.size() &&
+		   this->slots[handle.index].generation == handle.generation;
+}
+
+
+uint32_t
+Scene::addModel(const ModelAssetRef& model, Program* program, Impostor* impostor)
+{
+	ModelEntry entry;
+	entry.model = model;
+	entry.program = program;
+	entry.shaders = nullptr;
+	entry.impostor = impostor;
+	return this->addModel(entry, program);
+}
+
+
+uint32_t
+Scene::addModel(const ModelAssetRef& model, ShaderPermutations* shaders, Impostor* impostor)
+{
+	ModelEntry entry;
+	entry.model = model;
+	entry.program = nullptr;
+	entry.shaders = shaders;
+	entry.impostor = impostor;
+	return this->addModel(entry, shaders);
+}
+
+
+uint32_t
+Scene::addModel(ModelEntry& entry, const void* program)
+{
+	vector<const void*>::iterator it = find(this->programTable.begin(), this->programTable.end(), program);
+	entry.programIndex = it - this->programTable.begin();
+	if (it == this->programTable.end()) {
+		this->programTable.push_back(program);
+	}
+
+	const ModelAssetRef& model = entry.model;
+	this->modelTable.push_back(entry);
+	this->modelIndices[model.get()] = this->modelTable.size() - 1;
+	return this->modelTable.size() - 1;
+}
+
+
+void
+Scene::setModel(EntityHandle handle, uint32_t model)
+{
+	uint32_t i = this->indexOf(handle);
+	const ModelAsset* m = this->modelTable[model].model.get();
+
+	this->models[i] = model;
+	this->flags[i] |= ENTITY_DRAWABLE;
+	this->localBounds[i] = glm::vec4((m->boundsMin + m->boundsMax) * 0.5f,
+									 glm::length(m->boundsMax - m->boundsMin) * 0.5f);
+}
+
+
+EntityHandle
+Scene::spawn(const ModelInstance& instance)
+{
+	unordered_map<const ModelAsset*, uint32_t>::const_iterator it = this->modelIndices.find(instance.asset.get());
+	if (it == this->modelIndices.end()) {
+		cout << "Scene::spawn - model asset was not added to the scene." << endl;
+		return EntityHandle();
+	}
+
+	EntityHandle handle = this->create(instance.flags);
+	this->setModel(handle, it->second);
+
+	uint32_t i = this->indexOf(handle);
+	this->positions[i] = instance.position;
+	this->rotations[i] = instance.rotation;
+	this->scales[i] = instance.scale;
+	this->materials[i] = instance.material;
+	return handle;
+}
+
+
+void
+Scene::clear()
+{
+	this->positions.clear();
+	this->rotations.clear();
+	this->scales.clear();
+	this->worldMatrices.clear();
+	this->localBounds.clear();
+	this->worldBounds.clear();
+	this->models.clear();
+	this->materials.clear();
+	this->lights.clear();
+	this->flags.clear();
+	this->visible.clear();
+	this->denseToSlot.clear();
+
+	// Keep the slots (bumping their generation) so handles given out so far stay invalid
+	this->freeSlot = UINT32_MAX;
+	for (uint32_t slot = 0; slot < this->slots.size(); slot++) {
+		this->slots[slot].generation++;
+		this->slots[slot].dense = this->freeSlot;
+		this->freeSlot = slot;
+	}
+
+	this->modelTable.clear();
+	this->programTable.clear();
+	this->modelIndices.clear();
+}
+
+
+void
+Scene::updateTransforms()
+{
+	size_t count = this->size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::vec4& q = this->rotations[i];
+		const glm::vec3& s = this->scales[i];
+
+		// Rotation matrix of the quaternion, scaled, and translated
+		GLfloat xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		GLfloat xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		GLfloat wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+		glm::mat4& m = this->worldMatrices[i];
+		m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+		m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+		m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+		m[3] = glm::vec4(this->positions[i], 1.0f);
+
+		const glm::vec4& b = this->localBounds[i];
+		GLfloat maxScale = max(max(fabs(s.x), fabs(s.y)), fabs(s.z));
+		this->worldBounds[i] = glm::vec4(glm::vec3(m * glm::vec4(b.x, b.y, b.z, 1.0f)), b.w * maxScale);
+	}
+}
+
+
+void
+Scene::cull(const glm::mat4& viewProjection)
+{
+	glm::vec4 planes[6];
+	extractFrustumPlanes(viewProjection, planes);
+
+	size_t count = this->size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::vec4& b = this->worldBounds[i];
+		this->visible[i] = sphereInFrustum(planes, glm::vec3(b), b.w) ? 1 : 0;
+	}
+}
+
+
+void
+Scene::buildDrawList(const glm::vec3& viewPos, vector<DrawItem>& drawList,
+					 vector<vector<glm::vec4> >& impostorInstances) const
+{
+	drawList.clear();
+	impostorInstances.resize(this->modelTable.size());
+	for (vector<glm::vec4>& instances : impostorInstances) {
+		instances.clear();
+	}
+
+	size_t count = this->size();
+	for (size_t i = 0; i < count; i++) {
+		if (!this->visible[i] || !(this->flags[i] & ENTITY_DRAWABLE)) {
+			continue;
+		}
+
+		uint32_t model = this->models[i];
+		const ModelEntry& entry = this->modelTable[model];
+		// Impostors only support a uniform scale and no rotation, see Impostor::draw()
+		if (entry.impostor && entry.impostor->useImpostor(this->positions[i], viewPos)) {
+			impostorInstances[model].push_back(glm::vec4(this->positions[i], this->scales[i].x));
+			continue;
+		}
+
+		DrawItem item;
+		item.key = (entry.programIndex << 16) | model;
+		item.index = i;
+		drawList.push_back(item);
+	}
+
+	sort(drawList.begin(), drawList.end());
+}
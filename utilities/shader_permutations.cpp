@@ -0,0 +1,84 @@
+#include <sstream>
+
+#include <shader_permutations.h>
+#include <clustered_lighting.h>
+
+
+
+ShaderPermutations::ShaderPermutations(const GLchar* vertexShaderPath, const GLchar* fragmentShaderPath,
+									   GLuint numPointLights)
+:vertexShaderPath(vertexShaderPath), fragmentShaderPath(fragmentShaderPath),
+ numPointLights(numPointLights)
+{
+	for (Program*& variant : this->variants) {
+		variant = nullptr;
+	}
+}
+
+
+ShaderPermutations::~ShaderPermutations()
+{
+	for (Program* program : this->compiled) {
+		delete program;
+	}
+}
+
+
+Program*
+ShaderPermutations::get(uint32_t features)
+{
+	features &= (1 << SHADER_FEATURE_COUNT) - 1;
+
+	Program*& variant = this->variants[features];
+	if (!variant) {
+		variant = new Program(this->vertexShaderPath.c_str(), this->fragmentShaderPath.c_str(), nullptr,
+							  defines(features, this->numPointLights));
+		this->compiled.push_back(variant);
+	}
+	return variant;
+}
+
+
+string
+ShaderPermutations::defines(uint32_t features, GLuint numPointLights)
+{
+	stringstream ss;
+	if (features & SHADER_TEXTURED) {
+		ss << "#define TEXTURED\n";
+		// A specular map without a diffuse one is treated as untextured
+		if (features & SHADER_HAS_SPECULAR_MAP) {
+			ss << "#define HAS_SPECULAR_MAP\n";
+		}
+	}
+	if (features & SHADER_NORMAL_MAP) {
+		ss << "#define NORMAL_MAP\n";
+	}
+	if (features & SHADER_INSTANCED) {
+		ss << "#define INSTANCED\n";
+	}
+	if (features & SHADER_SHADOWS) {
+		ss << "#define SHADOWS\n";
+	}
+	if (features & SHADER_GBUFFER) {
+		// Lighting is done by the light pass, so the per tier variants don't apply
+		ss << "#define GBUFFER\n";
+	}
+	else if (features & SHADER_IMPOSTOR_CAPTURE) {
+		// Same, the impostor program lights the capture
+		ss << "#define IMPOSTOR_CAPTURE\n";
+	}
+	else if (features & SHADER_UNLIT) {
+		ss << "#define UNLIT\n";
+	}
+	else if (features & SHADER_GOURAUD) {
+		ss << "#define GOURAUD\n";
+	}
+	else if (features & SHADER_CLUSTERED) {
+		ss << "#define CLUSTERED\n";
+		ss << "#define CLUSTER_GRID_X " << CLUSTER_GRID_X << "\n";
+		ss << "#define CLUSTER_GRID_Y " << CLUSTER_GRID_Y << "\n";
+		ss << "#define CLUSTER_GRID_Z " << CLUSTER_GRID_Z << "\n";
+	}
+	ss << "#define NUM_POINT_LIGHTS " << numPointLights << "\n";
+	return ss.str();
+}
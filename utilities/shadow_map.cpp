@@ -0,0 +1,146 @@
+#include <shadow_map.h>
+#include <shader_interfaces.h>
+
+
+
+// Bias of the depth comparison, in normalized distance - see shadowFactor() in shaders/nanoShader.frag
+static const GLfloat SHADOW_BIAS = 0.005f;
+
+
+static GLuint
+createCube(GLuint size)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	for (GLuint face = 0; face < 6; face++) {
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT32F, size, size, 0,
+					 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	return textureID;
+}
+
+
+
+ShadowMap::ShadowMap(GLuint size, GLfloat far, GLfloat maxDrift)
+:size(size), far(far), maxDrift(maxDrift),
+ staticValid(false), dynamicEmpty(false), rendered(0)
+{
+	this->staticCube = createCube(size);
+	this->dynamicCube = createCube(size);
+
+	glGenFramebuffers(1, &this->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	// Depth only
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	this->depthProgram = new Program("shaders/shadowDepth.vs", "shaders/shadowDepth.frag", "shaders/shadowDepth.gs");
+	this->invalidateStatic();
+}
+
+
+ShadowMap::~ShadowMap()
+{
+	delete this->depthProgram;
+	glDeleteFramebuffers(1, &this->fbo);
+	glDeleteTextures(1, &this->staticCube);
+	glDeleteTextures(1, &this->dynamicCube);
+}
+
+
+void
+ShadowMap::invalidateStatic()
+{
+	this->staticValid = false;
+}
+
+
+void
+ShadowMap::update(const Scene& scene, const glm::vec3& lightPosition, const TransformSystem& transforms)
+{
+	this->lightPosition = lightPosition;
+	this->rendered = 0;
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, this->size, this->size);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+
+	// Static casters, when they changed or the light drifted too far from where they were rendered from
+	if (!this->staticValid || glm::length(lightPosition - this->staticPosition) > this->maxDrift) {
+		this->render(scene, transforms, this->staticCube, true, true);
+		this->staticPosition = lightPosition;
+		this->staticValid = true;
+	}
+
+	// Dynamic casters, every face
+	bool anyDynamic = false;
+	for (size_t i = 0; i < scene.size() && !anyDynamic; i++) {
+		uint32_t flags = scene.flags[i];
+		anyDynamic = (flags & ENTITY_DRAWABLE) && !(flags & (ENTITY_LIGHT | ENTITY_STATIC));
+	}
+	if (anyDynamic || !this->dynamicEmpty) {
+		this->render(scene, transforms, this->dynamicCube, false, anyDynamic);
+		this->dynamicEmpty = !anyDynamic;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+
+void
+ShadowMap::render(const Scene& scene, const TransformSystem& transforms, GLuint cube, bool staticCasters, bool any)
+{
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cube, 0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	if (!any) {
+		return;
+	}
+
+	Program& program = *this->depthProgram;
+	program.use();
+	transforms.bind(program);
+	program.set(Uniforms::shadowLightPos, this->lightPosition);
+	program.set(Uniforms::shadowFar, this->far);
+
+	size_t count = scene.size();
+	for (size_t i = 0; i < count; i++) {
+		uint32_t flags = scene.flags[i];
+		if (!(flags & ENTITY_DRAWABLE) || (flags & ENTITY_LIGHT) || ((flags & ENTITY_STATIC) != 0) != staticCasters) {
+			continue;
+		}
+		program.set(Uniforms::drawIndex, (GLint)i);
+		for (const Mesh& mesh : scene.modelTable[scene.models[i]].model->meshes) {
+			mesh.drawPositions();
+		}
+	}
+
+	this->rendered += 6;
+}
+
+
+void
+ShadowMap::bind(const Program& program) const
+{
+	glActiveTexture(GL_TEXTURE0 + SHADOW_STATIC_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, this->staticCube);
+	glActiveTexture(GL_TEXTURE0 + SHADOW_DYNAMIC_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, this->dynamicCube);
+	glActiveTexture(GL_TEXTURE0);
+
+	program.set(Uniforms::shadowStatic, (GLint)SHADOW_STATIC_TEXTURE_UNIT);
+	program.set(Uniforms::shadowDynamic, (GLint)SHADOW_DYNAMIC_TEXTURE_UNIT);
+	program.set(Uniforms::shadowLightPos, this->lightPosition);
+	program.set(Uniforms::shadowStaticLightPos, this->staticPosition);
+	program.set(Uniforms::shadowFar, this->far);
+	program.set(Uniforms::shadowBias, SHADOW_BIAS);
+}
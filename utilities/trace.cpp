@@ -0,0 +1,152 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+#include <trace.h>
+
+
+// The thread owning it is the only one writing events. 'head' counts them all: the event n is at
+// n % TRACE_EVENTS_PER_THREAD, and it is published by the release store of n + 1.
+struct ThreadBuffer {
+	vector<TraceEvent> events;
+	atomic<uint64_t> head;
+	uint32_t id;
+	string name;            // Under registryLock
+
+	ThreadBuffer(uint32_t id) :events(TRACE_EVENTS_PER_THREAD), head(0), id(id) {}
+};
+
+
+// Every thread's buffer. They are never freed, so the events of a thread that is gone still get written.
+static mutex registryLock;
+static vector<ThreadBuffer*> registry;
+
+static thread_local ThreadBuffer* localBuffer = nullptr;
+
+
+
+// Function static, so timing from static constructors of other files works
+static chrono::steady_clock::time_point
+epoch()
+{
+	static const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	return start;
+}
+
+
+static ThreadBuffer*
+threadBuffer()
+{
+	if (!localBuffer) {
+		lock_guard<mutex> lock(registryLock);
+		localBuffer = new ThreadBuffer(registry.size() + 1);
+		registry.push_back(localBuffer);
+	}
+	return localBuffer;
+}
+
+
+static void
+writeString(ostream& out, const string& s)
+{
+	out << '"';
+	for (char c : s) {
+		if (c == '"' || c == '\\') {
+			out << '\\';
+		}
+		out << c;
+	}
+	out << '"';
+}
+
+
+
+int64_t
+Trace::now()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch()).count();
+}
+
+
+void
+Trace::record(const char* name, int64_t start, int64_t end)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	uint64_t n = buffer->head.load(memory_order_relaxed);
+
+	TraceEvent& event = buffer->events[n % TRACE_EVENTS_PER_THREAD];
+	event.name = name;
+	event.start = start;
+	event.duration = end - start;
+
+	buffer->head.store(n + 1, memory_order_release);
+}
+
+
+void
+Trace::setThreadName(const string& name)
+{
+	ThreadBuffer* buffer = threadBuffer();
+	lock_guard<mutex> lock(registryLock);
+	buffer->name = name;
+}
+
+
+bool
+Trace::write(const string& path)
+{
+	ofstream out(path.c_str());
+	if (!out) {
+		cout << "Could not write the trace to " << path << endl;
+		return false;
+	}
+	out.setf(ios::fixed);
+	out.precision(3);
+
+	lock_guard<mutex> lock(registryLock);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	vector<TraceEvent> events;
+	for (ThreadBuffer* buffer : registry) {
+		// Copy the ring, then drop what its thread may have overwritten meanwhile. The slot of the event
+		// 'head' is being written before head moves past it, and it is the oldest one of a full ring, so the
+		// oldest slot is never copied: only TRACE_EVENTS_PER_THREAD - 1 events are complete at any time.
+		uint64_t end = buffer->head.load(memory_order_acquire);
+		uint64_t begin = (end >= TRACE_EVENTS_PER_THREAD) ? end - TRACE_EVENTS_PER_THREAD + 1 : 0;
+		events.clear();
+		for (uint64_t n = begin; n < end; n++) {
+			events.push_back(buffer->events[n % TRACE_EVENTS_PER_THREAD]);
+		}
+		// The fence keeps the copies above before the second load of head
+		atomic_thread_fence(memory_order_acquire);
+		uint64_t overwritten = buffer->head.load(memory_order_relaxed);
+		overwritten = (overwritten >= TRACE_EVENTS_PER_THREAD) ? overwritten - TRACE_EVENTS_PER_THREAD + 1 : 0;
+		size_t skip = (overwritten > begin) ? min<uint64_t>(overwritten - begin, events.size()) : 0;
+
+		if (!buffer->name.empty()) {
+			out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+				<< ",\"args\":{\"name\":";
+			writeString(out, buffer->name);
+			out << "}}";
+			first = false;
+		}
+
+		// Complete events, times in microseconds
+		for (size_t i = skip; i < events.size(); i++) {
+			out << (first ? "" : ",") << "\n{\"name\":";
+			writeString(out, events[i].name);
+			out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+				<< ",\"ts\":" << events[i].start / 1000.0 << ",\"dur\":" << events[i].duration / 1000.0 << "}";
+			first = false;
+		}
+	}
+	out << "\n]}\n";
+
+	cout << "Trace written to " << path << endl;
+	return true;
+}
@@ -0,0 +1,170 @@
+#include <cstring>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include <transform_system.h>
+#include <shader_interfaces.h>
+
+
+
+// out = a * b, column major 4x4 matrices
+static inline void
+multiply(const GLfloat* a, const GLfloat* b, GLfloat* out)
+{
+#if defined(__SSE__)
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 a2 = _mm_loadu_ps(a + 8);
+	__m128 a3 = _mm_loadu_ps(a + 12);
+
+	for (int j = 0; j < 4; j++) {
+		__m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[j * 4 + 0]));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[j * 4 + 1])));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[j * 4 + 2])));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[j * 4 + 3])));
+		_mm_storeu_ps(out + j * 4, r);
+	}
+#else
+	for (int j = 0; j < 4; j++) {
+		for (int i = 0; i < 4; i++) {
+			out[j * 4 + i] = a[i] * b[j * 4 + 0] + a[4 + i] * b[j * 4 + 1] +
+							 a[8 + i] * b[j * 4 + 2] + a[12 + i] * b[j * 4 + 3];
+		}
+	}
+#endif
+}
+
+
+// out column j = column j of a * s[j], for the 3 first columns
+static inline void
+scaleColumns(const GLfloat* a, const GLfloat s[3], GLfloat* out)
+{
+#if defined(__SSE__)
+	for (int j = 0; j < 3; j++) {
+		_mm_storeu_ps(out + j * 4, _mm_mul_ps(_mm_loadu_ps(a + j * 4), _mm_set1_ps(s[j])));
+	}
+#else
+	for (int j = 0; j < 3; j++) {
+		for (int i = 0; i < 4; i++) {
+			out[j * 4 + i] = a[j * 4 + i] * s[j];
+		}
+	}
+#endif
+}
+
+
+static inline GLfloat
+inverseSquare(GLfloat s)
+{
+	return (s != 0.0f) ? 1.0f / (s * s) : 0.0f;
+}
+
+
+
+TransformSystem::TransformSystem()
+:count(0), buffer(0), texture(0), capacity(0)
+{
+	glGenBuffers(1, &this->buffer);
+	glGenTextures(1, &this->texture);
+}
+
+
+TransformSystem::~TransformSystem()
+{
+	glDeleteTextures(1, &this->texture);
+	glDeleteBuffers(1, &this->buffer);
+}
+
+
+void
+TransformSystem::update(const Scene& scene, const glm::mat4& view, const glm::mat4& projection)
+{
+	this->count = scene.size();
+	if (this->staging.size() < (size_t)this->count * TRANSFORM_TEXELS) {
+		this->staging.resize(this->count * TRANSFORM_TEXELS);
+	}
+
+	const GLfloat* v = &view[0][0];
+	const GLfloat* p = &projection[0][0];
+
+	for (GLsizei i = 0; i < this->count; i++) {
+		const GLfloat* model = &scene.worldMatrices[i][0][0];
+		GLfloat* out = &this->staging[i * TRANSFORM_TEXELS][0];
+
+		memcpy(out, model, 16 * sizeof(GLfloat));
+		multiply(v, model, out + 16);
+		multiply(p, out + 16, out + 32);
+
+		// With model = T * R * S and a rigid view, inverse(transpose(mat3(view * model))) is
+		// mat3(view * model) with its columns divided by the squared scales - no inverse needed.
+		const glm::vec3& s = scene.scales[i];
+		GLfloat inverseScales[3] = { inverseSquare(s.x), inverseSquare(s.y), inverseSquare(s.z) };
+		scaleColumns(out + 16, inverseScales, out + 48);
+	}
+}
+
+
+GLint
+TransformSystem::push(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection)
+{
+	GLint index = this->count++;
+	if (this->staging.size() < (size_t)this->count * TRANSFORM_TEXELS) {
+		this->staging.resize(this->count * TRANSFORM_TEXELS);
+	}
+
+	glm::mat4 modelView = view * model;
+	glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelView)));
+
+	glm::vec4* out = &this->staging[index * TRANSFORM_TEXELS];
+	for (int c = 0; c < 4; c++) {
+		out[c] = model[c];
+		out[4 + c] = modelView[c];
+		out[8 + c] = (projection * modelView)[c];
+	}
+	for (int c = 0; c < 3; c++) {
+		out[12 + c] = glm::vec4(normalMatrix[c], 0.0f);
+	}
+
+	return index;
+}
+
+
+void
+TransformSystem::upload()
+{
+	size_t bytes = this->count * TRANSFORM_TEXELS * sizeof(glm::vec4);
+	if (bytes == 0) {
+		return;
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, this->buffer);
+	if (bytes > this->capacity) {
+		// Grow, and (re)attach the texture to the new storage
+		this->capacity = bytes;
+		glBufferData(GL_TEXTURE_BUFFER, this->capacity, this->staging.data(), GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+	else {
+		// Orphan the previous frame's storage so we don't wait for draws still reading it
+		glBufferData(GL_TEXTURE_BUFFER, this->capacity, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, this->staging.data());
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	RenderStats::frame.bytesUploaded += bytes;
+}
+
+
+void
+TransformSystem::bind(Program& program) const
+{
+	glActiveTexture(GL_TEXTURE0 + TRANSFORM_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->texture);
+	glActiveTexture(GL_TEXTURE0);
+	RenderStats::frame.textureBinds++;
+
+	program.set(Uniforms::transforms, (GLint)TRANSFORM_TEXTURE_UNIT);
+}
@@ -0,0 +1,216 @@
+#include <visibility_buffer.h>
+#include <texture_buffer.h>
+#include <shader_interfaces.h>
+
+
+
+static GLuint
+createTarget(GLint internalFormat, GLenum format, GLenum type, GLuint width, GLuint height)
+{
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+	// Read with texelFetch only
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return textureID;
+}
+
+
+
+VisibilityRenderer::VisibilityRenderer(GLuint width, GLuint height, GLuint numPointLights)
+:width(width), height(height), drawCapacity(0)
+{
+	this->ids = createTarget(GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, width, height);
+	this->depth = createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+
+	glGenFramebuffers(1, &this->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->ids, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, this->depth, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		cout << "Visibility buffer framebuffer is not complete." << endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &this->drawBuffer);
+	glGenTextures(1, &this->drawTexture);
+	glGenVertexArrays(1, &this->emptyVAO);
+
+	this->visibilityProgram = new Program("shaders/positionOnly.vs", "shaders/visibility.frag");
+	this->materialProgram = new Program("shaders/visibilityResolve.vs", "shaders/visibilityMaterial.frag");
+	this->resolveShaders = new ShaderPermutations("shaders/visibilityResolve.vs", "shaders/visibilityResolve.frag",
+												  numPointLights);
+}
+
+
+VisibilityRenderer::~VisibilityRenderer()
+{
+	delete this->visibilityProgram;
+	delete this->materialProgram;
+	delete this->resolveShaders;
+
+	glDeleteVertexArrays(1, &this->emptyVAO);
+	glDeleteTextures(1, &this->drawTexture);
+	glDeleteBuffers(1, &this->drawBuffer);
+	glDeleteFramebuffers(1, &this->fbo);
+	glDeleteTextures(1, &this->ids);
+	glDeleteTextures(1, &this->depth);
+}
+
+
+void
+VisibilityRenderer::render(const Scene& scene, const vector<DrawItem>& drawList, const TransformSystem& transforms)
+{
+	this->drawVisibility(scene, drawList, transforms);
+	this->uploadDraws();
+	this->resolve(transforms);
+}
+
+
+void
+VisibilityRenderer::drawVisibility(const Scene& scene, const vector<DrawItem>& drawList,
+								   const TransformSystem& transforms)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	GLuint background[4] = { 0, 0, 0, 0 };
+	glClearBufferuiv(GL_COLOR, 0, background);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	this->draws.clear();
+	this->meshes.clear();
+	this->meshSlots.clear();
+
+	Program& program = *this->visibilityProgram;
+	program.use();
+	transforms.bind(program);
+
+	for (const DrawItem& item : drawList) {
+		uint32_t i = item.index;
+		const ModelEntry& entry = scene.modelTable[scene.models[i]];
+		if (!entry.shaders) {
+			continue;
+		}
+		const MaterialOverride& material = scene.materials[i];
+		program.set(Uniforms::drawIndex, (GLint)i);
+
+		for (const Mesh& mesh : entry.model->meshes) {
+			if ((GLuint)mesh.indexCount / 3 > (1u << VISIBILITY_TRIANGLE_BITS)) {
+				static bool warned = false;
+				if (!warned) {
+					cout << "Visibility buffer: mesh of " << mesh.indexCount / 3 << " triangles is too big, skipped." << endl;
+					warned = true;
+				}
+				continue;
+			}
+			if (this->draws.size() / VISIBILITY_DRAW_TEXELS >= VISIBILITY_MAX_DRAWS) {
+				return;
+			}
+
+			unordered_map<const Mesh*, uint32_t>::const_iterator it = this->meshSlots.find(&mesh);
+			uint32_t slot;
+			if (it != this->meshSlots.end()) {
+				slot = it->second;
+			}
+			else {
+				// Slot VISIBILITY_MAX_MESHES - 1 would have depth 1, the background's
+				if (this->meshes.size() + 1 >= VISIBILITY_MAX_MESHES) {
+					continue;
+				}
+				slot = this->meshes.size();
+				this->meshSlots[&mesh] = slot;
+				this->meshes.push_back(&mesh);
+			}
+
+			GLuint draw = this->draws.size() / VISIBILITY_DRAW_TEXELS;
+			this->draws.push_back(glm::vec4((GLfloat)i, (GLfloat)slot, material.shininess, 0.0f));
+			this->draws.push_back(glm::vec4(material.color, 0.0f));
+			this->draws.push_back(glm::vec4(material.ambient, 0.0f));
+			this->draws.push_back(glm::vec4(material.diffuse, 0.0f));
+			this->draws.push_back(glm::vec4(material.specular, 0.0f));
+
+			program.set(Uniforms::visibilityDraw, draw + 1);
+			mesh.drawPositions();
+		}
+	}
+}
+
+
+void
+VisibilityRenderer::uploadDraws()
+{
+	uploadTextureBuffer(this->drawBuffer, this->drawTexture, GL_RGBA32F, this->draws.data(),
+						this->draws.size() * sizeof(glm::vec4), this->drawCapacity);
+}
+
+
+void
+VisibilityRenderer::resolve(const TransformSystem& transforms)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glActiveTexture(GL_TEXTURE0 + VISIBILITY_IDS_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, this->ids);
+	glActiveTexture(GL_TEXTURE0 + VISIBILITY_DRAWS_TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, this->drawTexture);
+	glActiveTexture(GL_TEXTURE0);
+
+	glBindVertexArray(this->emptyVAO);
+	RenderStats::frame.vaoBinds++;
+
+	// Mesh depths, no color
+	this->materialProgram->use();
+	this->materialProgram->set(Uniforms::visibilityIds, (GLint)VISIBILITY_IDS_TEXTURE_UNIT);
+	this->materialProgram->set(Uniforms::visibilityDraws, (GLint)VISIBILITY_DRAWS_TEXTURE_UNIT);
+	this->materialProgram->set(Uniforms::meshDepth, 0.0f);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthFunc(GL_ALWAYS);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	RenderStats::frame.draw(GL_TRIANGLES, 3);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	// One pass per mesh, only its pixels pass the depth test
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+	uint32_t resolveFeatures = SHADER_TEXTURED | SHADER_HAS_SPECULAR_MAP | SHADER_NORMAL_MAP;
+	for (uint32_t slot = 0; slot < this->meshes.size(); slot++) {
+		const Mesh& mesh = *this->meshes[slot];
+		Program& program = *this->resolveShaders->get(mesh.shaderFeatures & resolveFeatures);
+		program.use();
+		transforms.bind(program);
+		program.set(Uniforms::visibilityIds, (GLint)VISIBILITY_IDS_TEXTURE_UNIT);
+		program.set(Uniforms::visibilityDraws, (GLint)VISIBILITY_DRAWS_TEXTURE_UNIT);
+		program.set(Uniforms::meshVertices, (GLint)VISIBILITY_VERTICES_TEXTURE_UNIT);
+		program.set(Uniforms::meshIndices, (GLint)VISIBILITY_INDICES_TEXTURE_UNIT);
+		program.set(Uniforms::meshDepth, (GLfloat)(slot + 1) / VISIBILITY_MAX_MESHES);
+
+		mesh.bindVertexData(VISIBILITY_VERTICES_TEXTURE_UNIT, VISIBILITY_INDICES_TEXTURE_UNIT);
+		mesh.bindMaterial(program);
+		glBindVertexArray(this->emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		RenderStats::frame.vaoBinds++;
+		RenderStats::frame.draw(GL_TRIANGLES, 3);
+		mesh.unbindMaterial();
+	}
+	glBindVertexArray(0);
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+
+	GLuint units[4] = { VISIBILITY_IDS_TEXTURE_UNIT, VISIBILITY_DRAWS_TEXTURE_UNIT,
+						VISIBILITY_VERTICES_TEXTURE_UNIT, VISIBILITY_INDICES_TEXTURE_UNIT };
+	for (int u = 0; u < 4; u++) {
+		glActiveTexture(GL_TEXTURE0 + units[u]);
+		glBindTexture(u == 0 ? GL_TEXTURE_2D : GL_TEXTURE_BUFFER, 0);
+	}
+	glActiveTexture(GL_TEXTURE0);
+
+	// Replace the mesh depths by the scene's, for the forward draws that follow
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, this->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height,
+					  GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}